@@ -2,105 +2,313 @@
 // See https://teuder.github.io/rcpp4everyone_en/140_dataframe.html
 // [[Rcpp::plugins("cpp17")]]
 #include <Rcpp.h>
+#include <R_ext/Altrep.h>
 #include <cncpp.hpp>
+#include <algorithm>
 #include <iostream>
 #include <map>
+#include <memory>
 
 using namespace Rcpp;
 using namespace std;
 using namespace cncpp;
 
+// A program with its timeline. The lazy columns returned by simulate() share
+// it, so that it stays alive, and unchanged, as long as any of them is
+// referenced in R
+struct Model {
+  shared_ptr<Machine> machine;
+  Program program;
+  unique_ptr<Trajectory> traj; // built when needed
+
+  Model(shared_ptr<Machine> m) : machine(m), program(m.get()) {}
+  Trajectory &trajectory() {
+    if (!traj) traj = make_unique<Trajectory>(program, *machine);
+    return *traj;
+  }
+};
+
+
+// Lazy columns (ALTREP) -------------------------------------------------------
+// Elements are computed on access from the trajectory; the whole column is
+// only materialized when R asks for a pointer to its data
+
+enum class Column { N, TYPE, TIME, T_TIME, LAMBDA, SPEED, ACC, X, Y, Z };
+
+static const vector<pair<Column, const char *>> columns = {
+  {Column::N, "n"}, {Column::TYPE, "type"}, {Column::TIME, "time"},
+  {Column::T_TIME, "t_time"}, {Column::LAMBDA, "lambda"},
+  {Column::SPEED, "speed"}, {Column::ACC, "acc"}, {Column::X, "x"},
+  {Column::Y, "y"}, {Column::Z, "z"}
+};
+
+struct LazyColumn {
+  shared_ptr<Model> model;
+  Column col;
+  size_t first, count; // ticks [first, first + count)
+};
+
+static R_altrep_class_t real_class, string_class;
+
+static LazyColumn &column(SEXP x) {
+  return *static_cast<LazyColumn *>(R_ExternalPtrAddr(R_altrep_data1(x)));
+}
+
+static double value(const Trajectory::Sample &s, Column col) {
+  switch (col) {
+  case Column::N: return s.block->n();
+  case Column::TIME: return s.t;
+  case Column::T_TIME: return s.time;
+  case Column::LAMBDA: return s.lambda;
+  case Column::SPEED: return s.speed;
+  case Column::ACC: return s.block->profile().current_acc;
+  case Column::X: return s.position.x();
+  case Column::Y: return s.position.y();
+  case Column::Z: return s.position.z();
+  default: return NA_REAL;
+  }
+}
+
+// Elements [i, i + n) of c, in a single walk of the trajectory
+static void fill(LazyColumn &c, size_t i, size_t n, double *buf) {
+  size_t start = c.first + i;
+  c.model->trajectory().walk([&](const Trajectory::Sample &s) {
+    buf[s.tick - start] = value(s, c.col);
+  }, start, start + n);
+}
+
+static void fill_types(LazyColumn &c, SEXP out) {
+  c.model->trajectory().walk([&](const Trajectory::Sample &s) {
+    SET_STRING_ELT(out, s.tick - c.first,
+                   Rf_mkChar(Block::types.at(s.block->type()).c_str()));
+  }, c.first, c.first + c.count);
+}
+
+// Plain copy of the column, kept in data2 once made
+static SEXP materialize(SEXP x) {
+  SEXP data = R_altrep_data2(x);
+  if (data != R_NilValue) return data;
+  LazyColumn &c = column(x);
+  if (c.col == Column::TYPE) {
+    data = PROTECT(Rf_allocVector(STRSXP, c.count));
+    fill_types(c, data);
+  } else {
+    data = PROTECT(Rf_allocVector(REALSXP, c.count));
+    fill(c, 0, c.count, REAL(data));
+  }
+  R_set_altrep_data2(x, data);
+  UNPROTECT(1);
+  return data;
+}
+
+static R_xlen_t lazy_length(SEXP x) {
+  return column(x).count;
+}
+
+static Rboolean lazy_inspect(SEXP x, int pre, int deep, int pvec,
+                             void (*inspect_sub)(SEXP, int, int, int)) {
+  LazyColumn &c = column(x);
+  Rprintf("cncpp lazy column: %zu samples from tick %zu%s\n", c.count, c.first,
+          R_altrep_data2(x) == R_NilValue ? "" : " (materialized)");
+  return TRUE;
+}
+
+static void *lazy_dataptr(SEXP x, Rboolean writeable) {
+  return DATAPTR(materialize(x));
+}
+
+static const void *lazy_dataptr_or_null(SEXP x) {
+  SEXP data = R_altrep_data2(x);
+  return data == R_NilValue ? nullptr : DATAPTR(data);
+}
+
+static double real_elt(SEXP x, R_xlen_t i) {
+  SEXP data = R_altrep_data2(x);
+  if (data != R_NilValue) return REAL(data)[i];
+  LazyColumn &c = column(x);
+  return value(c.model->trajectory().tick(c.first + i), c.col);
+}
+
+static R_xlen_t real_get_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf) {
+  LazyColumn &c = column(x);
+  n = min<R_xlen_t>(n, c.count - i);
+  if (n <= 0) return 0;
+  SEXP data = R_altrep_data2(x);
+  if (data != R_NilValue)
+    copy(REAL(data) + i, REAL(data) + i + n, buf);
+  else
+    fill(c, i, n, buf);
+  return n;
+}
+
+static SEXP string_elt(SEXP x, R_xlen_t i) {
+  SEXP data = R_altrep_data2(x);
+  if (data != R_NilValue) return STRING_ELT(data, i);
+  LazyColumn &c = column(x);
+  Block *b = c.model->trajectory().tick(c.first + i).block;
+  return Rf_mkChar(Block::types.at(b->type()).c_str());
+}
+
+static void string_set_elt(SEXP x, R_xlen_t i, SEXP v) {
+  SET_STRING_ELT(materialize(x), i, v);
+}
+
+static void register_classes() {
+  static bool done = false;
+  if (done) return;
+  // sourceCpp gives no DllInfo; it is only used to look the classes up when
+  // unserializing, and these classes are serialized as plain vectors
+  real_class = R_make_altreal_class("cncpp_real", "cncpp", nullptr);
+  string_class = R_make_altstring_class("cncpp_string", "cncpp", nullptr);
+  for (auto cls : {real_class, string_class}) {
+    R_set_altrep_Length_method(cls, lazy_length);
+    R_set_altrep_Inspect_method(cls, lazy_inspect);
+    R_set_altvec_Dataptr_method(cls, lazy_dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls, lazy_dataptr_or_null);
+  }
+  R_set_altreal_Elt_method(real_class, real_elt);
+  R_set_altreal_Get_region_method(real_class, real_get_region);
+  R_set_altstring_Elt_method(string_class, string_elt);
+  R_set_altstring_Set_elt_method(string_class, string_set_elt);
+  done = true;
+}
+
+static SEXP lazy_column(shared_ptr<Model> model, Column col, size_t first,
+                        size_t count) {
+  register_classes();
+  SEXP ptr = PROTECT(R_MakeExternalPtr(new LazyColumn{model, col, first, count},
+                                       R_NilValue, R_NilValue));
+  R_RegisterCFinalizerEx(ptr, [](SEXP p) {
+    delete static_cast<LazyColumn *>(R_ExternalPtrAddr(p));
+    R_ClearExternalPtr(p);
+  }, TRUE);
+  SEXP x = R_new_altrep(col == Column::TYPE ? string_class : real_class, ptr,
+                        R_NilValue);
+  UNPROTECT(1);
+  return x;
+}
+
+
 // Wrapper class
 class CNCpp {
 
 public:
-  CNCpp(List blocks, string machine) : 
-    _blocks(blocks), _machine(machine), _prog(&_machine) {
+  CNCpp(List blocks, string machine) :
+    _blocks(blocks), _machine(make_shared<Machine>(machine)),
+    _model(make_shared<Model>(_machine)) {
     load(blocks);
   }
-  
-  CNCpp(string machine) : _machine(machine), _prog(&_machine) {}
-  
+
+  CNCpp(string machine) :
+    _machine(make_shared<Machine>(machine)),
+    _model(make_shared<Model>(_machine)) {}
+
   string version() {
     return cncpp::version();
   }
-  
+
   void reset() {
-    _prog.clear();
-  }
-  
-  DataFrame simulate() {
-    NumericVector n, t_time, time, lambda, speed, acc, x, y, z;
-    CharacterVector type;
-    data_t dt = _machine.tq();
-    size_t i = 0;
-    
-    for (auto &b : _prog) {
-      if (b.type() == Block::BlockType::NO_MOTION) {
-        continue;
-      } else if (b.type() == Block::BlockType::RAPID) {
-        type.push_back(Block::types.at(b.type()));
-        Point pos = b.target();
-        n.push_back(b.n());
-        t_time.push_back(i++ * dt);
-        time.push_back(0);
-        lambda.push_back(1);
-        speed.push_back(b.feedrate());
-        acc.push_back(0);
-        x.push_back(pos.x());
-        y.push_back(pos.y());
-        z.push_back(pos.z());
-        continue;
-      }
-      b.walk([&](Block &b, data_t t, data_t l, data_t s) {
-        type.push_back(Block::types.at(b.type()));
-        Point pos = b.interpolate(l);
-        n.push_back(b.n());
-        t_time.push_back(i++ * dt);
-        time.push_back(t);
-        lambda.push_back(l);
-        speed.push_back(s);
-        acc.push_back(b.profile().current_acc);
-        x.push_back(pos.x());
-        y.push_back(pos.y());
-        z.push_back(pos.z());
-      });
+    _file.clear();
+    _lines.clear();
+    fresh();
+  }
+
+  // All the samples of the program, on the tq clock
+  List simulate() {
+    return simulate_window(0, R_PosInf);
+  }
+
+  // Samples with t0 <= t_time < t1 only. Columns are lazy: a sample is only
+  // computed when R accesses it (e.g. head(df) computes 6 samples)
+  List simulate_window(double t0, double t1) {
+    Trajectory &traj = _model->trajectory();
+    size_t first = traj.tick_at(t0);
+    size_t last = R_finite(t1) ? traj.tick_at(t1) : traj.ticks();
+    last = min(last, traj.ticks());
+    size_t count = last > first ? last - first : 0;
+
+    List df(columns.size());
+    CharacterVector names(columns.size());
+    for (size_t i = 0; i < columns.size(); i++) {
+      df[i] = lazy_column(_model, columns[i].first, first, count);
+      names[i] = columns[i].second;
     }
-    
-    DataFrame df = DataFrame::create(
-      _["n"] = n,
-      _["type"] = type,
-      _["time"] = time,
-      _["t_time"] = t_time,
-      _["lambda"] = lambda,
-      _["speed"] = speed,
-      _["acc"] = acc,
-      _["x"] = x,
-      _["y"] = y,
-      _["z"] = z
-    );
+    // set as a data.frame directly: data.frame() could touch the elements
+    df.attr("names") = names;
+    df.attr("class") = "data.frame";
+    df.attr("row.names") = IntegerVector::create(NA_INTEGER, -int(count));
     return df;
   }
-  
+
+  // Program duration (s)
+  double duration() {
+    return _model->trajectory().duration();
+  }
+
   string program() {
-    return _prog.desc(false);
+    return _model->program.desc(false);
   }
-  
+
   void load_file(string file) {
-    _prog.rewind();
-    _prog.load(file);
+    _file = file;
+    _lines.clear();
+    fresh();
+    read(*_model, file);
+  }
+
+  // parsed and planned programs are cached in dir (empty: no cache)
+  void set_cache(string dir) {
+    _cache_dir = dir;
   }
-  
+
   void load(List blocks) {
+    Model &m = edit();
     for (auto &b : blocks) {
-      _prog << as<string>(b);
+      string line = as<string>(b);
+      m.program << line;
+      _lines.push_back(line);
     }
   }
-  
+
 private:
   List _blocks;
-  Machine _machine;
-  Program _prog;
+  shared_ptr<Machine> _machine;
+  shared_ptr<Model> _model;
+  string _cache_dir;
+  // what _model was made of, to rebuild it: file, then appended lines
+  string _file;
+  vector<string> _lines;
+
+  void read(Model &m, const string &file) {
+    m.program.rewind();
+    if (_cache_dir.empty())
+      m.program.load(file);
+    else
+      Cache(_cache_dir).load(m.program, file);
+  }
+
+  // Empty model to be filled. Lazy columns still referencing the current one
+  // keep it untouched
+  void fresh() {
+    if (_model.use_count() > 1)
+      _model = make_shared<Model>(_machine);
+    else {
+      _model->program.reset();
+      _model->traj.reset();
+    }
+  }
+
+  // Model to be appended to: copied (by parsing again) if still referenced
+  Model &edit() {
+    if (_model.use_count() > 1) {
+      auto m = make_shared<Model>(_machine);
+      if (!_file.empty()) read(*m, _file);
+      for (auto &l : _lines) m->program << l;
+      _model = m;
+    }
+    _model->traj.reset();
+    return *_model;
+  }
 };
 
 
@@ -113,10 +321,13 @@ RCPP_MODULE(cncpp) {
     .constructor<List, string>()
     .constructor<string>()
     .method("simulate", &CNCpp::simulate)
+    .method("simulate", &CNCpp::simulate_window)
+    .method("duration", &CNCpp::duration)
     .method("load", &CNCpp::load)
     .method("load_file", &CNCpp::load_file)
+    .method("set_cache", &CNCpp::set_cache)
     .method("version", &CNCpp::version)
     .method("reset", &CNCpp::reset)
     .method("program", &CNCpp::program)
     ;
-}
\ No newline at end of file
+}
@@ -15,6 +15,9 @@ Class Implementation
 #include <rang.hpp>
 #include <sstream>
 #include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <algorithm>
 
 // Only include iostream if DEBUG_BUILD is defined
 // then mark any line with: cout << "Check " << __LINE__ << endl;
@@ -37,39 +40,16 @@ const map<Block::BlockType, string> Block::types = {
   {BlockType::NO_MOTION, "No Motion"}
 };
 
-data_t Block::Profile::lambda(data_t t, data_t &s) {
-  data_t r;
-  current_acc = 0.0;
-
-  if (t < 0) {
-    r = 0.0;
-    s = 0.0;
-  } else if (t < dt_1) { // Acceleration
-    r = a * pow(t, 2) / 2.0;
-    s = a * t;
-    current_acc = a;
-  } else if (t < dt_1 + dt_m) { // Maintenance
-    r = f * (dt_1 / 2.0 + (t - dt_1));
-    s = f;
-    current_acc = 0;
-  } else if (t < dt_1 + dt_m + dt_2) { // Deceleration
-    data_t t_2 = dt_1 + dt_m;
-    r = f * dt_1 / 2.0 + f * (dt_m + t - t_2) +
-        d / 2.0 *(pow(t, 2) + pow(t_2, 2)) - d * t * t_2;
-    s = f + d * (t - t_2);
-    current_acc = d;
-  } else {
-    r = 1.0;
-    s = 0.0;
-    current_acc = 0.0;
-  }
-
-  r /= l;
-  s *= 60;
-  return r;
-}
-
-
+const map<Block::Error, string> Block::errors = {
+  {Error::NONE, "No error"},
+  {Error::EMPTY_ARGUMENT, "Empty command argument"},
+  {Error::BAD_NUMBER, "Invalid number"},
+  {Error::UNKNOWN_COMMAND, "Unknown/unsupported command"},
+  {Error::UNKNOWN_G, "Unknown G type"},
+  {Error::N_NOT_INCREASING, "Block number must be increasing"},
+  {Error::ARC_MISMATCH, "Arc endpoints mismatch error"},
+  {Error::FEED_OVER_FMAX, "Feedrate above machine fmax"}
+};
 
 /*
   ____        _     _ _        __  __      _   _               _     
@@ -81,34 +61,55 @@ data_t Block::Profile::lambda(data_t t, data_t &s) {
 */
 
 // LIFECYCLE -----------------------------------------------------------------
-Block::Block(string line) : _line(line), _n(0) {}
+Block::Block(std::string_view line, Source &source)
+    : Block(source, source.add(line)) {}
+
+Block::Block(Source &source, Source::Ref line) : _info(make_unique<Info>()) {
+  _info->source = &source;
+  _info->line = line;
+}
 
-Block::Block(string line, Block &p) : Block(line) {
+Block::Block(const Block &b)
+    : _profile(b._profile), _geometry(b._geometry), _type(b._type),
+      _parsed(b._parsed), _info(make_unique<Info>(*b._info)), prev(b.prev),
+      next(b.next) {}
+
+Block::Block(std::string_view line, Block &p) : Block(line, *p._info->source) {
   *this = p; // copy from previous object
 }
 
 Block::~Block() {
   if (_debug) 
     cerr << style::italic 
-         << format("Block {:>3} destroyed [{:p}].", _n, (void *)(this))
+         << format("Block {:>3} destroyed [{:p}].", _info->n, (void *)(this))
          << style::reset << endl;
 }
 
 Block &Block::operator=(Block &b) {
   if (!b._parsed) throw CNCError("Previous block has not been parsed", this);
-  _tool = b._tool;
-  _feedrate = b._feedrate;
-  _spindle = b._spindle;
-  _n = b._n + 1;
-  _target.reset();
+  _info->tool = b._info->tool;
+  _info->feedrate = b._info->feedrate;
+  _info->spindle = b._info->spindle;
+  _info->n = b._info->n + 1;
+  _info->target.reset();
   b.next = this;
   prev = &b;
   return *this;
 }
 
+// Back to the state of a block just created from its line, before parsing
+void Block::reset() {
+  _profile = Profile{};
+  _geometry = Geometry{};
+  _type = BlockType::NO_MOTION;
+  _parsed = false;
+  *_info = Info{nullptr, _info->source, _info->line};
+  prev = next = nullptr;
+}
+
 string Block::desc(bool colored) const {
   if (!_parsed) {
-    return format("[{:>3}] {:} (not parsed yet)", _n, _line);
+    return format("[{:>3}] {:} (not parsed yet)", _info->n, line());
   }
 
   stringstream ss;
@@ -125,69 +126,137 @@ string Block::desc(bool colored) const {
   // {:0>2}   -> pad with "0", right align, 2 chars wide
   // {:-^9}   -> pad with "-", center align, 9 chars wide
   // {:>5.0f} -> right align, 5 chars wide, 0 decimals float
-  ss << format("[{:>3}] ", _n);
+  ss << format("[{:>3}] ", _info->n);
   if (colored)
     ss << format("G{:0>2} ", styled(static_cast<int>(_type), fmt::fg(color)));
   else
     ss << format("G{:0>2} ", static_cast<int>(_type));
-  ss << format("({:-^9}) ", Block::types.at(_type)) << _target.desc();
-  ss << format(" F{:>5.0f} S{:>4.0f} ", _feedrate, _spindle);
-  ss << format("T{:0>2} M{:0>2} ", _tool, _m);
-  ss << format("L{:>6.2f}mm DT{:>6.2f}s", _length, _profile.dt);
+  ss << format("({:-^9}) ", Block::types.at(_type)) << _info->target.desc();
+  ss << format(" F{:>5.0f} S{:>4.0f} ", _info->feedrate, _info->spindle);
+  ss << format("T{:0>2} M{:0>2} ", _info->tool, _info->m);
+  ss << format("L{:>6.2f}mm DT{:>6.2f}s", _geometry.length, _profile.dt);
   return ss.str();
 }
 
 
 
 // METHODS -------------------------------------------------------------------
-Block &Block::parse(const Machine *m) {
-  _machine = m;
-  // initilize a stringstream with _line:
-  stringstream ss(_line);
-  string token;
-
-  // ss >> token returns a word at a time; returns false at the end
-  while (ss >> token) {
-    try {
-      // this is gonna be long, we factor it out to a dedicated private method:
-      parse_token(token);
-    } catch (CNCError &e) {
-      stringstream ss;
-      ss << "Parsing error at line: " << _line << endl;
-      ss << "Token: " << token << endl;
-      ss << "Exception: " << e.what() << endl;
-      throw CNCError(ss.str(), this);
-    }
+Block &Block::parse(const Machine *m, bool planned) {
+  Errors found;
+  if (try_parse(m, &found, planned) != Error::NONE) {
+    stringstream ss;
+    ss << "Parsing error at line: " << line() << endl;
+    ss << "Token: " << found.front().second << endl;
+    ss << "Exception: " << errors.at(found.front().first) << endl;
+    throw CNCError(ss.str(), this);
   }
+  return *this;
+}
+
+Block::Error Block::try_parse(const Machine *m, Errors *found, bool planned) {
+  Error first = Error::NONE;
+  auto report = [&](Error e, std::string_view what) {
+    if (first == Error::NONE) first = e;
+    if (found) found->emplace_back(e, string(what));
+  };
+  _info->machine = m;
+
+  // this is gonna be long, we factor it out to a dedicated private method:
+  tokenize(_info->source->view(_info->line), [&](std::string_view token) {
+    Error e = parse_token(token);
+    if (e != Error::NONE) report(e, token);
+  });
 
   // Modal (i.e. inherited) fields
-  _target.modal(start_point());
-  _delta = _target.delta(start_point());
-  _acc = _machine->A();
-  _length = _delta.length();
+  _info->target.modal(start_point());
+  _geometry.start = start_point().vec();
+  _geometry.delta = _info->target.delta(start_point()).vec();
+  _geometry.length = _geometry.delta.length();
+  if (_type == BlockType::CWA || _type == BlockType::CCWA) {
+    if (data_t mismatch; calc_arc(mismatch) != Error::NONE)
+      report(Error::ARC_MISMATCH, format("{:}", mismatch));
+  }
 
-  // Interpolated motion
+  // Speed profile, that only depends on the geometry and the machine
+  if (planned) plan(*_info->machine);
+  // done, set the flag:
+  _parsed = true;
+  return first;
+}
+
+void Block::plan(const Machine &m) {
+  _info->machine = &m;
+  _info->acc = m.A();
+  // Interpolated motion: feedrate and acceleration limited by the axes
   switch (_type) {
-    case BlockType::LINE:
-      _acc = _machine->A();
-      _arc_feedrate = _feedrate;
-      compute();
+    case BlockType::LINE: {
+      Vec3 cosines = _geometry.length > 0
+                         ? _geometry.delta * (1 / _geometry.length)
+                         : Vec3{};
+      _info->acc = m.acc_limit(cosines);
+      _info->arc_feedrate = min(_info->feedrate, feed_limit(m));
       break;
+    }
     case BlockType::CWA:
-    case BlockType::CCWA:
-      calc_arc();
-      _arc_feedrate = min(
-        _feedrate,
-        pow(3.0 / 4.0 * pow(_machine->A(), 2) * pow(_r, 2), 0.25) * 60
-      );
-      compute();
+    case BlockType::CCWA: {
+      // the tangent sweeps the XY plane: the planar component is checked
+      // against both X and Y. Half of the planar acceleration is left to the
+      // tangential component, the rest to the centripetal one (see below)
+      data_t l = _geometry.length > 0 ? _geometry.length : 1;
+      data_t c_xy = fabs(_geometry.dtheta * _geometry.r) / l;
+      Vec3 cosines(c_xy, c_xy, fabs(_geometry.delta.z()) / l);
+      data_t a_xy = min(m.amax(0), m.amax(1));
+      _info->acc = min(m.acc_limit(cosines), a_xy / 2);
+      _info->arc_feedrate = min(_info->feedrate, feed_limit(m));
       break;
-    default:
+    }
+    case BlockType::RAPID: {
+      // as fast as fmax and the axes allow, along the segment
+      Vec3 cosines = _geometry.length > 0
+                         ? _geometry.delta * (1 / _geometry.length)
+                         : Vec3{};
+      _info->acc = m.acc_limit(cosines);
+      _info->arc_feedrate = m.feed_limit(cosines);
+      if (m.dogleg() && _geometry.length > 0) {
+        // each axis on its own: the slowest one sets the duration, and
+        // lambda is its traveled fraction (see interpolate(time, ...))
+        for (size_t i = 0; i < 3; i++) {
+          Profile p = axis_profile(i);
+          if (p.dt > _profile.dt || i == 0) {
+            _profile = p;
+            _info->acc = m.amax(i);
+            _info->arc_feedrate = min(m.vmax(i), m.fmax());
+          }
+        }
+        return;
+      }
       break;
+    }
+    default:
+      return;
+  }
+  _profile.plan(_geometry.length, _info->arc_feedrate, _info->acc);
+}
+
+data_t Block::feed_limit(const Machine &m) const {
+  data_t l = _geometry.length > 0 ? _geometry.length : 1;
+  switch (_type) {
+    case BlockType::LINE:
+    case BlockType::RAPID:
+      return m.feed_limit(_geometry.delta * (1 / l));
+    case BlockType::CWA:
+    case BlockType::CCWA: {
+      // see plan() for the split of the planar acceleration
+      data_t c_xy = fabs(_geometry.dtheta * _geometry.r) / l;
+      Vec3 cosines(c_xy, c_xy, fabs(_geometry.delta.z()) / l);
+      data_t a_xy = min(m.amax(0), m.amax(1));
+      return min<data_t>(
+          m.feed_limit(cosines),
+          pow(3.0 / 4.0 * pow(a_xy, 2) * pow(_geometry.r, 2), 0.25) * 60);
+    }
+    default:
+      return m.fmax();
   }
-  // done, set the flag:
-  _parsed = true;
-  return *this;
 }
 
 // Just a wrapper to the profile lambda:
@@ -196,44 +265,110 @@ data_t Block::lambda(data_t time, data_t &speed) {
   return _profile.lambda(time, speed);
 }
 
-Point Block::interpolate(data_t lambda) {
+Vec3 Block::interpolate(data_t lambda) {
   if (!_parsed) throw CNCError("Block not parsed", this);
-  Point result = Point();
-  Point p0 = start_point();
-  
-  // 1. the block describes a segment
-  // x(t) = x(0) + d_x * lambda(t)
-  // y(t) = y(0) + d_y * lambda(t)
-  // z(t) = z(0) + d_z * lambda(t)
-  if (_type == BlockType::LINE) {
-    result.x(p0.x() + _delta.x() * lambda);
-    result.y(p0.y() + _delta.y() * lambda);
+  return _geometry.interpolate(lambda);
+}
+
+Vec3 Block::interpolate(data_t time, data_t &lambda, data_t &speed) {
+  lambda = this->lambda(time, speed);
+  if (!dogleg()) return interpolate(lambda);
+  return axes_position(time, speed);
+}
+
+Vec3 Block::position(data_t time, data_t &lambda, data_t &speed) const {
+  if (!_parsed) throw CNCError("Block not parsed", this);
+  Profile p = _profile;
+  lambda = p.lambda(time, speed);
+  if (!dogleg()) return _geometry.interpolate(lambda);
+  return axes_position(time, speed);
+}
+
+Vec3 Block::axes_position(data_t time, data_t &speed) const {
+  Vec3 p = _geometry.start, v;
+  for (size_t i = 0; i < 3; i++) {
+    if (_geometry.delta.c[i] == 0) continue;
+    Profile a = axis_profile(i);
+    p.c[i] += _geometry.delta.c[i] * a.lambda(time, v.c[i]);
   }
-  
-  // 2. the block describes an arc
-  else if (_type == BlockType::CWA || _type == BlockType::CCWA) {
-    data_t angle = _theta_0 + _dtheta * lambda;
-    result.x(_center.x() + _r * cos(angle));
-    result.y(_center.y() + _r * sin(angle));
+  speed = v.length();
+  return p;
+}
+
+bool Block::dogleg() const {
+  return _type == BlockType::RAPID && _info->machine &&
+         _info->machine->dogleg() && _geometry.length > 0;
+}
+
+void Block::path(data_t tol, vector<Vec3> &points) const {
+  if (!_parsed) throw CNCError("Block not parsed", this);
+  points.clear();
+  if (!dogleg()) {
+    size_t n = 1;
+    if (_geometry.arc && _geometry.r > tol)
+      n = min<size_t>(
+          ceil(fabs(_geometry.dtheta) / (2 * acos(1 - tol / _geometry.r))),
+          100000);
+    n = max<size_t>(n, 1);
+    for (size_t k = 0; k <= n; k++)
+      points.push_back(_geometry.interpolate(data_t(k) / n));
+    return;
+  }
+  // as interpolate(time), on local copies of the axis profiles: blocks can
+  // be shared by concurrent callers
+  Profile axes[3] = {axis_profile(0), axis_profile(1), axis_profile(2)};
+  Vec3 acc;
+  auto at = [&](data_t t) {
+    Vec3 p = _geometry.start;
+    data_t v;
+    for (size_t i = 0; i < 3; i++) {
+      if (_geometry.delta.c[i] == 0) continue;
+      p.c[i] += _geometry.delta.c[i] * axes[i].lambda(t, v);
+      acc.c[i] = copysign(axes[i].current_acc, _geometry.delta.c[i]);
+    }
+    return p;
+  };
+  // between the phase changes of the axes the path is a parabola in time,
+  // whose chords of duration h are within |a| h^2 / 8 of it
+  vector<data_t> times = {0, _profile.dt};
+  for (size_t i = 0; i < 3; i++) {
+    if (_geometry.delta.c[i] == 0) continue;
+    times.push_back(axes[i].dt_1);
+    times.push_back(axes[i].dt_1 + axes[i].dt_m);
+    times.push_back(axes[i].dt);
+  }
+  sort(times.begin(), times.end());
+  points.push_back(at(0));
+  for (size_t j = 1; j < times.size(); j++) {
+    data_t t0 = times[j - 1], t1 = min(times[j], _profile.dt);
+    if (!(t1 > t0)) continue;
+    at((t0 + t1) / 2); // acceleration within the phase
+    data_t a = acc.length();
+    size_t n = a > 0 ? min<size_t>(ceil((t1 - t0) / sqrt(8 * tol / a)), 100000)
+                     : 1;
+    n = max<size_t>(n, 1);
+    for (size_t k = 1; k <= n; k++)
+      points.push_back(at(t0 + (t1 - t0) * k / n));
   }
-  // Z increases linearly for both arcs and segments
-  result.z(p0.z() + _delta.z() * lambda);
-  return result;
 }
 
-Point Block::interpolate(data_t time, data_t &lambda, data_t &speed) {
-  lambda = this->lambda(time, speed);
-  return interpolate(lambda);
+Block::Profile Block::axis_profile(size_t i) const {
+  Profile p{};
+  data_t l = fabs(_geometry.delta.c[i]);
+  const Machine &m = *_info->machine;
+  if (l > 0) p.plan(l, min(m.vmax(i), m.fmax()), m.amax(i));
+  return p;
 }
 
 void Block::walk(function<void(Block &b, data_t t, data_t l, data_t s)> f) {
   if (!_parsed) throw CNCError("Block not parsed", this);
-  data_t t = 0.0, l, s;
-  // 1.0 / 10.0 != 1.0
-  while (t < _profile.dt) {
+  data_t l, s;
+  // integer ticks: accumulating t += tq would drift (1.0 / 10.0 != 1.0)
+  for (size_t k = 0;; k++) {
+    data_t t = k * _info->machine->tq();
+    if (t >= _profile.dt) break;
     l = lambda(t, s);
     f(*this, t, l, s);
-    t += _machine->tq();
   }
 }
 
@@ -249,161 +384,168 @@ void Block::walk(function<void(Block &b, data_t t, data_t l, data_t s)> f) {
  |_|   |_|  |_| \_/ \__,_|\__\___| |_| |_| |_|\___|\__|_| |_|\___/ \__,_|___/
                                                                              
 */
-void Block::parse_token(string token) {
-  char cmd = toupper(token[0]);
-  string arg = token.substr(1);
-  if (arg.empty()) throw CNCError("Empty command argument", this);
+Block::Error Block::parse_token(std::string_view token) {
+  char cmd;
+  data_t value;
+  Error e = scan(token, cmd, value);
+  if (e != Error::NONE) return e;
+  // N, G, T, M, P and L take integer arguments; those stored in narrow
+  // fields are also range checked, rather than silently wrapped
+  bool integer = (value == trunc(value));
+  auto fits = [&](auto field) {
+    return integer && value >= 0 &&
+           double(value) <= double(numeric_limits<decltype(field)>::max());
+  };
   // cover all possible/supported ISO commands:
   switch(cmd) {
   case 'N':
-    _n = stoi(arg); // "123" => 123; "hello" => 0
-    if (prev && _n <= prev->_n) 
-      throw CNCError("Block number must be increasing: " + to_string(prev->_n), this);
+    if (!fits(_info->n)) return Error::BAD_NUMBER;
+    _info->n = static_cast<uint32_t>(value);
+    if (prev && _info->n <= prev->_info->n) return Error::N_NOT_INCREASING;
     break;
 
   case 'G':
-    _type = static_cast<BlockType>(stoi(arg));
-    if (_type > BlockType::NO_MOTION)
-      throw CNCError("Unknown G type", this);
+    if (!integer || value < 0 || value > static_cast<int>(BlockType::NO_MOTION))
+      return Error::UNKNOWN_G;
+    _type = static_cast<BlockType>(value);
     break;
     
   case 'X':
-    _target.x(stod(arg));
+    _info->target.x(value);
     break;
 
   case 'Y':
-    _target.y(stod(arg));
+    _info->target.y(value);
     break;
 
   case 'Z':
-    _target.z(stod(arg));
+    _info->target.z(value);
     break;
 
   case 'I':
-    _i = stod(arg);
+    _info->i = value;
     break;
 
   case 'J':
-    _j = stod(arg);
+    _info->j = value;
     break;
 
   case 'R':
-    _r = stod(arg);
+    _geometry.r = value;
     break;
 
   case 'F':
-    _feedrate = stod(arg);
+    _info->feedrate = value;
     break;
 
   case 'S':
-    _spindle = stod(arg);
+    _info->spindle = value;
     break;
 
   case 'T':
-    _tool = stoi(arg);
+    if (!fits(_info->tool)) return Error::BAD_NUMBER;
+    _info->tool = static_cast<uint16_t>(value);
     break;
 
   case 'M':
-    _m = stoi(arg);
+    if (!fits(_info->m)) return Error::BAD_NUMBER;
+    _info->m = static_cast<uint16_t>(value);
+    break;
+
+  case 'P':
+    if (!fits(_info->p)) return Error::BAD_NUMBER;
+    _info->p = static_cast<uint32_t>(value);
+    break;
+
+  case 'L':
+    if (!fits(_info->l)) return Error::BAD_NUMBER;
+    _info->l = static_cast<uint16_t>(value);
+    break;
+
+  case 'O': // program number, only meaningful to Program
+    if (!integer || value < 0) return Error::BAD_NUMBER;
     break;
   
   default:
-    stringstream ss;
-    ss << "Unknown/unsupported command: '" << token << "'";
-    throw CNCError(ss.str(), this);
-    break;
+    return Error::UNKNOWN_COMMAND;
   }
+  return Error::NONE;
 }
 
-Point Block::start_point() {
-  return prev ? prev->target() : _machine->zero();
+// No exceptions and no allocations: the argument is copied on a small stack
+// buffer, so that strtod() sees a terminated string, and the whole argument
+// must be consumed ("X1O" is an error, while stod() would read it as 1)
+Block::Error Block::scan(std::string_view token, char &cmd, data_t &value) {
+  char buf[32], *end;
+  cmd = toupper(static_cast<unsigned char>(token[0]));
+  std::string_view arg = token.substr(1);
+  if (arg.empty()) return Error::EMPTY_ARGUMENT;
+  if (arg.size() >= sizeof(buf)) return Error::BAD_NUMBER;
+  arg.copy(buf, arg.size());
+  buf[arg.size()] = '\0';
+  double v = strtod(buf, &end);
+  if (end != buf + arg.size() || !isfinite(v)) return Error::BAD_NUMBER;
+  value = static_cast<data_t>(v);
+  return Error::NONE;
 }
 
-
-void Block::compute() {
-  data_t dt, dt_1, dt_m, dt_2, dq;
-  data_t f_m, &l = _length;
-  data_t &A = _acc, a, d;
-
-  f_m = _arc_feedrate / 60.0;
-  dt_1 = f_m / A;
-  dt_2 = dt_1;
-  dt_m = l / f_m - (dt_1 + dt_2) / 2.0;
-
-  if (dt_m > 0) { // long block, trapezoid
-    dt = _machine->quantize(dt_1 + dt_m + dt_2, dq);
-    dt_m = dt_m + dq;
-    f_m = (2*l) / (dt_1 + dt_2 + 2*dt_m);
-  } else { // short block, trinagle
-    dt_1 = dt_2 = sqrt(l / A);
-    dt = _machine->quantize(dt_1 + dt_2, dq);
-    dt_m = 0;
-    dt_2 = dt_2 + dq;
-    f_m = 2*l / (dt_1 + dt_2);
-  }
-  a = f_m / dt_1;
-  d = -(f_m / dt_2);
-  _profile.dt_1 = dt_1;
-  _profile.dt_2 = dt_2;
-  _profile.dt_m = dt_m;
-  _profile.a = a;
-  _profile.d = d;
-  _profile.f = f_m;
-  _profile.dt = dt;
-  _profile.l = l;
+Point Block::start_point() {
+  return prev ? prev->target() : _info->machine->zero();
 }
 
-void Block::calc_arc() {
+
+Block::Error Block::calc_arc(data_t &mismatch) {
   data_t x0, y0, z0, xc, yc, xf, yf, zf;
+  mismatch = 0;
+  data_t &r = _geometry.r, &theta_0 = _geometry.theta_0;
+  data_t &dtheta = _geometry.dtheta;
   Point p0 = start_point();
   x0 = p0.x();
   y0 = p0.y();
   z0 = p0.z();
-  xf = _target.x();
-  yf = _target.y();
-  zf = _target.z();
+  xf = _info->target.x();
+  yf = _info->target.y();
+  zf = _info->target.z();
 
-  if (_r) { // if the radius is given
-    data_t dx = _delta.x();
-    data_t dy = _delta.y();
+  if (r) { // if the radius is given
+    data_t dx = _geometry.delta.x();
+    data_t dy = _geometry.delta.y();
     data_t dxy2 = pow(dx, 2) + pow(dy, 2);
-    data_t sq = sqrt(-pow(dy, 2) * dxy2 * (dxy2 - 4 * _r * _r));
+    data_t sq = sqrt(-pow(dy, 2) * dxy2 * (dxy2 - 4 * r * r));
     // signs table
     // sign(r) | CW(-1) | CCW(+1)
     // --------------------------
     //      -1 |     +  |    -
     //      +1 |     -  |    +
-    int s = (_r > 0) - (_r < 0);
+    int s = (r > 0) - (r < 0);
     s *= (_type == BlockType::CCWA ? 1 : -1);
     xc = x0 + (dx - s * sq / dxy2) / 2.0;
     yc = y0 + dy / 2.0 + s * (dx * sq) / (2 * dy * dxy2);
   } else { // if I,J are given
     data_t r2;
-    _r = hypot(_i, _j);
-    xc = x0 + _i;
-    yc = y0 + _j;
+    r = hypot(_info->i, _info->j);
+    xc = x0 + _info->i;
+    yc = y0 + _info->j;
     r2 = hypot(xf - xc, yf - yc);
-    if (fabs(_r - r2) > _machine->error()) {
-      throw CNCError(
-          fmt::format("Arc endpoints mismatch error ({:})", _r - r2).c_str(),
-          this);
-    }
+    mismatch = r - r2;
   }
-  _center.x(xc);
-  _center.y(yc);
-  _theta_0 = atan2(y0 - yc, x0 - xc);
-  _dtheta = atan2(yf - yc, xf - xc) - _theta_0;
+  _geometry.center = Vec3(xc, yc, z0);
+  _geometry.arc = true;
+  theta_0 = atan2(y0 - yc, x0 - xc);
+  dtheta = atan2(yf - yc, xf - xc) - theta_0;
   // we need the net angle so we take the 2PI complement if negative
-  if (_dtheta < 0)
-    _dtheta = 2 * M_PI + _dtheta;
+  if (dtheta < 0)
+    dtheta = 2 * M_PI + dtheta;
   // if CW, take the negative complement
   if (_type == BlockType::CWA)
-    _dtheta = -(2 * M_PI - _dtheta);
+    dtheta = -(2 * M_PI - dtheta);
   //
-  _length = hypot(zf - z0, _dtheta * _r);
+  _geometry.length = hypot(zf - z0, dtheta * r);
   // from now on, it's safer to drop the sign of radius angle
-  _r = fabs(_r);
-
+  r = fabs(r);
+  // the block is complete anyway, so that parsing can go on
+  return fabs(mismatch) > _info->machine->max_error() ? Error::ARC_MISMATCH
+                                                : Error::NONE;
 }
 
 
@@ -426,7 +568,8 @@ using namespace cncpp;
 int main() {
   cerr << "Version: " << cncpp::version() << endl;
   Machine m = Machine();
-  auto b1 = Block("N10 G00 x100 y200 z10 F5000 S5000 T1").parse(&m);
+  Source source;
+  auto b1 = Block("N10 G00 x100 y200 z10 F5000 S5000 T1", source).parse(&m);
   auto b2 = Block("N20 G01 X10 y20", b1).parse(&m);
   
   cerr << "b1: " << b1.desc() << endl;
@@ -438,8 +581,17 @@ int main() {
     Point pos = b.interpolate(l);
     cout << format("{:} {:} {:} {:} {:} {:}", t, l, s, pos.x(), pos.y(), pos.z()) << endl;
   });
+
+  // integer words out of the range of their fields are rejected
+  int wrapped = 0;
+  for (auto line : {"T70000", "T-1", "N4294967296", "M65536", "P4294967296",
+                    "L65536"}) {
+    Block::Error e = Block(line, source).try_parse(&m);
+    cerr << line << ": " << Block::errors.at(e) << endl;
+    wrapped += e != Block::Error::BAD_NUMBER;
+  }
   
-  return 0;
+  return wrapped == 0 ? 0 : 1;
 }
 
 
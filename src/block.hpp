@@ -17,7 +17,13 @@ parameters for interpolation.
 #include "defines.hpp"
 #include "point.hpp"
 #include "machine.hpp"
+#include "motion.hpp"
+#include "source.hpp"
+#include <cctype>
+#include <cstdint>
 #include <map>
+#include <memory>
+#include <vector>
 #include <functional>
 
 // NAMESPACES AND CONSTANTS ----------------------------------------------------
@@ -28,15 +34,9 @@ namespace cncpp {
 class Block final : Object {
 public:
 
-  struct Profile {
-    data_t a, d;                              // acceleration and deceleration
-    data_t f, l;                              // feedrate and length
-    data_t fs, fe;                            // start and end feedrate
-    data_t dt_1, dt_m, dt_2;                  // partial times
-    data_t dt;                                // total time
-    data_t current_acc;                       // current acceleration on arc
-    data_t lambda(data_t t, data_t &s);       // lambda function
-  };
+  // Numeric core, in the default precision (see motion.hpp)
+  using Profile = ProfileT<data_t>;
+  using Geometry = GeometryT<data_t>;
 
   enum class BlockType {
     RAPID = 0,
@@ -49,63 +49,145 @@ public:
   // types[BlockType::LINE] => "linear"
   static const map<BlockType, string> types;
 
+  // Parsing errors, reported without throwing by try_parse()
+  enum class Error {
+    NONE = 0,
+    EMPTY_ARGUMENT,
+    BAD_NUMBER,
+    UNKNOWN_COMMAND,
+    UNKNOWN_G,
+    N_NOT_INCREASING,
+    ARC_MISMATCH,
+    FEED_OVER_FMAX // only reported by the Validator
+  };
+
+  // errors[Error::BAD_NUMBER] => "Invalid number"
+  static const map<Error, string> errors;
+  // list of errors with the offending token or value
+  using Errors = vector<pair<Error, string>>;
+
   // LIFECYCLE -----------------------------------------------------------------
-  Block(string line);
-  Block(string line, Block &prev);
+  // The line text is stored in source, which must outlive the block
+  Block(string_view line, Source &source);
+  Block(string_view line, Block &prev); // in the source of prev
+  // Block over a line already in source, with no parsed state (see Cache)
+  Block(Source &source, Source::Ref line);
+  Block(const Block &b); // also copies the cold data
   ~Block();
   string desc(bool colored = true) const override;
   Block &operator=(Block &b); // b1 = b2; or b1.operator=(b2)
 
   // METHODS -------------------------------------------------------------------
-  Block &parse(const Machine *m);
+  // Throws a CNCError on the first error. With planned == false, only the
+  // geometry is computed, and plan() must be called before interpolation
+  Block &parse(const Machine *m, bool planned = true);
+  // Never throws: returns the first error (Error::NONE on success) and
+  // appends all of them to found, if given; the block is parsed anyway, with
+  // the erroneous words ignored
+  Error try_parse(const Machine *m, Errors *found = nullptr,
+                  bool planned = true);
+  // Speed profile only, on the already parsed geometry: to be called again
+  // when the machine limits change
+  void plan(const Machine &m);
+  // Highest feedrate (mm/min) the machine allows along the block, whatever
+  // its F word: the limit of a feed override
+  data_t feed_limit(const Machine &m) const;
   data_t lambda(data_t time, data_t &speed);
-  Point interpolate(data_t lambda);
-  Point interpolate(data_t time, data_t &lambda, data_t &speed);
+  Vec3 interpolate(data_t lambda);
+  // Position at a time from the start of the block: unlike interpolate(lambda)
+  // also valid for dog-leg rapids, where each axis has its own profile
+  Vec3 interpolate(data_t time, data_t &lambda, data_t &speed);
+  // Same, leaving the block untouched (no current_acc), so that it can be
+  // shared by concurrent executors
+  Vec3 position(data_t time, data_t &lambda, data_t &speed) const;
+  bool dogleg() const;
+  // Points along the path, to be joined by segments within tol of it: arcs
+  // are split in chords, and dog-leg rapids at the phase changes of their
+  // axes and in time in between
+  void path(data_t tol, vector<Vec3> &points) const;
+  // Samples the block alone, at t = k * tq from its own start; a whole
+  // program is sampled on a single clock with a Trajectory
   void walk(function<void(Block &b, data_t t, data_t l, data_t s)> f);
 
+  // Calls f(token) for each whitespace separated token of a G-code line
+  template <typename F> static void tokenize(std::string_view line, F f) {
+    size_t i = 0, j, n = line.size();
+    while (i < n) {
+      while (i < n && isspace(static_cast<unsigned char>(line[i]))) i++;
+      for (j = i; j < n && !isspace(static_cast<unsigned char>(line[j])); j++);
+      if (j > i) f(line.substr(i, j - i));
+      i = j;
+    }
+  }
+  // Splits a token like "X10.5" into command ('X', uppercase) and value
+  static Error scan(std::string_view token, char &cmd, data_t &value);
+
   // ACCESSORS -----------------------------------------------------------------
-  string line() const { return _line; }
-  size_t n() const { return _n; }
+  string line() const { return string(_info->source->view(_info->line)); }
+  size_t n() const { return _info->n; }
   BlockType type() const { return _type; }
   string type_name() const { return types.at(_type); }
-  size_t tool() const { return _tool; }
-  data_t feedrate() const { return _feedrate; }
-  data_t arc_feedrate() const { return _arc_feedrate; }
-  data_t spindle() const { return _spindle; }
-  data_t length() const { return _length; }
-  Point target() const { return _target; }
-  Point center() const { return _center; }
-  Point delta() const { return _delta; }
-  size_t m() const { return _m; }
+  size_t tool() const { return _info->tool; }
+  data_t feedrate() const { return _info->feedrate; }
+  data_t arc_feedrate() const { return _info->arc_feedrate; }
+  data_t acceleration() const { return _info->acc; }
+  data_t spindle() const { return _info->spindle; }
+  data_t length() const { return _geometry.length; }
+  Point target() const { return _info->target; }
+  Vec3 center() const { return _geometry.center; }
+  Vec3 delta() const { return _geometry.delta; }
+  size_t m() const { return _info->m; }
+  size_t p() const { return _info->p; } // called subprogram (M98 P...)
+  size_t l() const { return _info->l; } // repetitions of the call (M98 L...)
   // We'll be able to use it as: b.profile().dt
   const Profile &profile() const { return _profile; }
-  
+  const Geometry &geometry() const { return _geometry; }
+
+
+  // Profile of a single axis at its own limits, for dog-leg rapids
+  Profile axis_profile(size_t i) const;
 
 private:
-  const Machine *_machine = nullptr; //pointer to the machine object
-  Profile _profile;                  // speed profile of the block
+  // position of a dog-leg rapid, each axis on its own profile
+  Vec3 axes_position(data_t time, data_t &speed) const;
+
+  // Cold data, used while parsing and for description only: kept apart, so
+  // that it does not take room among the data used during interpolation
+  struct Info {
+    const Machine *machine = nullptr; // pointer to the machine object
+    Source *source = nullptr;         // buffer holding the G-code text
+    Source::Ref line;                 // the original G-code line
+    uint32_t n = 0;                   // block number
+    uint16_t tool = 0;                // tool number
+    uint16_t m = 0;                   // M command
+    uint16_t l = 1;                   // subprogram repetitions
+    uint32_t p = 0;                   // subprogram number
+    uint32_t body = 0;                // body run by M98 (see Program::Body)
+    data_t feedrate = 0;              // feedrate
+    data_t arc_feedrate = 0;          // feedrate for arcs
+    data_t spindle = 0;               // spindle speed
+    data_t i = 0, j = 0;              // arc center offsets
+    data_t acc = 0;                   // actual acceleration
+    Point target = Point();           // target point
+  };
+
+  // Hot data, used during interpolation
+  Profile _profile{};                // speed profile of the block
+  Geometry _geometry{};              // path geometry
   BlockType _type = BlockType::NO_MOTION;
-  string _line;                      // the original G-code line
-  size_t _n = 0;                     // block number
-  size_t _tool = 0;                  // tool number
-  data_t _feedrate = 0;              // feedrate
-  data_t _arc_feedrate = 0;          // feedrate for arcs
-  data_t _spindle = 0;               // spindle speed
-  Point _target = Point();           // target point
-  Point _center = Point();           // center point for arcs
-  Point _delta = Point();            // projections
-  data_t _length = 0;                // length of the block
-  data_t _i = 0, _j = 0, _r = 0;     // arc parameters
-  data_t _theta_0 = 0, _dtheta = 0;  // arc angle parameters
-  data_t _acc = 0;                   // actual acceleration
-  size_t _m = 0;                     // M command
   bool _parsed = false;              // block has been parsed?
+  unique_ptr<Info> _info;            // never null
 
   // PRIVATE METHODS -----------------------------------------------------------
-  void parse_token(string token);
+  Error parse_token(std::string_view token);
   Point start_point(); // block starting point (prev target or machine init)
-  void compute();      // velocity profile
-  void calc_arc();     // calculate arc parameters
+  Error calc_arc(data_t &mismatch); // calculate arc parameters
+  void reset();        // clears the parsed state, for re-parsing
+
+  // Program sets the end state of subprogram calls
+  friend class Program;
+  // Cache stores and restores the parsed state
+  friend class Cache;
 
 public:
   Block *prev = nullptr;
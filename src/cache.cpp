@@ -0,0 +1,367 @@
+/*
+   ____           _                 _
+  / ___|__ _  ___| |__   ___    ___| | __ _ ___ ___
+ | |   / _` |/ __| '_ \ / _ \  / __| |/ _` / __/ __|
+ | |__| (_| | (__| | | |  __/ | (__| | (_| \__ \__ \
+  \____\__,_|\___|_| |_|\___|  \___|_|\__,_|___/___/
+
+Class implementation
+*/
+
+#include "cache.hpp"
+#include <fmt/core.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace cncpp;
+
+// File layout, all in native byte order:
+//   Header, source text, main program Records,
+//   then for each subprogram: SubHeader, body lines, and for each body:
+//   BodyHeader, Records
+// Block links, the machine and the source pointers are rebuilt on reading
+
+// Bump when the layout of the file or of the records changes, or when the
+// planning changes (2: profiles are no longer padded to a multiple of tq,
+// 3: rapids are planned, 4: a body for each modal state of the callers)
+static const uint32_t FORMAT = 4;
+static const char MAGIC[8] = {'C', 'N', 'C', 'P', 'P', 'B', 'I', 'N'};
+
+namespace {
+
+struct Header {
+  char magic[8];
+  uint64_t key;
+  uint32_t format;
+  uint32_t data_size;   // sizeof(data_t)
+  uint64_t text;        // bytes of source text
+  uint64_t blocks;      // blocks in the main program
+  uint64_t subprograms;
+};
+
+struct SubHeader {
+  uint64_t number;
+  uint64_t lines;       // body lines
+  uint64_t bodies;
+};
+
+struct BodyHeader {
+  data_t feedrate, spindle;
+  uint64_t tool;
+  Vec3 displacement;
+  uint64_t blocks;
+};
+
+// Bounds-checked reading from the mapped file
+struct Reader {
+  const char *data;
+  size_t size, pos = 0;
+
+  template <typename T> bool get(T &v) {
+    if (size - pos < sizeof(T)) return false;
+    memcpy(&v, data + pos, sizeof(T));
+    pos += sizeof(T);
+    return true;
+  }
+  bool get(std::string_view &v, size_t n) {
+    if (size - pos < n) return false;
+    v = std::string_view(data + pos, n);
+    pos += n;
+    return true;
+  }
+};
+
+template <typename T> void put(ostream &out, const T &v) {
+  out.write(reinterpret_cast<const char *>(&v), sizeof(T));
+}
+
+} // namespace
+
+struct Cache::Record {
+  Block::Profile profile;
+  Block::Geometry geometry;
+  Point target;
+  Source::Ref line;
+  data_t feedrate, arc_feedrate, spindle, i, j, acc;
+  uint32_t n, p, body;
+  uint16_t tool, m, l;
+  uint8_t type;
+  // raw bytes copies
+  static_assert(is_trivially_copyable_v<Block::Profile> &&
+                is_trivially_copyable_v<Block::Geometry>);
+};
+
+
+string Cache::desc(bool colored) const {
+  return fmt::format("Program cache in {}", _dir);
+}
+
+uint64_t Cache::key(std::string_view gcode, const Machine &m) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  auto hash = [&h](const void *data, size_t n) {
+    const unsigned char *c = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < n; i++) {
+      h ^= c[i];
+      h *= 0x100000001b3ULL;
+    }
+  };
+  data_t params[] = {m.A(),       m.tq(),      m.fmax(),    m.max_error(),
+                     m.zero().x(), m.zero().y(), m.zero().z(),
+                     m.vmax(0),   m.vmax(1),   m.vmax(2),
+                     m.amax(0),   m.amax(1),   m.amax(2),
+                     data_t(m.dogleg())};
+  string version = cncpp::version();
+  hash(gcode.data(), gcode.size());
+  hash(params, sizeof(params));
+  hash(version.data(), version.size());
+  hash(&FORMAT, sizeof(FORMAT));
+  return h;
+}
+
+string Cache::path(uint64_t key) const {
+  return fmt::format("{}/{:016x}.cncpp", _dir, key);
+}
+
+bool Cache::load(Program &program, const string &filename) {
+  ifstream file(filename, ios::binary);
+  if (!file.is_open()) {
+    throw runtime_error("Could not open file " + filename);
+  }
+  ostringstream ss;
+  ss << file.rdbuf();
+  uint64_t k = key(ss.str(), *program._machine);
+  string p = path(k);
+  if (read(program, p, k)) {
+    program._filename = filename;
+    return true;
+  }
+  program.load(filename);
+  if (!write(program, p, k) && _debug)
+    cerr << "Cannot write cache file " << p << endl;
+  return false;
+}
+
+
+// PRIVATE METHODS -------------------------------------------------------------
+bool Cache::read(Program &program, const string &path, uint64_t key) const {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  size_t size = st.st_size;
+  void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return false;
+
+  Reader in{static_cast<const char *>(map), size};
+  std::string_view text;
+  // appends n blocks to list, linking them as Program does
+  auto blocks = [&](list<Block> &list, uint64_t n) {
+    Record r;
+    for (uint64_t k = 0; k < n; k++) {
+      if (!in.get(r) ||
+          uint64_t(r.line.offset) + r.line.length > text.size() ||
+          r.type > static_cast<uint8_t>(Block::BlockType::NO_MOTION))
+        return false;
+      Block *prev = list.empty() ? nullptr : &list.back();
+      Block &b = list.emplace_back(program._source, r.line);
+      b._profile = r.profile;
+      b._geometry = r.geometry;
+      b._type = static_cast<Block::BlockType>(r.type);
+      b._parsed = true;
+      b._info->machine = program._machine;
+      b._info->n = r.n;
+      b._info->tool = r.tool;
+      b._info->m = r.m;
+      b._info->l = r.l;
+      b._info->p = r.p;
+      b._info->body = r.body;
+      b._info->feedrate = r.feedrate;
+      b._info->arc_feedrate = r.arc_feedrate;
+      b._info->spindle = r.spindle;
+      b._info->i = r.i;
+      b._info->j = r.j;
+      b._info->acc = r.acc;
+      b._info->target = r.target;
+      if (prev) {
+        b.prev = prev;
+        prev->next = &b;
+      }
+    }
+    return true;
+  };
+
+  Header h;
+  bool ok = in.get(h) && memcmp(h.magic, MAGIC, sizeof(MAGIC)) == 0 &&
+            h.key == key && h.format == FORMAT &&
+            h.data_size == sizeof(data_t) && in.get(text, h.text);
+  if (ok) {
+    program.reset();
+    program._source._text.assign(text);
+    ok = blocks(program, h.blocks);
+  }
+  for (uint64_t s = 0; ok && s < h.subprograms; s++) {
+    SubHeader sh;
+    ok = in.get(sh);
+    if (!ok) break;
+    Program::Subprogram &sub = program._subprograms[sh.number];
+    for (uint64_t l = 0; ok && l < sh.lines; l++) {
+      uint32_t length;
+      std::string_view line;
+      ok = in.get(length) && in.get(line, length);
+      if (ok) sub.text.emplace_back(line);
+    }
+    for (uint64_t k = 0; ok && k < sh.bodies; k++) {
+      BodyHeader bh;
+      ok = in.get(bh);
+      if (!ok) break;
+      Program::Body &body = sub.bodies.emplace_back();
+      body.feedrate = bh.feedrate;
+      body.spindle = bh.spindle;
+      body.tool = bh.tool;
+      body.displacement = bh.displacement;
+      ok = blocks(body.blocks, bh.blocks);
+    }
+  }
+  munmap(map, size);
+  if (!ok) program.reset();
+  program.rewind();
+  return ok;
+}
+
+bool Cache::write(const Program &program, const string &path,
+                  uint64_t key) const {
+  // written aside and then renamed, so that readers never see partial files
+  string tmp = fmt::format("{}.{}", path, getpid());
+  ofstream out(tmp, ios::binary);
+  if (!out.is_open()) return false;
+
+  auto blocks = [&](const list<Block> &list) {
+    Record r;
+    for (const Block &b : list) {
+      memset(static_cast<void *>(&r), 0, sizeof(r)); // zero padding bytes
+      r.profile = b._profile;
+      r.geometry = b._geometry;
+      r.target = b._info->target;
+      r.line = b._info->line;
+      r.feedrate = b._info->feedrate;
+      r.arc_feedrate = b._info->arc_feedrate;
+      r.spindle = b._info->spindle;
+      r.i = b._info->i;
+      r.j = b._info->j;
+      r.acc = b._info->acc;
+      r.n = b._info->n;
+      r.p = b._info->p;
+      r.body = b._info->body;
+      r.tool = b._info->tool;
+      r.m = b._info->m;
+      r.l = b._info->l;
+      r.type = static_cast<uint8_t>(b._type);
+      put(out, r);
+    }
+  };
+
+  Header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, MAGIC, sizeof(MAGIC));
+  h.key = key;
+  h.format = FORMAT;
+  h.data_size = sizeof(data_t);
+  h.text = program._source.size();
+  h.blocks = program.size();
+  h.subprograms = program._subprograms.size();
+  put(out, h);
+  out.write(program._source.text().data(), program._source.size());
+  blocks(program);
+  for (auto &[number, sub] : program._subprograms) {
+    SubHeader sh;
+    memset(static_cast<void *>(&sh), 0, sizeof(sh));
+    sh.number = number;
+    sh.lines = sub.text.size();
+    sh.bodies = sub.bodies.size();
+    put(out, sh);
+    for (auto &line : sub.text) {
+      put(out, static_cast<uint32_t>(line.size()));
+      out.write(line.data(), line.size());
+    }
+    for (auto &body : sub.bodies) {
+      BodyHeader bh;
+      memset(static_cast<void *>(&bh), 0, sizeof(bh));
+      bh.feedrate = body.feedrate;
+      bh.spindle = body.spindle;
+      bh.tool = body.tool;
+      bh.displacement = body.displacement;
+      bh.blocks = body.blocks.size();
+      put(out, bh);
+      blocks(body.blocks);
+    }
+  }
+  out.close();
+  if (!out || rename(tmp.c_str(), path.c_str()) != 0) {
+    remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+
+
+
+/*
+  _____         _                     _
+ |_   _|__  ___| |_   _ __ ___   __ _(_)_ __
+   | |/ _ \/ __| __| | '_ ` _ \ / _` | | '_ \
+   | |  __/\__ \ |_  | | | | | | (_| | | | | |
+   |_|\___||___/\__| |_| |_| |_|\__,_|_|_| |_|
+
+*/
+
+#ifdef CACHE_MAIN
+
+#include <chrono>
+
+// Usage: cache_test machine.yml program.gcode [cache_dir]
+// Loads the program twice (the second time from the cache) and compares
+int main(int argc, const char *argv[]) {
+  if (argc < 3) {
+    cerr << "Usage: " << argv[0] << " <machine.yml> <file.gcode> [cache_dir]"
+         << endl;
+    return 1;
+  }
+  Machine machine(argv[1]);
+  Cache cache(argc > 3 ? argv[3] : "/tmp");
+  // start from a cold cache
+  ifstream file(argv[2], ios::binary);
+  ostringstream ss;
+  ss << file.rdbuf();
+  remove(cache.path(Cache::key(ss.str(), machine)).c_str());
+
+  string descs[2];
+  for (int i = 0; i < 2; i++) {
+    Program program(&machine);
+    auto start = chrono::steady_clock::now();
+    bool hit = cache.load(program, argv[2]);
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    cerr << fmt::format("{}: {} blocks in {:.3f} s", hit ? "hit " : "miss",
+                        program.size(), elapsed.count())
+         << endl;
+    descs[i] = program.desc(false);
+  }
+  bool same = descs[0] == descs[1];
+  cerr << (same ? "Cached program is identical" : "Cached program differs")
+       << endl;
+  return same ? 0 : 3;
+}
+
+#endif // CACHE_MAIN
@@ -0,0 +1,65 @@
+/*
+   ____           _                 _
+  / ___|__ _  ___| |__   ___    ___| | __ _ ___ ___
+ | |   / _` |/ __| '_ \ / _ \  / __| |/ _` / __/ __|
+ | |__| (_| | (__| | | |  __/ | (__| | (_| \__ \__ \
+  \____\__,_|\___|_| |_|\___|  \___|_|\__,_|___/___/
+
+Persistent binary cache of parsed and planned programs. Cache files are named
+after a hash of the G-code text and of the Machine parameters used in
+planning, so that a program is reparsed only when either of them changes:
+
+  Cache cache("/tmp/cncpp_cache");
+  Program program(&machine);
+  cache.load(program, "part.gcode"); // true if read from the cache
+
+Cache files are only meant to be read back on the same platform and by the
+same library version.
+*/
+#ifndef CACHE_HPP
+#define CACHE_HPP
+
+// INCLUDES AND DEFINES --------------------------------------------------------
+#include "defines.hpp"
+#include "machine.hpp"
+#include "program.hpp"
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// NAMESPACES AND CONSTANTS ----------------------------------------------------
+using namespace std;
+
+namespace cncpp {
+
+class Cache : Object {
+public:
+  // LIFECYCLE -----------------------------------------------------------------
+  // dir must exist and be writable
+  Cache(const string &dir) : _dir(dir) {}
+  string desc(bool colored = true) const override;
+
+  // METHODS -------------------------------------------------------------------
+  // Loads filename into program (replacing its blocks), from the cache if
+  // valid; otherwise the file is parsed and the cache is written.
+  // Returns true on a cache hit
+  bool load(Program &program, const string &filename);
+  // FNV-1a hash of the G-code text and of the planning parameters
+  static uint64_t key(std::string_view gcode, const Machine &machine);
+  // Cache file for a given key
+  string path(uint64_t key) const;
+
+  // ACCESSORS -----------------------------------------------------------------
+  const string &dir() const { return _dir; }
+
+private:
+  struct Record; // a block, as stored in the file
+  string _dir;
+
+  bool read(Program &program, const string &path, uint64_t key) const;
+  bool write(const Program &program, const string &path, uint64_t key) const;
+};
+
+} // namespace cncpp
+
+#endif // CACHE_HPP
@@ -13,9 +13,27 @@ Master header file
 
 #include "defines.hpp"
 #include "point.hpp"
+#include "motion.hpp"
+#include "source.hpp"
 #include "block.hpp"
+#include "correlator.hpp"
+#include "recorder.hpp"
 #include "machine.hpp"
 #include "program.hpp"
+#include "generator.hpp"
+#include "parallel.hpp"
+#include "pool.hpp"
+#include "validator.hpp"
+#include "cache.hpp"
+#include "trajectory.hpp"
+#include "resampler.hpp"
+#include "queue.hpp"
+#include "pipeline.hpp"
+#include "executor.hpp"
+#include "stock.hpp"
+#include "index.hpp"
+#include "envelope.hpp"
+#include "orchestrator.hpp"
 
 
 #endif // CNCPP_HPP
\ No newline at end of file
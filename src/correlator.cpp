@@ -0,0 +1,226 @@
+/*
+   ____                    _       _                    _
+  / ___|___  _ __ _ __ ___| | __ _| |_ ___  _ __    ___| | __ _ ___ ___
+ | |   / _ \| '__| '__/ _ \ |/ _` | __/ _ \| '__|  / __| |/ _` / __/ __|
+ | |__| (_) | |  | | |  __/ | (_| | || (_) | |    | (__| | (_| \__ \__ \
+  \____\___/|_|  |_|  \___|_|\__,_|\__\___/|_|     \___|_|\__,_|___/___/
+
+
+Class implementation
+*/
+
+#include "correlator.hpp"
+#include <fmt/core.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+using namespace std;
+using namespace cncpp;
+using namespace fmt;
+
+// Values below SUB have a bucket each; then each power of 2 is split in SUB
+size_t Correlator::Histogram::bucket(uint64_t ns) {
+  if (ns < SUB) return ns;
+  size_t e = ilogb(double(ns)); // at least 4
+  size_t b = (e - 3) * SUB + ((ns >> (e - 4)) & (SUB - 1));
+  return min(b, 61 * SUB - 1);
+}
+
+uint64_t Correlator::Histogram::value(size_t b) {
+  if (b < SUB) return b;
+  size_t e = b / SUB + 3;
+  uint64_t width = uint64_t(1) << (e - 4);
+  return (SUB + b % SUB) * width + width / 2;
+}
+
+void Correlator::Histogram::add(uint64_t ns) {
+  _buckets[bucket(ns)].fetch_add(1, memory_order_relaxed);
+  _total.fetch_add(ns, memory_order_relaxed);
+  uint64_t m = _max.load(memory_order_relaxed);
+  while (ns > m && !_max.compare_exchange_weak(m, ns, memory_order_relaxed))
+    ;
+  _count.fetch_add(1, memory_order_release);
+}
+
+void Correlator::Histogram::reset() {
+  for (auto &b : _buckets)
+    b = 0;
+  _count = _total = _max = 0;
+}
+
+double Correlator::Histogram::percentile(double p) const {
+  uint64_t n = _count.load(memory_order_acquire);
+  if (n == 0) return 0;
+  uint64_t rank = std::max<uint64_t>(1, ceil(std::min(std::max(p, 0.0), 1.0) * n));
+  uint64_t seen = 0;
+  for (size_t b = 0; b < _buckets.size(); b++) {
+    seen += _buckets[b].load(memory_order_relaxed);
+    if (seen >= rank) return std::min(value(b), _max.load()) * 1e-9;
+  }
+  return max();
+}
+
+Correlator::Correlator(size_t window)
+    : _window(max<size_t>(window, 1)), _slots(make_unique<Slot[]>(_window)) {}
+
+string Correlator::desc(bool colored) const {
+  string s = "Correlator:";
+  for (auto [name, h] : {pair{"round trip", &_round_trip},
+                         pair{"outbound", &_outbound},
+                         pair{"inbound", &_inbound}}) {
+    s += format(" {} p50 {:.3f} ms, p99 {:.3f} ms, max {:.3f} ms ({});", name,
+                h->percentile(0.5) * 1000, h->percentile(0.99) * 1000,
+                h->max() * 1000, h->count());
+  }
+  return s + format(" {} unmatched", _unmatched);
+}
+
+uint64_t Correlator::now() {
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void Correlator::sent(uint64_t seq, uint64_t time) {
+  Slot &slot = _slots[seq % _window];
+  // a receiver still reading the time of the previous seq sees the slot
+  // taken before the time changes (see received())
+  slot.seq.store(Slot::WRITING, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  slot.time.store(time, memory_order_relaxed);
+  slot.seq.store(seq, memory_order_release);
+}
+
+// Only the first status answering a setpoint is a measure of its latency
+void Correlator::received(uint64_t seq, uint64_t remote, uint64_t time) {
+  Slot &slot = _slots[seq % _window];
+  uint64_t expected = seq;
+  // the acquire pairs with the release of seq in sent(): the time is read
+  // once the slot is matched, and dropped if a later seq has taken the slot
+  // meanwhile
+  if (seq == 0 ||
+      !slot.seq.compare_exchange_strong(expected, 0, memory_order_acquire,
+                                        memory_order_relaxed)) {
+    _unmatched++;
+    return;
+  }
+  uint64_t start = slot.time.load(memory_order_relaxed);
+  atomic_thread_fence(memory_order_acquire);
+  if (slot.seq.load(memory_order_relaxed) != 0) {
+    _unmatched++;
+    return;
+  }
+  if (time >= start) _round_trip.add(time - start);
+  if (remote == 0) return;
+  if (remote >= start) _outbound.add(remote - start);
+  if (time >= remote) _inbound.add(time - remote);
+}
+
+void Correlator::reset() {
+  for (size_t i = 0; i < _window; i++)
+    _slots[i].seq = 0;
+  _round_trip.reset();
+  _outbound.reset();
+  _inbound.reset();
+  _unmatched = 0;
+}
+
+
+/*
+  _____         _                     _
+ |_   _|__  ___| |_   _ __ ___   __ _(_)_ __
+   | |/ _ \/ __| __| | '_ ` _ \ / _` | | '_ \
+   | |  __/\__ \ |_  | | | | | | (_| | | | | |
+   |_|\___||___/\__| |_| |_| |_|\__,_|_|_| |_|
+
+*/
+
+#ifdef CORRELATOR_MAIN
+
+#include "machine.hpp"
+#include "queue.hpp"
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono;
+
+// Percentiles against the exact ones, then a loopback through the machine:
+// an echo thread answers each setpoint 2 ms after it was sent, as an axis
+// controller would
+int main(int argc, const char *argv[]) {
+  if (argc < 2) {
+    cerr << "Usage: " << argv[0] << " <machine.yml>" << endl;
+    return 1;
+  }
+  size_t errors = 0;
+
+  {
+    Correlator::Histogram h;
+    mt19937 rng(0);
+    exponential_distribution<double> latency(1.0 / 1e6); // 1 ms mean, ns
+    vector<uint64_t> values(1000000);
+    for (auto &v : values) {
+      v = uint64_t(latency(rng));
+      h.add(v);
+    }
+    sort(values.begin(), values.end());
+    for (double p : {0.5, 0.9, 0.99, 0.999}) {
+      double exact = values[size_t(ceil(p * values.size())) - 1] * 1e-9;
+      double e = fabs(h.percentile(p) - exact) / exact;
+      errors += e > 0.035;
+      cout << format("p{:<5} {:.4f} ms vs. {:.4f} ms ({:.2f}%)", p * 100,
+                     h.percentile(p) * 1000, exact * 1000, e * 100)
+           << endl;
+    }
+    errors += h.max() != values.back() * 1e-9;
+  }
+
+  Machine machine(argv[1]);
+  machine.stamp(true);
+  machine.setpoint(0, 0, 0);
+  json j = json::parse(machine.payload(false));
+  errors += !j.contains("seq") || !j.contains("t");
+
+  struct Sent {
+    uint64_t seq, time;
+  };
+  BoundedQueue<Sent> wire(1024);
+  thread echo([&]() {
+    Sent s;
+    while (wire.pop(s)) {
+      this_thread::sleep_until(steady_clock::time_point(nanoseconds(s.time)) +
+                               milliseconds(2));
+      string status = format("{{\"x\": 0.5, \"y\": 0.5, \"z\": 0.5, "
+                             "\"error\": 0, \"seq\": {}, \"t\": {}}}",
+                             s.seq, Correlator::now());
+      mosquitto_message msg{};
+      msg.topic = const_cast<char *>("cnc/status/x");
+      msg.payload = status.data();
+      msg.payloadlen = status.size();
+      machine.on_message(&msg);
+    }
+  });
+  const size_t n = 1000;
+  Correlator &c = machine.correlator();
+  for (uint64_t seq = 1; seq <= n; seq++) {
+    uint64_t t = Correlator::now(); // as by Machine::sync
+    c.sent(seq, t);
+    wire.push({seq, t});
+    this_thread::sleep_for(milliseconds(1));
+  }
+  wire.push({1, Correlator::now()}); // answered twice
+  wire.close();
+  echo.join();
+  cout << c.desc() << endl;
+  errors += c.round_trip().count() != n || c.outbound().count() != n ||
+            c.unmatched() != 1 || c.round_trip().percentile(0.5) < 0.002 ||
+            c.outbound().percentile(0.5) < 0.002;
+
+  cout << (errors == 0 ? "OK" : "FAILED") << endl;
+  return errors == 0 ? 0 : 3;
+}
+
+#endif // CORRELATOR_MAIN
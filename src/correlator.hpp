@@ -0,0 +1,103 @@
+/*
+   ____                    _       _                    _
+  / ___|___  _ __ _ __ ___| | __ _| |_ ___  _ __    ___| | __ _ ___ ___
+ | |   / _ \| '__| '__/ _ \ |/ _` | __/ _ \| '__|  / __| |/ _` / __/ __|
+ | |__| (_) | |  | | |  __/ | (_| | || (_) | |    | (__| | (_| \__ \__ \
+  \____\___/|_|  |_|  \___|_|\__,_|\__\___/|_|     \___|_|\__,_|___/___/
+
+
+Latency of the control loop over MQTT. When stamping is enabled (stamp:
+true in machine.yml), each setpoint message also carries a sequence number
+and the steady clock time it was sent at (ns):
+
+  {"x": 0.5, "y": 0.5, "z": 0.5, "rapid": false, "seq": 42, "t": 1234567}
+
+and a status message answering it is expected to echo the sequence number of
+the last setpoint applied, optionally with its own send time:
+
+  {"x": 0.5, "y": 0.5, "z": 0.5, "error": 0.0, "seq": 42, "t": 1234999}
+
+The correlator matches the two streams by sequence number, and keeps
+histograms of the round trip (setpoint sent to status received) and, for
+stamped statuses, of the outbound (setpoint sent to status sent) and
+inbound (status sent to received) times. One-way times need a clock shared
+by both ends, e.g. both processes on the same host (CLOCK_MONOTONIC).
+
+  Correlator &c = machine.correlator();
+  c.round_trip().percentile(0.99); // s
+
+Histograms are log-linear, with 16 buckets per power of 2 (within 3%), and
+lock-free: they can be read while being updated.
+*/
+#ifndef CORRELATOR_HPP
+#define CORRELATOR_HPP
+
+// INCLUDES AND DEFINES --------------------------------------------------------
+#include "defines.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// NAMESPACES AND CONSTANTS ----------------------------------------------------
+using namespace std;
+
+namespace cncpp {
+
+class Correlator : Object {
+public:
+  // Histogram of times in ns, read in s
+  class Histogram {
+  public:
+    void add(uint64_t ns);
+    void reset();
+    uint64_t count() const { return _count; }
+    double max() const { return _max * 1e-9; }
+    double mean() const { return _count ? _total * 1e-9 / _count : 0; }
+    // p in [0, 1]: 0.5 for the median
+    double percentile(double p) const;
+
+  private:
+    static constexpr size_t SUB = 16; // buckets per power of 2
+    array<atomic<uint64_t>, 61 * SUB> _buckets{};
+    atomic<uint64_t> _count{0}, _total{0}, _max{0};
+    static size_t bucket(uint64_t ns);
+    static uint64_t value(size_t bucket); // middle of the bucket
+  };
+
+  // LIFECYCLE -----------------------------------------------------------------
+  // Matches statuses to the last window setpoints sent
+  Correlator(size_t window = 4096);
+  string desc(bool colored = true) const override;
+
+  // METHODS -------------------------------------------------------------------
+  // Steady clock times (ns); remote is 0 for statuses without a time. Called
+  // by the machine, from its MQTT thread
+  void sent(uint64_t seq, uint64_t time);
+  void received(uint64_t seq, uint64_t remote, uint64_t time);
+  void reset();
+  static uint64_t now();
+
+  // ACCESSORS -----------------------------------------------------------------
+  const Histogram &round_trip() const { return _round_trip; }
+  const Histogram &outbound() const { return _outbound; }
+  const Histogram &inbound() const { return _inbound; }
+  // statuses answering a setpoint already matched, too old, or never sent
+  uint64_t unmatched() const { return _unmatched; }
+
+private:
+  struct Slot {
+    static constexpr uint64_t WRITING = UINT64_MAX; // sent() storing time
+    atomic<uint64_t> seq{0}; // 0: free, or already matched
+    atomic<uint64_t> time{0};
+  };
+  size_t _window;
+  unique_ptr<Slot[]> _slots;
+  Histogram _round_trip, _outbound, _inbound;
+  atomic<uint64_t> _unmatched{0};
+};
+
+} // namespace cncpp
+
+#endif // CORRELATOR_HPP
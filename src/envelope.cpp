@@ -0,0 +1,194 @@
+/*
+  _____                _                         _
+ | ____|_ ____   _____| | ___  _ __   ___    ___| | __ _ ___ ___
+ |  _| | '_ \ \ / / _ \ |/ _ \| '_ \ / _ \  / __| |/ _` / __/ __|
+ | |___| | | \ V /  __/ | (_) | |_) |  __/ | (__| | (_| \__ \__ \
+ |_____|_| |_|\_/ \___|_|\___/| .__/ \___|  \___|_|\__,_|___/___/
+                              |_|
+
+Class implementation
+*/
+
+#include "envelope.hpp"
+#include "parallel.hpp"
+#include <fmt/core.h>
+
+using namespace std;
+using namespace cncpp;
+using namespace fmt;
+
+Envelope::Envelope(const Machine &machine) {
+  Vec3 offset = machine.offset().vec();
+  for (size_t i = 0; i < 3; i++) {
+    _lo.c[i] = 0 - offset.c[i]; // not -0
+    _hi.c[i] = machine.travel(i) - offset.c[i];
+  }
+}
+
+string Envelope::desc(bool colored) const {
+  return format("Envelope: X [{}, {}], Y [{}, {}], Z [{}, {}] mm", _lo.x(),
+                _hi.x(), _lo.y(), _hi.y(), _lo.z(), _hi.z());
+}
+
+vector<Envelope::Violation> Envelope::check(Program &program,
+                                            unsigned threads) const {
+  vector<pair<Block *, Vec3>> blocks;
+  for (auto c = program.cursor(); !c.done(); ++c) {
+    Block &b = c.block();
+    if (b.type() == Block::BlockType::NO_MOTION || !(b.length() > 0))
+      continue;
+    blocks.push_back({&b, c.offset()});
+  }
+  // dog-leg rapids stay within the box of their end points, too
+  auto extremes = [](const pair<Block *, Vec3> &b, Vec3 &lo, Vec3 &hi) {
+    b.first->geometry().bounds(lo, hi);
+    lo = lo + b.second;
+    hi = hi + b.second;
+  };
+  vector<uint8_t> axes(blocks.size());
+  parallel_for(blocks.size(), [&](size_t begin, size_t end) {
+    Vec3 lo, hi;
+    for (size_t i = begin; i < end; i++) {
+      extremes(blocks[i], lo, hi);
+      axes[i] = outside(lo) | outside(hi);
+    }
+  }, threads);
+  vector<Violation> found;
+  for (size_t i = 0; i < blocks.size(); i++) {
+    if (!axes[i]) continue;
+    Violation v{blocks[i].first, blocks[i].second, Vec3(), Vec3(), axes[i]};
+    extremes(blocks[i], v.lo, v.hi);
+    found.push_back(v);
+  }
+  return found;
+}
+
+
+/*
+  _____         _                     _
+ |_   _|__  ___| |_   _ __ ___   __ _(_)_ __
+   | |/ _ \/ __| __| | '_ ` _ \ / _` | | '_ \
+   | |  __/\__ \ |_  | | | | | | (_| | | | | |
+   |_|\___||___/\__| |_| |_| |_|\__,_|_|_| |_|
+
+*/
+
+#ifdef ENVELOPE_MAIN
+
+#include "executor.hpp"
+#include "generator.hpp"
+#include <chrono>
+#include <iostream>
+#include <set>
+
+using namespace std::chrono;
+
+// An arc bulging out of the travel with its end points within it, block
+// extremes against their sampled paths, and the cost of the pre-run check
+// and of the per-sample guard
+int main(int argc, const char *argv[]) {
+  if (argc < 2) {
+    cerr << "Usage: " << argv[0] << " <machine.yml> [program.gcode]" << endl;
+    return 1;
+  }
+  Machine machine(argv[1]);
+  Envelope envelope(machine);
+  size_t errors = 0;
+  cout << envelope.desc() << endl;
+
+  // X travel is [0, 1000] mm: the arc reaches X 1001.18 mm
+  {
+    Program program(&machine);
+    for (auto line : {"G00 X995 Y500 Z500", "G03 X995 Y520 I-5 J10 F1000",
+                      "G00 X500"})
+      program << line;
+    auto found = envelope.check(program);
+    bool ok = found.size() == 1 &&
+              found[0].block == &*std::next(program.begin()) &&
+              found[0].axes == 1 && fabs(found[0].hi.x() - 1001.1803) < 1e-3;
+    errors += !ok;
+    cout << format("Arc out of the travel: {} violations {}", found.size(),
+                   ok ? "" : "(WRONG)")
+         << endl;
+    try {
+      Executor(program, machine).run([](const Executor::Sample &s) {});
+      errors++;
+      cout << "Executor not stopped (WRONG)" << endl;
+    } catch (CNCError &e) {
+      cout << "Executor stopped: " << e.what() << endl;
+    }
+  }
+
+  Program program(&machine);
+  if (argc > 2) {
+    program.load(argv[2]);
+  } else {
+    Generator gen;
+    for (auto &line : gen.lines(20000))
+      program << line;
+  }
+
+  // exact extremes: within a micron of the sampled paths, and never inside
+  // them
+  size_t blocks = 0;
+  vector<Vec3> path;
+  for (auto &b : program) {
+    if (b.type() == Block::BlockType::NO_MOTION || !(b.length() > 0))
+      continue;
+    Vec3 lo, hi;
+    b.geometry().bounds(lo, hi);
+    b.path(1e-4, path);
+    Vec3 p_lo = path[0], p_hi = path[0];
+    for (auto &p : path) {
+      for (size_t i = 0; i < 3; i++) {
+        p_lo.c[i] = min(p_lo.c[i], p.c[i]);
+        p_hi.c[i] = max(p_hi.c[i], p.c[i]);
+      }
+    }
+    for (size_t i = 0; i < 3; i++) {
+      errors += p_lo.c[i] < lo.c[i] - 1e-4 || p_lo.c[i] - lo.c[i] > 1e-3;
+      errors += p_hi.c[i] > hi.c[i] + 1e-4 || hi.c[i] - p_hi.c[i] > 1e-3;
+    }
+    blocks++;
+  }
+  cout << format("Extremes of {} blocks checked against their paths", blocks)
+       << endl;
+
+  // a smaller box: every sample out of it belongs to a flagged block
+  Envelope box(Vec3(50, 50, 5), Vec3(350, 350, 40));
+  auto t0 = steady_clock::now();
+  auto serial = box.check(program, 1);
+  auto t1 = steady_clock::now();
+  auto found = box.check(program);
+  auto t2 = steady_clock::now();
+  set<Block *> flagged;
+  for (auto &v : found)
+    flagged.insert(v.block);
+  Trajectory traj(program, machine);
+  vector<Vec3> positions;
+  size_t missed = 0, out = 0;
+  traj.walk([&](const Trajectory::Sample &s) {
+    positions.push_back(s.position);
+    missed += !box.contains(s.position) && !flagged.count(s.block);
+  });
+  auto t3 = steady_clock::now();
+  for (auto &p : positions)
+    out += !box.contains(p);
+  auto t4 = steady_clock::now();
+  errors += missed > 0 || serial.size() != found.size();
+  cout << format("{} executed blocks out of {}: {} of {} samples out, {} of "
+                 "them in blocks not found",
+                 found.size(), box.desc(), out, positions.size(), missed)
+       << endl;
+  cout << format("Check {:.2f} ms on 1 thread, {:.2f} ms on {} threads; "
+                 "guard {:.2f} ns/sample",
+                 duration<double>(t1 - t0).count() * 1000,
+                 duration<double>(t2 - t1).count() * 1000, default_threads(),
+                 duration<double, nano>(t4 - t3).count() / positions.size())
+       << endl;
+
+  cout << (errors == 0 ? "OK" : "FAILED") << endl;
+  return errors == 0 ? 0 : 3;
+}
+
+#endif // ENVELOPE_MAIN
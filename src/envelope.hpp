@@ -0,0 +1,83 @@
+/*
+  _____                _                         _
+ | ____|_ ____   _____| | ___  _ __   ___    ___| | __ _ ___ ___
+ |  _| | '_ \ \ / / _ \ |/ _ \| '_ \ / _ \  / __| |/ _` / __/ __|
+ | |___| | | \ V /  __/ | (_) | |_) |  __/ | (__| | (_| \__ \__ \
+ |_____|_| |_|\_/ \___|_|\___/| .__/ \___|  \___|_|\__,_|___/___/
+                              |_|
+
+Travel envelope of the machine: the soft limits of each axis, checked on a
+whole program before running it, and on each sample while running it. The
+pre-run check takes the exact extremes of every executed block (arcs
+included, see Geometry::bounds), in parallel and without sampling:
+
+  Envelope envelope(machine);
+  for (auto &v : envelope.check(program)) ... // blocks out of the envelope
+
+Limits come from the axis length and the offset of the machine, and are kept
+in program coordinates, so that contains() is just six comparisons.
+*/
+#ifndef ENVELOPE_HPP
+#define ENVELOPE_HPP
+
+// INCLUDES AND DEFINES --------------------------------------------------------
+#include "defines.hpp"
+#include "block.hpp"
+#include "machine.hpp"
+#include "program.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// NAMESPACES AND CONSTANTS ----------------------------------------------------
+using namespace std;
+
+namespace cncpp {
+
+class Envelope : Object {
+public:
+  // An executed block reaching out of the envelope
+  struct Violation {
+    Block *block;
+    Vec3 offset;    // subprogram offset of this execution
+    Vec3 lo, hi;    // extremes of the block, in program coordinates
+    uint8_t axes;   // bitmask of the axes out of their travel (1 is X)
+  };
+
+  // LIFECYCLE -----------------------------------------------------------------
+  // Travel of the machine axes
+  Envelope(const Machine &machine);
+  // Any box, in program coordinates
+  Envelope(const Vec3 &lo, const Vec3 &hi) : _lo(lo), _hi(hi) {}
+  string desc(bool colored = true) const override;
+
+  // METHODS -------------------------------------------------------------------
+  // All the executed blocks (subprogram repetitions included) out of the
+  // envelope, in execution order
+  vector<Violation> check(Program &program, unsigned threads = 0) const;
+  // Per-sample guard: evaluated on all the axes, without branches
+  bool contains(const Vec3 &p) const {
+    bool in = true;
+    for (size_t i = 0; i < 3; i++)
+      in &= (p.c[i] >= _lo.c[i]) & (p.c[i] <= _hi.c[i]);
+    return in;
+  }
+  // Bitmask of the axes of p out of their travel
+  uint8_t outside(const Vec3 &p) const {
+    uint8_t axes = 0;
+    for (size_t i = 0; i < 3; i++)
+      axes |= ((p.c[i] < _lo.c[i]) | (p.c[i] > _hi.c[i])) << i;
+    return axes;
+  }
+
+  // ACCESSORS -----------------------------------------------------------------
+  const Vec3 &lo() const { return _lo; }
+  const Vec3 &hi() const { return _hi; }
+
+private:
+  Vec3 _lo, _hi;
+};
+
+} // namespace cncpp
+
+#endif // ENVELOPE_HPP
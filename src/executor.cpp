@@ -0,0 +1,490 @@
+/*
+  _____                     _                    _
+ | ____|_  _____  ___ _   _| |_ ___  _ __    ___| | __ _ ___ ___
+ |  _| \ \/ / _ \/ __| | | | __/ _ \| '__|  / __| |/ _` / __/ __|
+ | |___ >  <  __/ (__| |_| | || (_) | |    | (__| | (_| \__ \__ \
+ |_____/_/\_\___|\___|\__,_|\__\___/|_|     \___|_|\__,_|___/___/
+
+
+Class implementation
+*/
+
+#include "executor.hpp"
+#include <fmt/core.h>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <thread>
+
+using namespace std;
+using namespace std::chrono;
+using namespace cncpp;
+using namespace fmt;
+
+Executor::Executor(Program &program, Machine &machine)
+    : _cursor(program), _machine(machine), _tq(machine.tq()),
+      _override(machine.feed_override()), _held(machine.feed_hold()),
+      _commands(machine.command_count()), _envelope(machine) {}
+
+string Executor::desc(bool colored) const {
+  return format("Executor: tick {}, feed override {}%{}, {} commands, "
+                "latency max {:.3f} ms, mean {:.3f} ms",
+                _tick, _override, _held ? " (hold)" : "", _latency.commands,
+                _latency.max * 1000, _latency.mean() * 1000);
+}
+
+bool Executor::overridden() const {
+  switch (_block->type()) {
+  case Block::BlockType::LINE:
+  case Block::BlockType::CWA:
+  case Block::BlockType::CCWA:
+    return true;
+  default:
+    return false;
+  }
+}
+
+data_t Executor::feedrate() const {
+  if (_held) return 0;
+  if (!overridden()) return _block->arc_feedrate();
+  return min(_block->feedrate() * _override / 100,
+             _block->feed_limit(_machine));
+}
+
+bool Executor::advance() {
+  double end = _block ? this->end() : 0;
+  if (_block) ++_cursor;
+  while (!_cursor.done() && !(_cursor.block().profile().dt > 0))
+    ++_cursor;
+  if (_cursor.done()) return false;
+  _block = &_cursor.block();
+  _offset = _cursor.offset();
+  _start = _t0 = end;
+  _s0 = 0;
+  _warped = false;
+  _nominal = !_held && (_override == 100 || !overridden());
+  if (_held && _block->dogleg()) { // at rest on its own clock
+    warp();
+    _rate = 0;
+  } else if (_nominal) {
+    _profile = _block->profile();
+  } else {
+    _profile.plan(_block->length(), feedrate(), _block->acceleration(), 0);
+  }
+  return true;
+}
+
+void Executor::retime(double time) {
+  data_t v;
+  data_t s = _s0 + _profile.lambda(data_t(time - _t0), v) * _profile.l;
+  data_t rest = _block->length() - s;
+  if (!(rest > 0)) { // already there, e.g. stopped right at the end: over
+    _profile.dt = static_cast<data_t>(time - _t0);
+    return;
+  }
+  if (s == 0 && v == 0 && !_held && (_override == 100 || !overridden())) {
+    // resumed before moving: the block runs as planned, from now on
+    _profile = _block->profile();
+    _start = _t0 = time;
+    _nominal = true;
+    return;
+  }
+  _profile.plan(rest, feedrate(), _block->acceleration(), v);
+  _s0 = s;
+  _t0 = time;
+  _nominal = false;
+}
+
+void Executor::warp() {
+  _warped = true;
+  _nominal = false;
+  _profile = _block->profile();
+  _tau = _t0 - _start;
+  _rate = 1;
+  _end = numeric_limits<double>::infinity();
+  for (size_t i = 0; i < 3; i++)
+    _axes[i] = _block->axis_profile(i);
+}
+
+void Executor::warp(double time, double &tau, data_t &rate) {
+  // along an axis at x(tau), the acceleration is x'' r^2 + x' r': the rate r
+  // changes only as fast as that stays within amax, for each moving axis.
+  // An axis already braking at its limit holds the rate until it is at rest
+  data_t target = _held ? 0 : 1;
+  bool down = target < _rate;
+  auto bound = [&](double tau, data_t r) { // max |r'|
+    data_t dr = numeric_limits<data_t>::infinity();
+    for (size_t i = 0; i < 3; i++) {
+      if (_block->delta().c[i] == 0) continue;
+      data_t v;
+      _axes[i].lambda(data_t(tau), v);
+      data_t w = v / 60, a = _axes[i].current_acc * r * r;
+      if (w > 0) dr = min(dr, (_machine.amax(i) + (down ? a : -a)) / w);
+    }
+    return dr;
+  };
+  double dt = time - _t0;
+  data_t step = dt > 0 ? bound(_tau, _rate) * data_t(dt) : 0;
+  // the same at the end of the tick, where an axis may be in another phase;
+  // not at rest, where the rate changes at once
+  for (int pass = 0; pass < 3; pass++) {
+    rate = down ? max(target, _rate - step) : min(target, _rate + step);
+    tau = _tau + (_rate + rate) / 2.0 * dt;
+    if (isinf(step)) break;
+    data_t last = bound(min<double>(tau, _profile.dt), rate) * data_t(dt);
+    if (!(last < step)) break;
+    step = last;
+  }
+  double mean = (_rate + rate) / 2.0;
+  _end = numeric_limits<double>::infinity();
+  if (tau >= _profile.dt) { // over within this tick
+    _end = mean > 0 ? _t0 + (_profile.dt - _tau) / mean : _t0;
+    tau = _profile.dt;
+  }
+}
+
+bool Executor::step(Sample &s) {
+  if (_done) return false;
+  if (!_block && !advance()) { // nothing to execute
+    _done = true;
+    return false;
+  }
+  double time = _tick * _tq, tau = 0;
+  data_t rate = 1;
+  // blocks end at their exact time, mid-tick (see Trajectory::walk); a
+  // dog-leg rapid on its own clock, when that reaches the planned duration
+  bool last = false;
+  for (;;) {
+    if (_warped) warp(time, tau, rate);
+    if (last || time < end()) break;
+    last = !advance();
+  }
+
+  // a new command affects this very sample
+  uint64_t commands = _machine.command_count();
+  if (commands != _commands) {
+    bool held = _machine.feed_hold();
+    _commands = commands;
+    _override = _machine.feed_override();
+    _issued = _machine.command_time();
+    _pending = true;
+    if (!last && _block->dogleg() && held != _held) {
+      _held = held;
+      if (!_warped) { // from the previous sample on, as planned until then
+        _t0 = max(_start, time - _tq);
+        warp();
+      }
+      warp(time, tau, rate);
+    } else if (!last && !_block->dogleg() && (overridden() || held != _held)) {
+      _held = held;
+      retime(time);
+    }
+    _held = held;
+  }
+
+  s.tick = _tick++;
+  s.time = time;
+  s.t = static_cast<data_t>(time - _start);
+  s.block = _block;
+  if (_warped) {
+    Vec3 p = _block->geometry().start, v;
+    for (size_t i = 0; i < 3; i++) {
+      if (_block->delta().c[i] == 0) continue;
+      p.c[i] += _block->delta().c[i] * _axes[i].lambda(data_t(tau), v.c[i]);
+    }
+    data_t speed;
+    s.lambda = _profile.lambda(data_t(tau), speed);
+    s.speed = v.length() * rate;
+    s.position = p + _offset;
+  } else if (_nominal) {
+    s.position = _block->position(s.t, s.lambda, s.speed) + _offset;
+  } else {
+    data_t r = _profile.lambda(static_cast<data_t>(time - _t0), s.speed);
+    s.lambda = (_s0 + r * _profile.l) / _block->length();
+    s.position = _block->geometry().interpolate(s.lambda) + _offset;
+  }
+  // the latency of a command is up to the first sample that it changes: for
+  // a dog-leg rapid, the first one on the new rate of its clock
+  if (_pending && (!_warped || rate != _rate || rate == (_held ? 0 : 1))) {
+    _pending = false;
+    double latency =
+        duration_cast<duration<double>>(steady_clock::now() - _issued).count();
+    _latency.commands++;
+    _latency.max = max(_latency.max, latency);
+    _latency.total += latency;
+  }
+  if (_warped) {
+    _t0 = time;
+    _tau = tau;
+    _rate = rate;
+  }
+  if (!_envelope.contains(s.position)) {
+    uint8_t axes = _envelope.outside(s.position);
+    throw CNCError(format("Block {} out of the travel of axis {} at tick {}",
+                          _block->n(), "XYZ"[axes & 1 ? 0 : axes & 2 ? 1 : 2],
+                          s.tick),
+                   this);
+  }
+  _done = last;
+  return true;
+}
+
+void Executor::run(function<void(const Sample &s)> f, bool realtime) {
+  auto start = steady_clock::now();
+  size_t first = _tick;
+  Sample s;
+  for (;;) {
+    if (realtime) {
+      this_thread::sleep_until(
+          start + duration_cast<steady_clock::duration>(
+                      duration<double>((_tick - first) * _tq)));
+    }
+    if (!step(s)) break;
+    f(s);
+  }
+}
+
+
+/*
+  _____         _                     _
+ |_   _|__  ___| |_   _ __ ___   __ _(_)_ __
+   | |/ _ \/ __| __| | '_ ` _ \ / _` | | '_ \
+   | |  __/\__ \ |_  | | | | | | (_| | | | | |
+   |_|\___||___/\__| |_| |_| |_|\__,_|_|_| |_|
+
+*/
+
+#ifdef EXECUTOR_MAIN
+
+#include "generator.hpp"
+#include <yaml-cpp/yaml.h>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <unistd.h>
+
+// Samples at 100% vs. a Trajectory, cycle times at other overrides, limits
+// under random override changes and holds, and command-to-effect latency in
+// real time
+int main(int argc, const char *argv[]) {
+  if (argc < 2) {
+    cerr << "Usage: " << argv[0] << " <machine.yml> [program.gcode]" << endl;
+    return 1;
+  }
+  Machine machine(argv[1]);
+  Program program(&machine);
+  if (argc > 2) {
+    program.load(argv[2]);
+  } else {
+    Generator gen;
+    for (auto &line : gen.lines(2000))
+      program << line;
+  }
+  Trajectory traj(program, machine);
+  double tq = machine.tq();
+  size_t errors = 0;
+
+  // at 100%, bit for bit the same as the trajectory
+  {
+    Executor ex(program, machine);
+    size_t count = 0;
+    Executor::Sample s;
+    traj.walk([&](const Trajectory::Sample &t) {
+      if (!ex.step(s) || s.block != t.block || s.t != t.t ||
+          s.lambda != t.lambda || s.speed != t.speed ||
+          s.position.x() != t.position.x() ||
+          s.position.y() != t.position.y() ||
+          s.position.z() != t.position.z())
+        errors++;
+      count++;
+    });
+    errors += ex.step(s);
+    cout << format("100%: {} samples, {} different from the trajectory",
+                   count, errors)
+         << endl;
+  }
+
+  // constant overrides
+  for (data_t ovr : {50, 150, 200}) {
+    machine.feed_override(ovr);
+    Executor ex(program, machine);
+    ex.run([](const Executor::Sample &s) {});
+    cout << format("{:>3}%: cycle time {:.3f} s vs. {:.3f} s", ovr,
+                   ex.tick() * tq, traj.duration())
+         << endl;
+  }
+
+  // random overrides and holds: within the limits, prompt stops, same end
+  // point
+  mt19937 rng(1);
+  uniform_int_distribution<int> every(20, 400), percent(0, 200), dice(0, 3);
+  machine.feed_override(100);
+  Executor ex(program, machine);
+  size_t next = every(rng), holds = 0, moved = 0;
+  double acc = 0, feed = 0, stop = 0, v_hold = 0;
+  size_t hold_tick = 0;
+  bool stopped = false;
+  Executor::Sample prev{}, last{};
+  ex.run([&](const Executor::Sample &s) {
+    if (s.tick == next) {
+      if (machine.feed_hold()) {
+        machine.feed_hold(false);
+      } else if (dice(rng) == 0) {
+        machine.feed_hold(true);
+        holds++;
+        hold_tick = s.tick + 1; // first sample affected
+        stopped = false;
+      } else { // do not stop for long: the test would never end
+        machine.feed_override(machine.feed_override() == 0 ? 100
+                                                           : percent(rng));
+      }
+      next += every(rng);
+    }
+    // dog-leg rapids: the speed is the one of their slowest axis
+    if (s.tick > 0 && s.block == prev.block && !s.block->dogleg())
+      acc = max(acc, fabs(double(s.speed - prev.speed)) / 60 / tq /
+                         s.block->acceleration());
+    if (!s.block->dogleg())
+      feed = max(feed, double(s.speed / s.block->feed_limit(machine)));
+    if (machine.feed_hold() && s.tick >= hold_tick) {
+      // from the speed v of the first sample on hold, at rest within v / A
+      // (plus a tick, to sample the rest), and then still
+      if (s.tick == hold_tick)
+        v_hold = s.speed / 60 / s.block->acceleration();
+      if (stopped && (s.position - prev.position).length() > 0) moved++;
+      if (!stopped && s.speed == 0) {
+        stopped = true;
+        stop = max(stop, (s.tick - hold_tick) * tq - v_hold);
+      }
+    }
+    prev = last = s;
+  });
+  Vec3 end = traj.tick(traj.ticks() - 1).position;
+  double miss = (last.position - end).length();
+  cout << format("Random: {} commands ({} holds), cycle time {:.3f} s, max "
+                 "acceleration {:.2f}% of the block one, max feed {:.2f}% of "
+                 "the limit, end point off by {:.3e} mm",
+                 ex.latency().commands, holds, ex.tick() * tq, acc * 100,
+                 feed * 100, miss)
+       << endl;
+  cout << format("Holds: at rest at most {:.3f} ms after v / A, {} moves "
+                 "while at rest",
+                 stop * 1000, moved)
+       << endl;
+  errors += acc > 1.001 || feed > 1.001 || miss > 1e-6 || stop > tq * 1.001 ||
+            moved > 0;
+
+  // dog-leg rapids: held on their own clock, within the acceleration of each
+  // axis. The hold starts at the first sample while both axes speed up, and
+  // while X cruises; while Y brakes at its limit, as soon as Y is at rest
+  {
+    auto data = YAML::LoadFile(argv[1]);
+    data["machine"]["dogleg"] = true;
+    string settings = format("/tmp/cncpp_executor_{}.yml", getpid());
+    ofstream(settings) << data << endl;
+    Machine m(settings);
+    remove(settings.c_str());
+    Program rapids(&m);
+    rapids << "N10 G00 X100 Y100 Z100" << "N20 G00 X500 Y200 Z150"
+           << "N30 G00 X100 Y100 Z100";
+    Trajectory nominal(rapids, m);
+    Block &rapid = *std::next(rapids.begin());
+    double t20 = rapids.front().profile().dt; // start of the rapid
+    // an axis braking at its limit cannot brake harder: the clock slows
+    // down once it is at rest
+    auto start = [&](double t) {
+      for (bool braking = true; braking;) {
+        braking = false;
+        for (size_t i = 0; i < 3; i++) {
+          Block::Profile p = rapid.axis_profile(i);
+          if (t >= t20 + p.dt_1 + p.dt_m && t < t20 + p.dt) {
+            t = t20 + p.dt;
+            braking = true;
+          }
+        }
+      }
+      return t;
+    };
+    // second differences of rounded positions, at rounded times of the clock
+    data_t noise = 4 * numeric_limits<data_t>::epsilon() * 2000 / (tq * tq);
+    for (double at : {0.5, 1.5, 2.2}) {
+      m.feed_hold(false);
+      Executor ex(rapids, m);
+      size_t hold = static_cast<size_t>((t20 + at) / tq), rest = 0;
+      size_t slower = 0, moved = 0;
+      double acc = 0;
+      Executor::Sample s, p1{}, p2{};
+      for (;;) {
+        if (ex.tick() == hold) m.feed_hold(true);
+        if (rest && ex.tick() == rest + 100) m.feed_hold(false);
+        if (!ex.step(s)) break;
+        if (s.tick >= hold && !slower &&
+            s.speed < nominal.tick(s.tick).speed)
+          slower = s.tick;
+        if (m.feed_hold() && rest)
+          moved += (s.position - p1.position).length() > 0;
+        if (m.feed_hold() && !rest && slower && s.speed == 0) rest = s.tick;
+        if (s.tick >= 2 && s.block == &rapid && p2.block == &rapid) {
+          Vec3 a = (s.position - p1.position * 2 + p2.position) *
+                   data_t(1 / (tq * tq));
+          for (size_t i = 0; i < 3; i++)
+            acc = max(acc, double((fabs(a.c[i]) - noise) / m.amax(i)));
+        }
+        p2 = p1;
+        p1 = s;
+      }
+      Vec3 end = nominal.tick(nominal.ticks() - 1).position;
+      cout << format("Dog-leg hold at {:.1f} s: slower after {:.3f} s, at "
+                     "rest after {:.3f} s, max acceleration {:.2f}% of the "
+                     "axis one, {} moves at rest, end point off by {:.3e} mm",
+                     at, (slower - hold) * tq, (rest - hold) * tq, acc * 100,
+                     moved, (s.position - end).length())
+           << endl;
+      // within a tick of the start, from the sample before it
+      bool prompt = slower >= hold && slower * tq <= start(hold * tq) + 2 * tq;
+      errors += !prompt || !rest || acc > 1.001 || moved > 0 ||
+                (s.position - end).length() > 1e-6 ||
+                ex.latency().commands != 2;
+    }
+    m.feed_hold(false);
+  }
+
+  // real time: commands from another thread, for 2 s at most
+  struct Stop {};
+  machine.feed_override(100);
+  machine.feed_hold(false);
+  Executor rt(program, machine);
+  atomic<bool> running = true;
+  thread commander([&]() {
+    mt19937 rng(2);
+    uniform_int_distribution<int> ms(5, 50), percent(20, 200), dice(0, 3);
+    while (running) {
+      this_thread::sleep_for(milliseconds(ms(rng)));
+      if (machine.feed_hold() || dice(rng) == 0)
+        machine.feed_hold(!machine.feed_hold());
+      else
+        machine.feed_override(percent(rng));
+    }
+  });
+  try {
+    rt.run([&](const Executor::Sample &s) {
+      if (s.time > 2) throw Stop();
+    }, true);
+  } catch (Stop &) {}
+  running = false;
+  commander.join();
+  cout << rt.desc() << endl;
+  cout << format("Real time: {} commands, latency max {:.3f} ms (tq = {} ms), "
+                 "mean {:.3f} ms",
+                 rt.latency().commands, rt.latency().max * 1000, tq * 1000,
+                 rt.latency().mean() * 1000)
+       << endl;
+  // one tq at most, plus the scheduling jitter of the test machine
+  errors += rt.latency().mean() > tq;
+
+  cout << (errors == 0 ? "OK" : "FAILED") << endl;
+  return errors == 0 ? 0 : 3;
+}
+
+#endif // EXECUTOR_MAIN
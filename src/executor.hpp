@@ -0,0 +1,132 @@
+/*
+  _____                     _                    _
+ | ____|_  _____  ___ _   _| |_ ___  _ __    ___| | __ _ ___ ___
+ |  _| \ \/ / _ \/ __| | | | __/ _ \| '__|  / __| |/ _` / __/ __|
+ | |___ >  <  __/ (__| |_| | || (_) | |    | (__| | (_| \__ \__ \
+ |_____/_/\_\___|\___|\__,_|\__\___/|_|     \___|_|\__,_|___/___/
+
+Executes a program sample by sample, as a machine controller does, with a
+feed override that can change at any time during the job (see
+Machine::feed_override, also set through MQTT). At the first sample after a
+command, the rest of the current block is re-planned from the current
+position and speed, at the acceleration of the block; the following blocks
+are planned at the new feedrate as they start. Block profiles are never
+changed, so that the program is not re-planned:
+
+  Executor ex(program, machine);
+  ex.run([](const Executor::Sample &s) { ... }, true); // in real time
+  machine.feed_override(50); // from another thread, or via MQTT
+
+The override (0 to 200%) applies to feed moves only, up to the limits of
+the machine along each block; rapids are not affected. At 100% the samples
+are the same as those of a Trajectory.
+
+A feed hold (Machine::feed_hold) is re-timed the same way, down to rest at
+the acceleration of the block, and the motion resumes from there along the
+same path once released. Dog-leg rapids cannot be re-planned, as their path
+depends on their timing: their axes run on a clock of their own instead,
+whose rate goes down to 0 and back up to 1 as fast as the acceleration of
+each axis allows, so that they stop and resume along the same path. An axis
+already braking at its limit cannot brake any harder, though: the clock slows
+down once it is at rest.
+
+Every sample is checked against the travel envelope of the machine (see
+Envelope): a sample out of it throws a CNCError instead of being returned.
+*/
+#ifndef EXECUTOR_HPP
+#define EXECUTOR_HPP
+
+// INCLUDES AND DEFINES --------------------------------------------------------
+#include "defines.hpp"
+#include "block.hpp"
+#include "envelope.hpp"
+#include "machine.hpp"
+#include "program.hpp"
+#include "trajectory.hpp"
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// NAMESPACES AND CONSTANTS ----------------------------------------------------
+using namespace std;
+
+namespace cncpp {
+
+class Executor : Object {
+public:
+  using Sample = Trajectory::Sample;
+
+  // Time from a command (override or hold) to the first sample affected
+  struct Latency {
+    size_t commands = 0;      // commands applied
+    double max = 0, total = 0; // s
+    double mean() const { return commands ? total / commands : 0; }
+  };
+
+  // LIFECYCLE -----------------------------------------------------------------
+  // The program must outlive the executor, and be left unchanged meanwhile;
+  // it is only read, so that several executors can share it (Orchestrator)
+  Executor(Program &program, Machine &machine);
+  string desc(bool colored = true) const override;
+
+  // METHODS -------------------------------------------------------------------
+  // Next sample, one tq after the previous one: false once the program is
+  // over (the last sample is at or past the end, as for a Trajectory).
+  // Throws a CNCError if the sample is out of the travel envelope
+  bool step(Sample &s);
+  // All the remaining samples. In real time, each sample is computed at its
+  // own time (k * tq from the call), so that an override command takes
+  // effect within one tq
+  void run(function<void(const Sample &s)> f, bool realtime = false);
+
+  // ACCESSORS -----------------------------------------------------------------
+  data_t feed_override() const { return _override; } // applied (%)
+  bool held() const { return _held; } // holding, or stopping to hold
+  const Latency &latency() const { return _latency; }
+  size_t tick() const { return _tick; }
+  bool done() const { return _done; }
+
+private:
+  Program::Cursor _cursor;
+  Machine &_machine;
+  double _tq;
+  size_t _tick = 0;
+  bool _done = false;
+  // current block, moving along _profile since _t0
+  Block *_block = nullptr;
+  Vec3 _offset;
+  Block::Profile _profile;
+  bool _nominal = true;        // _profile is the one of the block
+  double _start = 0, _t0 = 0;  // start of the block and of _profile (s)
+  data_t _s0 = 0;              // length traveled before _t0 (mm)
+  data_t _override = 100;
+  bool _held = false;
+  uint64_t _commands = 0;      // commands seen so far
+  Latency _latency;
+  bool _pending = false;       // a command waits for its first sample
+  chrono::steady_clock::time_point _issued; // of that command
+  // dog-leg rapid on a clock of its own, at _rate of the time at _t0
+  bool _warped = false;
+  double _tau = 0, _end = 0;   // its time at _t0, and its end once known (s)
+  data_t _rate = 1;            // 0 (held) to 1 (as planned)
+  Block::Profile _axes[3];     // of the block, along its time
+  Envelope _envelope;          // soft limits
+
+  // next block taking time, starting where the current one ends; false if
+  // there is none, and the current one is kept
+  bool advance();
+  // re-plans the rest of the current block from time on
+  void retime(double time);
+  // time and rate of the clock of a dog-leg rapid at time; sets _end once
+  // it is reached
+  void warp(double time, double &tau, data_t &rate);
+  void warp(); // the current dog-leg rapid on its own clock from now on
+  double end() const { return _warped ? _end : _t0 + _profile.dt; }
+  bool overridden() const; // the current block is a feed move
+  data_t feedrate() const; // of the current block, with override and hold
+};
+
+} // namespace cncpp
+
+#endif // EXECUTOR_HPP
@@ -0,0 +1,197 @@
+/*
+   ____                           _                    _
+  / ___| ___ _ __   ___ _ __ __ _| |_ ___  _ __    ___| | __ _ ___ ___
+ | |  _ / _ \ '_ \ / _ \ '__/ _` | __/ _ \| '__|  / __| |/ _` / __/ __|
+ | |_| |  __/ | | |  __/ | | (_| | || (_) | |    | (__| | (_| \__ \__ \
+  \____|\___|_| |_|\___|_|  \__,_|\__\___/|_|     \___|_|\__,_|___/___/
+
+Class implementation
+*/
+
+#include "generator.hpp"
+#include <cmath>
+#include <fmt/core.h>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+using namespace cncpp;
+using namespace fmt;
+
+// The generated toolpath stays within a square of this side (mm), with Z
+// between 0 and WORK_HEIGHT
+#define WORK_SIDE 400.0
+#define WORK_HEIGHT 50.0
+#define MAX_STEP 20.0
+
+// Round to the 4 decimals that are written in the G-code, so that the next
+// block starts exactly where the parser will think the previous one ended
+static data_t round4(data_t v) { return round(v * 1E4) / 1E4; }
+
+const map<Generator::Kind, string> Generator::kinds = {
+  {Kind::LINES, "lines"},
+  {Kind::ARCS, "arcs"},
+  {Kind::MIXED, "mixed"}
+};
+
+
+// LIFECYCLE -------------------------------------------------------------------
+Generator::Generator(Kind kind, unsigned seed) : _kind(kind), _seed(seed) {
+  reset();
+}
+
+string Generator::desc(bool colored) const {
+  return format("Generator: {} (seed {}), {} lines so far", kinds.at(_kind),
+                _seed, _count);
+}
+
+void Generator::reset() {
+  _rng.seed(_seed);
+  _count = 0;
+  _x = _y = WORK_SIDE / 2.0;
+  _z = WORK_HEIGHT / 5.0;
+  _feedrate = 0;
+}
+
+
+// METHODS ---------------------------------------------------------------------
+string Generator::next() {
+  string body;
+  if (_count == 0) { // rapid to the starting point, select tool and spindle
+    body = format("G00 X{:.4f} Y{:.4f} Z{:.4f} T01 S2000", _x, _y, _z);
+  } else {
+    data_t dice = uniform(0, 1);
+    switch (_kind) {
+    case Kind::LINES:
+      body = line();
+      break;
+    case Kind::ARCS:
+      body = arc();
+      break;
+    case Kind::MIXED:
+      if (dice < 0.05) // no motion: change feedrate and spindle speed
+        body = format("F{:.0f} S{:.0f}", _feedrate = round(uniform(1000, 5000)),
+                      round(uniform(1000, 3000)));
+      else if (dice < 0.65)
+        body = line();
+      else
+        body = arc();
+      break;
+    }
+  }
+  _count++;
+  return format("N{} {}", _count * 10, body);
+}
+
+vector<string> Generator::lines(size_t n) {
+  vector<string> result;
+  result.reserve(n);
+  for (size_t i = 0; i < n; i++)
+    result.push_back(next());
+  return result;
+}
+
+void Generator::write(ostream &out, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    out << next() << '\n';
+}
+
+void Generator::write(const string &filename, size_t n) {
+  ofstream file(filename);
+  if (!file.is_open()) {
+    throw CNCError("Could not open file " + filename, this);
+  }
+  write(file, n);
+}
+
+
+/*
+  ____       _            _                        _   _               _
+ |  _ \ _ __(_)_   ____ _| |_ ___   _ __ ___   ___| |_| |__   ___   __| |___
+ | |_) | '__| \ \ / / _` | __/ _ \ | '_ ` _ \ / _ \ __| '_ \ / _ \ / _` / __|
+ |  __/| |  | |\ V / (_| | ||  __/ | | | | | |  __/ |_| | | | (_) | (_| \__ \
+ |_|   |_|  |_| \_/ \__,_|\__\___| |_| |_| |_|\___|\__|_| |_|\___/ \__,_|___/
+
+*/
+
+// Random walk step, bouncing back from the work area limits
+string Generator::line() {
+  stringstream ss;
+  data_t dx = uniform(-MAX_STEP, MAX_STEP);
+  data_t dy = uniform(-MAX_STEP, MAX_STEP);
+  if (_x + dx < 0 || _x + dx > WORK_SIDE) dx = -dx;
+  if (_y + dy < 0 || _y + dy > WORK_SIDE) dy = -dy;
+  _x = round4(_x + dx);
+  _y = round4(_y + dy);
+  ss << format("G01 X{:.4f} Y{:.4f}", _x, _y);
+  if (uniform(0, 1) < 0.1) {
+    _z = round4(uniform(0, WORK_HEIGHT));
+    ss << format(" Z{:.4f}", _z);
+  }
+  if (_feedrate == 0) {
+    _feedrate = 2000;
+    ss << format(" F{:.0f}", _feedrate);
+  }
+  return ss.str();
+}
+
+// Arc with I,J center offset; the center is biased towards the middle of the
+// work area so that the toolpath does not drift away
+string Generator::arc() {
+  stringstream ss;
+  bool ccw = uniform(0, 1) < 0.5;
+  data_t r = uniform(5, 30);
+  data_t phi = atan2(WORK_SIDE / 2.0 - _y, WORK_SIDE / 2.0 - _x) +
+               uniform(-M_PI / 2.0, M_PI / 2.0);
+  data_t i = round4(r * cos(phi)), j = round4(r * sin(phi));
+  data_t xc = _x + i, yc = _y + j;
+  data_t sweep = uniform(M_PI / 6.0, 3.0 * M_PI / 2.0);
+  data_t theta = atan2(_y - yc, _x - xc) + (ccw ? sweep : -sweep);
+  r = hypot(i, j);
+  _x = round4(xc + r * cos(theta));
+  _y = round4(yc + r * sin(theta));
+  ss << format("G0{} X{:.4f} Y{:.4f} I{:.4f} J{:.4f}", ccw ? 3 : 2, _x, _y, i,
+               j);
+  if (_feedrate == 0) {
+    _feedrate = 2000;
+    ss << format(" F{:.0f}", _feedrate);
+  }
+  return ss.str();
+}
+
+data_t Generator::uniform(data_t from, data_t to) {
+  return uniform_real_distribution<data_t>(from, to)(_rng);
+}
+
+
+
+/*
+  _____         _                     _
+ |_   _|__  ___| |_   _ __ ___   __ _(_)_ __
+   | |/ _ \/ __| __| | '_ ` _ \ / _` | | '_ \
+   | |  __/\__ \ |_  | | | | | | (_| | | | | |
+   |_|\___||___/\__| |_| |_| |_|\__,_|_|_| |_|
+
+*/
+
+#ifdef GENERATOR_MAIN
+
+#include <iostream>
+
+// Usage: generator_test [lines|arcs|mixed] [n] [seed] > program.gcode
+int main(int argc, const char *argv[]) {
+  Generator::Kind kind = Generator::Kind::MIXED;
+  size_t n = argc > 2 ? stoul(argv[2]) : 20;
+  unsigned seed = argc > 3 ? stoul(argv[3]) : 0;
+  if (argc > 1) {
+    for (auto &[k, name] : Generator::kinds) {
+      if (name == argv[1]) kind = k;
+    }
+  }
+  Generator gen(kind, seed);
+  gen.write(cout, n);
+  cerr << gen.desc() << endl;
+  return 0;
+}
+
+#endif // GENERATOR_MAIN
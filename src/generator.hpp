@@ -0,0 +1,67 @@
+/*
+   ____                           _                    _
+  / ___| ___ _ __   ___ _ __ __ _| |_ ___  _ __    ___| | __ _ ___ ___
+ | |  _ / _ \ '_ \ / _ \ '__/ _` | __/ _ \| '__|  / __| |/ _` / __/ __|
+ | |_| |  __/ | | |  __/ | | (_| | || (_) | |    | (__| | (_| \__ \__ \
+  \____|\___|_| |_|\___|_|  \__,_|\__\___/|_|     \___|_|\__,_|___/___/
+
+Synthetic G-code generator, used to produce arbitrarily large programs made
+of segments, arcs, or a mix of both, e.g. for benchmarking the parser and the
+interpolator. The output is deterministic for a given kind and seed.
+*/
+#ifndef GENERATOR_HPP
+#define GENERATOR_HPP
+
+// INCLUDES AND DEFINES --------------------------------------------------------
+#include "defines.hpp"
+#include <map>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// NAMESPACES AND CONSTANTS ----------------------------------------------------
+using namespace std;
+
+namespace cncpp {
+
+class Generator : Object {
+public:
+  enum class Kind { LINES = 0, ARCS, MIXED };
+
+  // kinds[Kind::ARCS] => "arcs"
+  static const map<Kind, string> kinds;
+
+  // LIFECYCLE -----------------------------------------------------------------
+  Generator(Kind kind = Kind::MIXED, unsigned seed = 0);
+  string desc(bool colored = true) const override;
+  void reset();
+
+  // METHODS -------------------------------------------------------------------
+  string next();                        // next G-code line
+  vector<string> lines(size_t n);       // next n lines
+  void write(ostream &out, size_t n);   // next n lines, one per row
+  void write(const string &filename, size_t n);
+
+  // ACCESSORS -----------------------------------------------------------------
+  Kind kind() const { return _kind; }
+  unsigned seed() const { return _seed; }
+  size_t count() const { return _count; }
+
+private:
+  Kind _kind;
+  unsigned _seed;
+  mt19937 _rng;
+  size_t _count = 0;                    // lines generated so far
+  data_t _x = 0, _y = 0, _z = 0;        // current position
+  data_t _feedrate = 0;
+
+  // PRIVATE METHODS -----------------------------------------------------------
+  string line();
+  string arc();
+  data_t uniform(data_t from, data_t to);
+};
+
+} // namespace cncpp
+
+#endif // GENERATOR_HPP
@@ -0,0 +1,381 @@
+/*
+  ___           _                  _
+ |_ _|_ __   __| | _____  __   ___| | __ _ ___ ___
+  | || '_ \ / _` |/ _ \ \/ /  / __| |/ _` / __/ __|
+  | || | | | (_| |  __/>  <  | (__| | (_| \__ \__ \
+ |___|_| |_|\__,_|\___/_/\_\  \___|_|\__,_|___/___/
+
+
+Class implementation
+*/
+
+#include "index.hpp"
+#include "parallel.hpp"
+#include <fmt/core.h>
+#include <numeric>
+#include <queue>
+
+using namespace std;
+using namespace cncpp;
+using namespace fmt;
+
+// Subtrees at least this large are built on a task of their own
+#define TASK_ENTRIES 4096
+
+Index::Index(Program &program, data_t tolerance, unsigned threads)
+    : _tol(tolerance), _root(LEAF) {
+  if (!(tolerance > 0)) throw CNCError("Invalid index tolerance", this);
+  for (auto c = program.cursor(); !c.done(); ++c) {
+    Block &b = c.block();
+    if (b.type() == Block::BlockType::NO_MOTION || !(b.length() > 0))
+      continue;
+    _entries.push_back({&b, c.offset(), Box{}});
+  }
+  if (_entries.size() >= LEAF) throw CNCError("Too many blocks to index", this);
+  // dog-leg rapids stay within the box of their end points, too
+  parallel_for(_entries.size(), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      Entry &e = _entries[i];
+      e.block->geometry().bounds(e.box.lo, e.box.hi);
+      e.box.lo = e.box.lo + e.offset;
+      e.box.hi = e.box.hi + e.offset;
+    }
+  }, threads);
+  if (_entries.size() < 2) return;
+
+  vector<uint32_t> order(_entries.size());
+  iota(order.begin(), order.end(), 0);
+  _nodes.resize(_entries.size() - 1);
+  _root = 0;
+  Pool pool(threads);
+  build(order, 0, order.size(), 0, pool);
+  pool.wait();
+}
+
+string Index::desc(bool colored) const {
+  return format("Index: {} moves, {} nodes, tolerance {} mm", _entries.size(),
+                _nodes.size(), _tol);
+}
+
+// Entries [begin, end) of order, split at the median of their centers along
+// the longest side. A subtree of n entries takes n - 1 consecutive nodes: the
+// left one follows its parent, and the right one the left subtree, so that
+// the layout is fixed before the subtrees are built
+void Index::build(vector<uint32_t> &order, size_t begin, size_t end,
+                  uint32_t node, Pool &pool) {
+  Box all, centers;
+  for (size_t i = begin; i < end; i++) {
+    const Box &b = _entries[order[i]].box;
+    all.extend(b);
+    centers.extend((b.lo + b.hi) * data_t(0.5));
+  }
+  Vec3 side = centers.hi - centers.lo;
+  size_t axis = side.x() >= side.y() ? (side.x() >= side.z() ? 0 : 2)
+                                     : (side.y() >= side.z() ? 1 : 2);
+  size_t mid = begin + (end - begin) / 2;
+  nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+              [&](uint32_t a, uint32_t b) {
+                const Box &ba = _entries[a].box, &bb = _entries[b].box;
+                data_t ca = ba.lo.c[axis] + ba.hi.c[axis];
+                data_t cb = bb.lo.c[axis] + bb.hi.c[axis];
+                return ca < cb || (ca == cb && a < b);
+              });
+  uint32_t left = node + 1, right = node + (mid - begin);
+  Node &n = _nodes[node];
+  n.box = all;
+  n.child[0] = mid - begin == 1 ? LEAF | order[begin] : left;
+  n.child[1] = end - mid == 1 ? LEAF | order[mid] : right;
+  if (end - mid > 1) {
+    if (end - mid >= TASK_ENTRIES)
+      pool.submit([this, &order, &pool, mid, end, right]() {
+        build(order, mid, end, right, pool);
+      });
+    else
+      build(order, mid, end, right, pool);
+  }
+  if (mid - begin > 1) build(order, begin, mid, left, pool);
+}
+
+// Distance from p to segment a-b
+static data_t segment_distance(const Vec3 &p, const Vec3 &a, const Vec3 &b) {
+  Vec3 d = b - a, w = p - a;
+  data_t l2 = d.dot(d);
+  data_t t = l2 > 0 ? min<data_t>(max<data_t>(w.dot(d) / l2, 0), 1) : 0;
+  return (w - d * t).length();
+}
+
+// Whether segment a-b crosses box (slab test)
+static bool segment_crosses(const Vec3 &a, const Vec3 &b, const Index::Box &box) {
+  data_t t_0 = 0, t_1 = 1;
+  for (size_t i = 0; i < 3; i++) {
+    data_t d = b.c[i] - a.c[i];
+    if (d == 0) {
+      if (a.c[i] < box.lo.c[i] || a.c[i] > box.hi.c[i]) return false;
+      continue;
+    }
+    data_t t_a = (box.lo.c[i] - a.c[i]) / d, t_b = (box.hi.c[i] - a.c[i]) / d;
+    t_0 = max(t_0, min(t_a, t_b));
+    t_1 = min(t_1, max(t_a, t_b));
+    if (t_0 > t_1) return false;
+  }
+  return true;
+}
+
+data_t Index::distance(const Entry &e, const Vec3 &p) const {
+  thread_local vector<Vec3> pts;
+  e.block->path(_tol, pts);
+  Vec3 q = p - e.offset;
+  data_t d = numeric_limits<data_t>::infinity();
+  for (size_t i = 1; i < pts.size(); i++)
+    d = min(d, segment_distance(q, pts[i - 1], pts[i]));
+  return d;
+}
+
+bool Index::crosses(const Entry &e, const Box &b) const {
+  if (!e.box.intersects(b)) return false;
+  thread_local vector<Vec3> pts;
+  e.block->path(_tol, pts);
+  Box shifted{b.lo - e.offset, b.hi - e.offset};
+  for (size_t i = 1; i < pts.size(); i++)
+    if (segment_crosses(pts[i - 1], pts[i], shifted)) return true;
+  return false;
+}
+
+vector<const Index::Entry *> Index::query(const Box &b) const {
+  vector<uint32_t> found;
+  if (_entries.empty()) return {};
+  vector<uint32_t> stack{_root};
+  while (!stack.empty()) {
+    uint32_t ref = stack.back();
+    stack.pop_back();
+    if (!box(ref).intersects(b)) continue;
+    if (ref & LEAF) {
+      if (crosses(_entries[ref & ~LEAF], b)) found.push_back(ref & ~LEAF);
+    } else {
+      stack.push_back(_nodes[ref].child[0]);
+      stack.push_back(_nodes[ref].child[1]);
+    }
+  }
+  sort(found.begin(), found.end());
+  vector<const Entry *> result;
+  for (auto i : found)
+    result.push_back(&_entries[i]);
+  return result;
+}
+
+vector<const Index::Entry *> Index::query(const Vec3 &p, data_t d) const {
+  vector<uint32_t> found;
+  if (_entries.empty()) return {};
+  vector<uint32_t> stack{_root};
+  while (!stack.empty()) {
+    uint32_t ref = stack.back();
+    stack.pop_back();
+    if (box(ref).distance(p) > d) continue;
+    if (ref & LEAF) {
+      if (distance(_entries[ref & ~LEAF], p) <= d)
+        found.push_back(ref & ~LEAF);
+    } else {
+      stack.push_back(_nodes[ref].child[0]);
+      stack.push_back(_nodes[ref].child[1]);
+    }
+  }
+  sort(found.begin(), found.end());
+  vector<const Entry *> result;
+  for (auto i : found)
+    result.push_back(&_entries[i]);
+  return result;
+}
+
+// Best first: boxes are visited by increasing distance, until the closest
+// one is farther than the best block so far
+const Index::Entry *Index::nearest(const Vec3 &p, data_t *distance) const {
+  using item = pair<data_t, uint32_t>;
+  priority_queue<item, vector<item>, greater<item>> queue;
+  data_t best = numeric_limits<data_t>::infinity();
+  uint32_t best_i = 0;
+  if (!_entries.empty()) queue.push({box(_root).distance(p), _root});
+  while (!queue.empty() && queue.top().first <= best) {
+    uint32_t ref = queue.top().second;
+    queue.pop();
+    if (ref & LEAF) {
+      uint32_t i = ref & ~LEAF;
+      data_t d = this->distance(_entries[i], p);
+      if (d < best || (d == best && i < best_i)) {
+        best = d;
+        best_i = i;
+      }
+    } else {
+      for (uint32_t c : _nodes[ref].child) {
+        data_t d = box(c).distance(p);
+        if (d <= best) queue.push({d, c});
+      }
+    }
+  }
+  if (distance) *distance = best;
+  return _entries.empty() ? nullptr : &_entries[best_i];
+}
+
+
+/*
+  _____         _                     _
+ |_   _|__  ___| |_   _ __ ___   __ _(_)_ __
+   | |/ _ \/ __| __| | '_ ` _ \ / _` | | '_ \
+   | |  __/\__ \ |_  | | | | | | (_| | | | | |
+   |_|\___||___/\__| |_| |_| |_|\__,_|_|_| |_|
+
+*/
+
+#ifdef INDEX_MAIN
+
+#include "generator.hpp"
+#include <yaml-cpp/yaml.h>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <unistd.h>
+
+using namespace std::chrono;
+
+// Random box, distance and nearest queries against a linear scan of all the
+// blocks, on a generated (or given) program
+int main(int argc, const char *argv[]) {
+  if (argc < 2) {
+    cerr << "Usage: " << argv[0] << " <machine.yml> [program.gcode]" << endl;
+    return 1;
+  }
+  Machine machine(argv[1]);
+  Program program(&machine);
+  if (argc > 2) {
+    program.load(argv[2]);
+  } else {
+    Generator gen;
+    for (auto &line : gen.lines(20000))
+      program << line;
+  }
+
+  auto t0 = steady_clock::now();
+  Index serial(program, 1e-3, 1);
+  auto t1 = steady_clock::now();
+  Index index(program);
+  auto t2 = steady_clock::now();
+  cout << index.desc() << endl;
+  cout << format("Built in {:.3f} s on 1 thread, {:.3f} s on {} threads",
+                 duration<double>(t1 - t0).count(),
+                 duration<double>(t2 - t1).count(), default_threads())
+       << endl;
+
+  // linear scan: every path, at the same tolerance
+  vector<vector<Vec3>> paths;
+  for (auto &e : index.entries()) {
+    paths.emplace_back();
+    e.block->path(index.tolerance(), paths.back());
+    for (auto &p : paths.back())
+      p = p + e.offset;
+  }
+  auto distance = [](const Vec3 &p, const vector<Vec3> &path) {
+    data_t d = numeric_limits<data_t>::infinity();
+    for (size_t i = 1; i < path.size(); i++) {
+      Vec3 s = path[i] - path[i - 1], w = p - path[i - 1];
+      data_t l2 = s.dot(s);
+      data_t t = l2 > 0 ? min<data_t>(max<data_t>(w.dot(s) / l2, 0), 1) : 0;
+      d = min(d, (w - s * t).length());
+    }
+    return d;
+  };
+
+  mt19937 rng(0);
+  uniform_real_distribution<data_t> coord(-50, 450), size(0, 20);
+  size_t errors = 0, queries = 200, found = 0;
+  double t_index = 0, t_scan = 0;
+  for (size_t q = 0; q < queries; q++) {
+    Vec3 p(coord(rng), coord(rng), coord(rng) / 10);
+    data_t r = size(rng);
+    auto s0 = steady_clock::now();
+    auto within = index.query(p, r);
+    data_t d_near;
+    const Index::Entry *near = index.nearest(p, &d_near);
+    auto s1 = steady_clock::now();
+    vector<const Index::Entry *> scan;
+    data_t best = numeric_limits<data_t>::infinity();
+    for (size_t i = 0; i < paths.size(); i++) {
+      data_t d = distance(p, paths[i]);
+      if (d <= r) scan.push_back(&index.entries()[i]);
+      best = min(best, d);
+    }
+    auto s2 = steady_clock::now();
+    t_index += duration<double>(s1 - s0).count();
+    t_scan += duration<double>(s2 - s1).count();
+    found += within.size();
+    // the same up to rounding, where subprogram offsets are applied
+    errors += within != scan || !near ||
+              fabs(d_near - best) > index.tolerance() / 10;
+  }
+  // boxes: through the box centers, a box is crossed by whatever passes
+  // within its inscribed sphere, and is not by what is farther than its
+  // circumscribed one
+  for (size_t q = 0; q < queries; q++) {
+    Vec3 c(coord(rng), coord(rng), coord(rng) / 10);
+    data_t h = size(rng) / 2;
+    Index::Box box{c - Vec3(h, h, h), c + Vec3(h, h, h)};
+    auto crossed = index.query(box);
+    for (size_t i = 0, k = 0; i < paths.size(); i++) {
+      bool in = k < crossed.size() && crossed[k] == &index.entries()[i];
+      k += in;
+      data_t d = distance(c, paths[i]);
+      errors += (d <= h && !in) || (d > h * sqrt(3.0) + 1e-6 && in);
+    }
+  }
+  // same results whatever the number of threads
+  auto positions = [](const Index &index, vector<const Index::Entry *> v) {
+    vector<size_t> pos;
+    for (auto e : v)
+      pos.push_back(e - index.entries().data());
+    return pos;
+  };
+  for (size_t i = 0; i < 100; i++) {
+    Vec3 p(coord(rng), coord(rng), coord(rng) / 10);
+    errors += positions(serial, serial.query(p, 10)) !=
+                  positions(index, index.query(p, 10)) ||
+              positions(serial, {serial.nearest(p)}) !=
+                  positions(index, {index.nearest(p)});
+  }
+  cout << format("{} queries: {:.1f} us each vs. {:.1f} us for a linear scan, "
+                 "{} blocks found",
+                 queries, t_index / queries * 1e6, t_scan / queries * 1e6,
+                 found)
+       << endl;
+
+  // dog-leg rapids: their path is within the tolerance as well, also where
+  // the axes meet
+  {
+    auto data = YAML::LoadFile(argv[1]);
+    data["machine"]["dogleg"] = true;
+    string settings = format("/tmp/cncpp_index_{}.yml", getpid());
+    ofstream(settings) << data << endl;
+    Machine m(settings);
+    remove(settings.c_str());
+    Program rapids(&m);
+    rapids << "N10 G00 X0 Y0 Z0" << "N20 G00 X400 Y100 Z50";
+    Block &rapid = rapids.back();
+    vector<Vec3> path;
+    rapid.path(index.tolerance(), path);
+    data_t worst = 0, t, speed;
+    for (size_t k = 0; k <= 20000; k++) {
+      Vec3 p = rapid.position(rapid.profile().dt * k / 20000, t, speed);
+      worst = max(worst, distance(p, path));
+    }
+    cout << format("Dog-leg rapid: {} points, {:.3e} mm off at most "
+                   "(tolerance {})",
+                   path.size(), worst, index.tolerance())
+         << endl;
+    // up to the rounding of positions of a few hundred mm
+    errors += worst > index.tolerance() +
+                          1000 * numeric_limits<data_t>::epsilon();
+  }
+
+  cout << (errors == 0 ? "OK" : "FAILED") << endl;
+  return errors == 0 ? 0 : 3;
+}
+
+#endif // INDEX_MAIN
@@ -0,0 +1,130 @@
+/*
+  ___           _                  _
+ |_ _|_ __   __| | _____  __   ___| | __ _ ___ ___
+  | || '_ \ / _` |/ _ \ \/ /  / __| |/ _` / __/ __|
+  | || | | | (_| |  __/>  <  | (__| | (_| \__ \__ \
+ |___|_| |_|\__,_|\___/_/\_\  \___|_|\__,_|___/___/
+
+
+Spatial index of the blocks of a program, for region and proximity queries
+(fixture collisions, picking) that would otherwise scan every block. It is a
+bounding volume hierarchy on the boxes of the executed moves, subprogram
+repetitions included, built in parallel:
+
+  Index index(program);
+  for (auto e : index.query(Index::Box{lo, hi})) ...  // crossing a box
+  for (auto e : index.query(clamp, 2.0)) ...          // within 2 mm
+  const Index::Entry *e = index.nearest(p, &d);         // closest block
+
+Boxes only narrow down the candidates: these are then tested on their path,
+with arcs and dog-leg rapids split in chords within the index tolerance (see
+Block::path), so that results are exact up to it. Queries are const, and can run concurrently.
+*/
+#ifndef INDEX_HPP
+#define INDEX_HPP
+
+// INCLUDES AND DEFINES --------------------------------------------------------
+#include "defines.hpp"
+#include "block.hpp"
+#include "program.hpp"
+#include "pool.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+// NAMESPACES AND CONSTANTS ----------------------------------------------------
+using namespace std;
+
+namespace cncpp {
+
+class Index : Object {
+public:
+  // Axis-aligned box; the default one is empty
+  struct Box {
+    Vec3 lo{numeric_limits<data_t>::max(), numeric_limits<data_t>::max(),
+            numeric_limits<data_t>::max()};
+    Vec3 hi{numeric_limits<data_t>::lowest(), numeric_limits<data_t>::lowest(),
+            numeric_limits<data_t>::lowest()};
+
+    void extend(const Vec3 &p) {
+      for (size_t i = 0; i < 3; i++) {
+        lo.c[i] = min(lo.c[i], p.c[i]);
+        hi.c[i] = max(hi.c[i], p.c[i]);
+      }
+    }
+    void extend(const Box &b) {
+      for (size_t i = 0; i < 3; i++) {
+        lo.c[i] = min(lo.c[i], b.lo.c[i]);
+        hi.c[i] = max(hi.c[i], b.hi.c[i]);
+      }
+    }
+    bool intersects(const Box &b) const {
+      for (size_t i = 0; i < 3; i++)
+        if (b.lo.c[i] > hi.c[i] || b.hi.c[i] < lo.c[i]) return false;
+      return true;
+    }
+    // 0 inside
+    data_t distance(const Vec3 &p) const {
+      data_t d2 = 0;
+      for (size_t i = 0; i < 3; i++) {
+        data_t d = max({lo.c[i] - p.c[i], p.c[i] - hi.c[i], data_t(0)});
+        d2 += d * d;
+      }
+      return std::sqrt(d2);
+    }
+  };
+
+  // A move, in execution order: its positions are shifted by offset
+  struct Entry {
+    Block *block;
+    Vec3 offset;
+    Box box;
+  };
+
+  // LIFECYCLE -----------------------------------------------------------------
+  // The program must outlive the index, and must not change
+  Index(Program &program, data_t tolerance = 1e-3, unsigned threads = 0);
+  string desc(bool colored = true) const override;
+
+  // METHODS -------------------------------------------------------------------
+  // Blocks whose path crosses box, in execution order
+  vector<const Entry *> query(const Box &box) const;
+  // Blocks passing within distance of p, in execution order
+  vector<const Entry *> query(const Vec3 &p, data_t distance) const;
+  // Closest block to p (the first in execution order on ties), nullptr if
+  // the index is empty
+  const Entry *nearest(const Vec3 &p, data_t *distance = nullptr) const;
+
+  // ACCESSORS -----------------------------------------------------------------
+  const vector<Entry> &entries() const { return _entries; }
+  size_t size() const { return _entries.size(); }
+  data_t tolerance() const { return _tol; }
+
+private:
+  // Internal node: children are nodes, or entries when flagged with LEAF
+  struct Node {
+    Box box;
+    uint32_t child[2];
+  };
+  static constexpr uint32_t LEAF = 0x80000000;
+
+  data_t _tol;
+  vector<Entry> _entries;
+  vector<Node> _nodes;   // n - 1 for n entries, root first
+  uint32_t _root;
+
+  void build(vector<uint32_t> &order, size_t begin, size_t end, uint32_t node,
+             Pool &pool);
+  const Box &box(uint32_t ref) const {
+    return ref & LEAF ? _entries[ref & ~LEAF].box : _nodes[ref].box;
+  }
+  // exact distance from p to the path of e, within the tolerance
+  data_t distance(const Entry &e, const Vec3 &p) const;
+  bool crosses(const Entry &e, const Box &b) const;
+};
+
+} // namespace cncpp
+
+#endif // INDEX_HPP
@@ -12,6 +12,8 @@ Class implementation
 #include <yaml-cpp/yaml.h>
 #include <sstream>
 #include <iostream>
+#include <cmath>
+#include <limits>
 #include <rang.hpp>
 
 using namespace rang;
@@ -36,11 +38,14 @@ Machine::~Machine() {
 void Machine::load(const string &s) {
   _settings_file = s;
   auto data = YAML::LoadFile(s);
+  _settings_time = filesystem::last_write_time(s);
   auto machine = data["machine"];
   _A = machine["A"].as<data_t>();
   _tq = machine["tq"].as<data_t>();
   _fmax = machine["fmax"].as<data_t>();
   _max_error = machine["max_error"].as<data_t>();
+  _dogleg = machine["dogleg"].as<bool>(false);
+  _stamp = machine["stamp"].as<bool>(false);
   _zero = Point(
     machine["zero"][0].as<data_t>(),
     machine["zero"][1].as<data_t>(),
@@ -51,12 +56,42 @@ void Machine::load(const string &s) {
     machine["offset"][1].as<data_t>(),
     machine["offset"][2].as<data_t>()
   );
-  //MQTT parameters
-  _mqtt_host = data["mqtt"]["host"].as<string>("localhost");
-  _mqtt_port = data["mqtt"]["port"].as<int>(1883);
-  _mqtt_keepalive = data["mqtt"]["keepalive"].as<int>(60);
-  _pub_topic = data["mqtt"]["topics"]["pub"].as<string>("cnc/setpoint");
-  _sub_topic = data["mqtt"]["topics"]["sub"].as<string>("cnc/status/#");
+  // per-axis limits, defaulting to the machine ones
+  for (size_t i = 0; i < 3; i++) {
+    auto axis = machine["axes"][string(1, "XYZ"[i])];
+    _vmax[i] = axis["vmax"].as<data_t>(_fmax);
+    _amax[i] = axis["amax"].as<data_t>(_A);
+    // length is in m
+    _travel[i] = axis["length"] ? axis["length"].as<data_t>() * 1000 : INFINITY;
+  }
+  // tool table: T number -> radius and shape
+  _tools.clear();
+  for (auto t : machine["tools"]) {
+    Tool &tool = _tools[t.first.as<size_t>()];
+    tool.radius = t.second["radius"].as<data_t>();
+    string shape = t.second["shape"].as<string>("flat");
+    if (shape != "flat" && shape != "ball")
+      throw CNCError("Unknown tool shape " + shape, this);
+    tool.ball = shape == "ball";
+  }
+  // MQTT parameters, under machine: as in machine.yml (or at the root, as in
+  // older settings files)
+  auto mqtt = machine["mqtt"] ? machine["mqtt"] : data["mqtt"];
+  _mqtt_host = mqtt["host"].as<string>("localhost");
+  _mqtt_port = mqtt["port"].as<int>(1883);
+  _mqtt_keepalive = mqtt["keepalive"].as<int>(60);
+  _pub_topic = mqtt["topics"]["pub"].as<string>("cnc/setpoint");
+  _sub_topic = mqtt["topics"]["sub"].as<string>("cnc/status/#");
+  _override_topic = mqtt["topics"]["override"].as<string>("cnc/override");
+}
+
+bool Machine::reload() {
+  error_code ec;
+  if (_settings_file.empty() ||
+      filesystem::last_write_time(_settings_file, ec) == _settings_time || ec)
+    return false;
+  load(_settings_file);
+  return true;
 }
 
 string Machine::desc(bool colored) const {
@@ -64,18 +99,48 @@ string Machine::desc(bool colored) const {
   ss << "A = " << _A << ", ";
   ss << "tq = " << _tq << ", ";
   ss << "max_error = " << _max_error << ", ";
-  ss << "fmax = " << _fmax << endl;
+  ss << "fmax = " << _fmax << ", ";
+  ss << "dogleg = " << (_dogleg ? "true" : "false") << ", ";
+  ss << "stamp = " << (_stamp ? "true" : "false") << endl;
+  ss << "vmax = [" << _vmax[0] << ", " << _vmax[1] << ", " << _vmax[2] << "], ";
+  ss << "amax = [" << _amax[0] << ", " << _amax[1] << ", " << _amax[2] << "], ";
+  ss << "travel = [" << _travel[0] << ", " << _travel[1] << ", " << _travel[2]
+     << "]" << endl;
+  ss << "tools = [";
+  for (auto &[n, t] : _tools)
+    ss << (n == _tools.begin()->first ? "" : ", ") << "T" << n << ": "
+       << (t.ball ? "ball" : "flat") << " r" << t.radius;
+  ss << "]" << endl;
   ss << "zero = " << _zero.desc(colored) << endl;
   ss << "offset = " << _offset.desc(colored) << endl;
-  ss << "MQTT host = " << mqtt_host() << endl;
+  ss << "MQTT host = " << mqtt_host() << ", override topic = "
+     << _override_topic << endl;
   return ss.str();
 }
 
-data_t Machine::quantize(data_t t, data_t &dq) const {
-  data_t q;
-  q = static_cast<size_t>((t / _tq) + 1) * _tq;
-  dq = q - t;
-  return q;
+const Machine::Tool &Machine::tool(size_t n) const {
+  auto found = _tools.find(n);
+  if (found == _tools.end())
+    throw CNCError("Tool T" + to_string(n) + " is not in the tool table", this);
+  return found->second;
+}
+
+// Along direction c, axis i moves at |c_i| times the path speed, so the path
+// speed is limited by lim_i / |c_i|; axes that do not move are not limiting
+static data_t axes_limit(const data_t lim[3], const Vec3 &c, data_t none) {
+  data_t l = numeric_limits<data_t>::infinity();
+  for (size_t i = 0; i < 3; i++) {
+    if (fabs(c.c[i]) > 0) l = min(l, lim[i] / fabs(c.c[i]));
+  }
+  return isinf(l) ? none : l;
+}
+
+data_t Machine::feed_limit(const Vec3 &cosines) const {
+  return min(_fmax, axes_limit(_vmax, cosines, _fmax));
+}
+
+data_t Machine::acc_limit(const Vec3 &cosines) const {
+  return axes_limit(_amax, cosines, _A);
 }
 
 // MQTT-related methods
@@ -89,14 +154,18 @@ int Machine::connect() {
 }
 
 void Machine::listen_start() {
-  if (subscribe(NULL, _sub_topic.c_str()) != MOSQ_ERR_SUCCESS) {
-    throw CNCError("Cannot subscribe to topic " + _sub_topic, this);
+  for (auto &topic : {_sub_topic, _override_topic}) {
+    if (subscribe(NULL, topic.c_str()) != MOSQ_ERR_SUCCESS) {
+      throw CNCError("Cannot subscribe to topic " + topic, this);
+    }
   }
 }
 
 void Machine::listen_stop() {
-  if (unsubscribe(NULL, _sub_topic.c_str()) != MOSQ_ERR_SUCCESS) {
-    throw CNCError("Cannot unsubscribe from topic " + _sub_topic, this);
+  for (auto &topic : {_sub_topic, _override_topic}) {
+    if (unsubscribe(NULL, topic.c_str()) != MOSQ_ERR_SUCCESS) {
+      throw CNCError("Cannot unsubscribe from topic " + topic, this);
+    }
   }
 }
 
@@ -131,6 +200,7 @@ void Machine::on_unsubscribe(int mid)  {
 }
 
 void Machine::on_message(const struct mosquitto_message *message)  {
+  uint64_t arrival = Correlator::now();
   string payload((char *)message->payload, message->payloadlen);
   json j;
   try {
@@ -141,22 +211,70 @@ void Machine::on_message(const struct mosquitto_message *message)  {
          << style::reset << fg::reset << endl;
     return;
   }
-  _position = Point(j.value("x", 0)*1000, j.value("y", 0) * 1000, j.value("z", 0) * 1000);
-  _error = j.value("error", 0) * 1000;
+  if (_override_topic == message->topic) {
+    if (j.contains("feed") && j["feed"].is_number())
+      feed_override(j["feed"].get<data_t>());
+    if (j.contains("hold") && j["hold"].is_boolean())
+      feed_hold(j["hold"].get<bool>());
+    return;
+  }
+  // m to mm; the defaults are double, or the values would be read as int
+  _position = Point(j.value("x", 0.0) * 1000, j.value("y", 0.0) * 1000,
+                    j.value("z", 0.0) * 1000);
+  _error = j.value("error", 0.0) * 1000;
+  if (j.contains("seq") && j["seq"].is_number_unsigned())
+    _correlator.received(j["seq"].get<uint64_t>(), j.value("t", uint64_t(0)),
+                         arrival);
+  if (_recorder) {
+    _recorder->status(_position.vec(), _error);
+    if (fabs(_error) > _max_error) _recorder->trigger();
+  }
+}
+
+// the count is updated last: an executor seeing it changed also sees the
+// new value
+void Machine::feed_override(data_t percent) {
+  _feed_override = min<data_t>(max<data_t>(percent, 0), 200);
+  _command_time = chrono::steady_clock::now().time_since_epoch().count();
+  _command_count++;
+}
+
+void Machine::feed_hold(bool hold) {
+  _feed_hold = hold;
+  _command_time = chrono::steady_clock::now().time_since_epoch().count();
+  _command_count++;
+}
+
+string Machine::payload(bool rapid) const {
+  if (!_setpoint.is_complete())
+    throw CNCError("Incomplete setpoint " + _setpoint.desc(false), this);
+  Point pos = (_setpoint + _offset);
+  json j;
+  j["x"] = pos.x();
+  j["y"] = pos.y();
+  j["z"] = pos.z();
+  j["rapid"] = rapid;
+  if (_stamp) {
+    j["seq"] = _seq;
+    j["t"] = _sent_time;
+  }
+  return j.dump();
 }
 
 void Machine::sync(bool rapid) {
-    Point pos = (_setpoint + _offset);
-    json j;
-    j["x"] = pos.x();
-    j["y"] = pos.y();
-    j["z"] = pos.z();
-    j["rapid"] = rapid;
-    string payload = j.dump();
+    if (!_setpoint.is_complete()) // before the sequence number is spent
+      throw CNCError("Incomplete setpoint " + _setpoint.desc(false), this);
+    if (_stamp) {
+      _seq++;
+      _sent_time = Correlator::now();
+      _correlator.sent(_seq, _sent_time); // before an answer can arrive
+    }
+    string payload = this->payload(rapid);
     int rc = publish(NULL, _pub_topic.c_str(), payload.length(), payload.c_str(), 0, false);
     if (rc != MOSQ_ERR_SUCCESS) {
       throw CNCError("Cannot publish to topic " + _pub_topic, this);
     }
+    if (_recorder) _recorder->setpoint((_setpoint + _offset).vec(), rapid);
     loop();
 }
 
@@ -194,6 +312,15 @@ int main(int argc, const char *argv[]) {
   cout << "Default machine after loading:" << endl;
   cout << default_machine.desc() << endl;
 
+  try { // no setpoint yet: nothing must be sent
+    default_machine.payload(false);
+    cerr << "Incomplete setpoint accepted" << endl;
+    return 1;
+  } catch (cncpp::CNCError &e) {
+    cout << "Rejected: " << e.what() << endl;
+  }
+  default_machine.setpoint(1, 2, 3);
+  cout << default_machine.payload(false) << endl;
 
   return 0;
 
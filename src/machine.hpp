@@ -12,6 +12,12 @@
 
 #include "defines.hpp"
 #include "point.hpp"
+#include "correlator.hpp"
+#include "recorder.hpp"
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <map>
 #include <mosquittopp.h>
 #include <nlohmann/json.hpp>
 
@@ -23,6 +29,12 @@ namespace cncpp {
 
 class Machine final : Object, mosquittopp {
 public:
+  // Entry of the tool table, by T number
+  struct Tool {
+    data_t radius = 0; // mm
+    bool ball = false; // ball end (or flat end) mill
+  };
+
   // Lifecycle -----------------------------------------------------------------
   Machine(const string &settings_file);
   Machine() {}
@@ -30,8 +42,14 @@ public:
 
   // Methods -------------------------------------------------------------------
   void load(const string &settings_file);
+  // Loads the settings file again if it changed since the last load, e.g. to
+  // tune the machine while a program is loaded; true if reloaded
+  bool reload();
   string desc(bool colored = true) const override;
-  data_t quantize(data_t t, data_t &dq) const;
+  // Max feedrate (mm/min) and acceleration (mm/s/s) along a direction, given
+  // by its direction cosines: the most limiting axis wins
+  data_t feed_limit(const Vec3 &cosines) const;
+  data_t acc_limit(const Vec3 &cosines) const;
 
   // Accessors -----------------------------------------------------------------
   data_t A() const { return _A; }
@@ -39,6 +57,17 @@ public:
   data_t fmax() const { return _fmax; }
   data_t error() const { return _error; }
   data_t max_error() const { return _max_error; }
+  // per-axis limits, axis is 0 (X), 1 (Y) or 2 (Z)
+  data_t vmax(size_t axis) const { return _vmax[axis]; }
+  data_t amax(size_t axis) const { return _amax[axis]; }
+  // axis travel (mm), from 0 in machine coordinates, i.e. on positions
+  // shifted by offset(); infinite if not configured
+  data_t travel(size_t axis) const { return _travel[axis]; }
+  // rapids: each axis moves at its own limits (non-linear path)
+  bool dogleg() const { return _dogleg; }
+  // Throws a CNCError if tool n is not in the table
+  const Tool &tool(size_t n) const;
+  const map<size_t, Tool> &tools() const { return _tools; }
 
   Point zero() const { return _zero; }
   Point offset() const { return _offset; }
@@ -53,6 +82,34 @@ public:
     return _setpoint;
   }
 
+  // Operator commands, from any thread, applied by an Executor at its next
+  // sample; also received on the MQTT override topic as {"feed": 120} or
+  // {"hold": true}.
+  // Feed override (%), from 0 to 200
+  void feed_override(data_t percent);
+  data_t feed_override() const { return _feed_override; }
+  // Feed hold: controlled stop along the path, until released
+  void feed_hold(bool hold);
+  bool feed_hold() const { return _feed_hold; }
+  // commands received so far, and time of the last one (to measure latency)
+  uint64_t command_count() const { return _command_count; }
+  chrono::steady_clock::time_point command_time() const {
+    return chrono::steady_clock::time_point(
+        chrono::steady_clock::duration(_command_time.load()));
+  }
+
+  // Telemetry: setpoints sent and statuses received are also written to
+  // recorder (not owned), if any; a status with a following error above
+  // max_error triggers it
+  void recorder(Recorder *r) { _recorder = r; }
+  Recorder *recorder() const { return _recorder; }
+  // Loop latency: setpoints carry a sequence number and their send time,
+  // and statuses echoing it are matched by the correlator
+  void stamp(bool on) { _stamp = on; }
+  bool stamp() const { return _stamp; }
+  Correlator &correlator() { return _correlator; }
+  const Correlator &correlator() const { return _correlator; }
+
   // MQTT-related methods
   int connect();
   bool connected() { return _connected; }
@@ -64,13 +121,20 @@ public:
   void on_unsubscribe(int mid) override;
   void on_message(const struct mosquitto_message *message) override;
   void sync(bool rapid);
+  string payload(bool rapid) const; // JSON setpoint message sent by sync();
+                                    // both throw if the setpoint is incomplete
 
+  // topics, as set in the settings file
+  const string &pub_topic() const { return _pub_topic; }
+  const string &sub_topic() const { return _sub_topic; }
+  const string &override_topic() const { return _override_topic; }
   // returns something like "mqtt://localhost:1883"
   string mqtt_host() const { return "mqtt://" + _mqtt_host + ":" + to_string(_mqtt_port); }
 
 private:
   // parameters
   string _settings_file = "";
+  filesystem::file_time_type _settings_time;
   Point _zero = Point(0, 0, 0);
   Point _offset = Point(0, 0, 0);
   Point _setpoint, _position;
@@ -78,9 +142,22 @@ private:
   data_t _tq = 0.005; // sampling time (s)
   data_t _fmax = 10000;
   data_t _max_error = 0.005;
+  data_t _vmax[3] = {10000, 10000, 10000}; // per-axis feedrate (mm/min)
+  data_t _amax[3] = {5.0, 5.0, 5.0};       // per-axis acceleration (mm/s/s)
+  data_t _travel[3] = {INFINITY, INFINITY, INFINITY}; // per-axis travel (mm)
+  bool _dogleg = false;
+  map<size_t, Tool> _tools;
 
   // State variables
   data_t _error = 0.0;
+  atomic<data_t> _feed_override{100};
+  atomic<bool> _feed_hold{false};
+  atomic<uint64_t> _command_count{0};
+  atomic<chrono::steady_clock::rep> _command_time{0};
+  Recorder *_recorder = nullptr;
+  bool _stamp = false;
+  uint64_t _seq = 0, _sent_time = 0; // of the last stamped setpoint
+  Correlator _correlator;
 
   // MQTT-related params
   string _mqtt_host = "localhost";
@@ -88,6 +165,7 @@ private:
   int _mqtt_keepalive = 60;
   string _pub_topic; // publish set-points
   string _sub_topic; // get current postions
+  string _override_topic; // get feed override and hold commands
   char _msg_buffer[MQTT_BUFLEN];
   bool _connected = false;
 
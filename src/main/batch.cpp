@@ -0,0 +1,269 @@
+/*
+  ____        _       _                         _           _
+ | __ )  __ _| |_ ___| |__     __ _ _ __   __ _| |_   _ ___(_)___
+ |  _ \ / _` | __/ __| '_ \   / _` | '_ \ / _` | | | | / __| / __|
+ | |_) | (_| | || (__| | | | | (_| | | | | (_| | | |_| \__ \ \__ \
+ |____/ \__,_|\__\___|_| |_|  \__,_|_| |_|\__,_|_|\__, |___/_|___/
+                                                  |___/
+Cycle time, travel, bounding box and validation status of many part programs
+at once, e.g. after a machine change. Files are analyzed concurrently on a
+work-stealing Pool, and the results are written as a single CSV table:
+
+  cncpp_batch [-j threads] [-l list.txt] machine.yml programs/ part.gcode
+
+Each file is streamed through its own Program: blocks are accounted for and
+dropped as soon as they are parsed, so that a worker only keeps the source
+text and the subprograms of the file it is working on.
+*/
+
+#include "../cncpp.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <rang.hpp>
+#include <fmt/core.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace cncpp;
+using namespace rang;
+using namespace fmt;
+namespace fs = std::filesystem;
+
+using bt = Block::BlockType;
+
+static const vector<string> extensions = {".gcode", ".nc", ".ngc", ".tap"};
+
+// Results for a program, or for a subprogram relative to its local origin
+struct Stats {
+  string status = "ok";
+  size_t lines = 0, blocks = 0;  // source lines, executed blocks
+  double time = 0;               // cycle time (s)
+  double feed = 0, rapid = 0;    // travel (mm)
+  Vec3 lo = Vec3(1, 1, 1) * numeric_limits<data_t>::infinity();
+  Vec3 hi = Vec3(1, 1, 1) * -numeric_limits<data_t>::infinity();
+  Vec3 displacement;             // subprograms only
+  double seconds = 0;            // analysis time
+
+  bool empty() const { return lo.x() > hi.x(); }
+  void add(const Vec3 &p) {
+    for (int i = 0; i < 3; i++) {
+      lo.c[i] = min(lo.c[i], p.c[i]);
+      hi.c[i] = max(hi.c[i], p.c[i]);
+    }
+  }
+};
+
+using Bodies = map<const Program::Body *, Stats>;
+
+static const Stats &subprogram(const Program &p, const Block &call,
+                               Bodies &subs);
+
+// Adds block b; a subprogram call adds each repetition of the subprogram
+static void account(Stats &s, const Block &b, const Program &p,
+                    Bodies &subs) {
+  s.blocks++;
+  if (b.m() == 98 && b.l() > 0) {
+    const Stats &sub = subprogram(p, b, subs);
+    s.blocks += sub.blocks * b.l();
+    s.time += sub.time * b.l();
+    s.feed += sub.feed * b.l();
+    s.rapid += sub.rapid * b.l();
+    if (!sub.empty()) {
+      // repetitions are shifted along a line: the first and the last bound
+      // all the others
+      Vec3 first = b.geometry().start;
+      Vec3 last = first + sub.displacement * data_t(b.l() - 1);
+      for (const Vec3 &o : {first, last}) {
+        s.add(sub.lo + o);
+        s.add(sub.hi + o);
+      }
+    }
+    return;
+  }
+  s.time += b.profile().dt;
+  switch (b.type()) {
+  case bt::RAPID: s.rapid += b.length(); break;
+  case bt::LINE: s.feed += b.length(); break;
+  case bt::CWA:
+  case bt::CCWA: s.feed += b.length(); break;
+  default: return;
+  }
+  Vec3 lo, hi;
+  b.geometry().bounds(lo, hi);
+  s.add(lo);
+  s.add(hi);
+}
+
+static const Stats &subprogram(const Program &p, const Block &call,
+                               Bodies &subs) {
+  const Program::Body &body = p.body(call);
+  auto found = subs.find(&body);
+  if (found != subs.end()) return found->second;
+  Stats s;
+  s.displacement = body.displacement;
+  // the first block is the head at the local origin
+  for (auto it = next(body.blocks.begin()); it != body.blocks.end(); it++)
+    account(s, *it, p, subs);
+  return subs[&body] = s;
+}
+
+static Stats analyze(const string &file, Machine &machine) {
+  auto start = chrono::steady_clock::now();
+  Stats s;
+  try {
+    ifstream in(file);
+    if (!in.is_open()) throw runtime_error("Could not open file");
+    Program program(&machine);
+    Bodies subs;
+    string line;
+    // subprograms may be defined after they are called: their lines are fed
+    // in a first pass, as in Program::load
+    vector<bool> main;
+    bool defining = false;
+    while (getline(in, line)) {
+      optional<size_t> begin;
+      bool end = false;
+      Program::delimiters(line, begin, end);
+      if (begin) defining = true;
+      main.push_back(!defining);
+      if (defining) program << line;
+      if (end) defining = false;
+    }
+    if (defining) throw runtime_error("Missing M99 at the end of subprogram");
+    s.lines = main.size();
+    in.clear();
+    in.seekg(0);
+    for (size_t i = 0; getline(in, line); i++) {
+      if (!main[i]) continue;
+      program << line;
+      account(s, program.back(), program, subs);
+      // the last block is the only one needed to parse the next one
+      while (program.size() > 1)
+        program.pop_front();
+    }
+  } catch (exception &e) {
+    s.status = e.what();
+    replace(s.status.begin(), s.status.end(), '\n', ' ');
+    replace(s.status.begin(), s.status.end(), '"', '\'');
+  }
+  s.seconds = chrono::duration<double>(chrono::steady_clock::now() - start)
+                  .count();
+  return s;
+}
+
+static void collect(const fs::path &path, vector<string> &files) {
+  if (!fs::is_directory(path)) {
+    files.push_back(path.string());
+    return;
+  }
+  vector<string> found;
+  for (auto &entry : fs::recursive_directory_iterator(path)) {
+    if (!entry.is_regular_file()) continue;
+    string ext = entry.path().extension().string();
+    transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    if (find(extensions.begin(), extensions.end(), ext) != extensions.end())
+      found.push_back(entry.path().string());
+  }
+  sort(found.begin(), found.end());
+  files.insert(files.end(), found.begin(), found.end());
+}
+
+
+/*
+  __  __       _
+ |  \/  | __ _(_)_ __
+ | |\/| |/ _` | | '_ \
+ | |  | | (_| | | | | |
+ |_|  |_|\__,_|_|_| |_|
+
+*/
+
+static void usage(const char *name) {
+  cerr << style::bold << "Usage: " << name
+       << " [-j threads] [-l list.txt] [-o results.csv] <machine.yml>"
+       << " [program.gcode|directory]..." << style::reset << endl;
+}
+
+int main(int argc, char *const argv[]) {
+  unsigned threads = 0;
+  string list_file, out_file;
+  int opt;
+  while ((opt = getopt(argc, argv, "j:l:o:h")) != -1) {
+    switch (opt) {
+    case 'j': threads = stoul(optarg); break;
+    case 'l': list_file = optarg; break;
+    case 'o': out_file = optarg; break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (optind >= argc) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  Machine machine;
+  vector<string> files;
+  try {
+    machine.load(argv[optind]);
+    for (int i = optind + 1; i < argc; i++)
+      collect(argv[i], files);
+    if (!list_file.empty()) {
+      ifstream list(list_file);
+      if (!list.is_open()) throw runtime_error("Could not open " + list_file);
+      for (string line; getline(list, line);) {
+        if (!line.empty()) collect(line, files);
+      }
+    }
+  } catch (exception &e) {
+    cerr << fg::red << style::bold << "Error: " << e.what()
+         << style::reset << fg::reset << endl;
+    return 2;
+  }
+
+  // each task writes its own slot, the table is written in input order
+  vector<Stats> results(files.size());
+  auto start = chrono::steady_clock::now();
+  Pool pool(threads);
+  for (size_t i = 0; i < files.size(); i++) {
+    pool.submit([&, i]() { results[i] = analyze(files[i], machine); });
+  }
+  pool.wait();
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+  ofstream out_stream;
+  if (!out_file.empty()) out_stream.open(out_file);
+  ostream &out = out_file.empty() ? cout : out_stream;
+  out << "file,status,lines,blocks,time,feed_length,rapid_length,"
+         "x_min,y_min,z_min,x_max,y_max,z_max,seconds"
+      << endl;
+  size_t failed = 0;
+  double total = 0;
+  for (size_t i = 0; i < files.size(); i++) {
+    Stats &s = results[i];
+    if (s.status != "ok") failed++;
+    total += s.time;
+    if (s.empty()) s.lo = s.hi = Vec3();
+    out << format("\"{}\",\"{}\",{},{},{:.3f},{:.3f},{:.3f},{:.3f},{:.3f},"
+                  "{:.3f},{:.3f},{:.3f},{:.3f},{:.3f}",
+                  files[i], s.status, s.lines, s.blocks, s.time, s.feed,
+                  s.rapid, s.lo.x(), s.lo.y(), s.lo.z(), s.hi.x(), s.hi.y(),
+                  s.hi.z(), s.seconds)
+        << endl;
+  }
+
+  cerr << style::bold
+       << format("{} programs ({} with errors), total cycle time {:.1f} s, "
+                 "analyzed in {:.3f} s",
+                 files.size(), failed, total, elapsed.count())
+       << style::reset << endl
+       << pool.desc() << endl;
+  return failed ? 3 : 0;
+}
@@ -0,0 +1,258 @@
+/*
+  ____                  _                          _
+ | __ )  ___ _ __   ___| |__  _ __ ___   __ _ _ __| | _____
+ |  _ \ / _ \ '_ \ / __| '_ \| '_ ` _ \ / _` | '__| |/ / __|
+ | |_) |  __/ | | | (__| | | | | | | | | (_| | |  |   <\__ \
+ |____/ \___|_| |_|\___|_| |_|_| |_| |_|\__,_|_|  |_|\_\___/
+
+Micro-benchmarks of the library hot paths on synthetic programs. Results are
+written as JSON, and can be compared against a previously stored baseline:
+
+  cncpp_bench -n 100000 -o baseline.json
+  cncpp_bench -n 100000 -b baseline.json
+*/
+
+#include "../cncpp.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <rang.hpp>
+#include <fmt/core.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace std::chrono;
+using namespace cncpp;
+using namespace rang;
+using namespace fmt;
+
+using bt = Block::BlockType;
+
+// Each benchmark returns the number of operations it performed
+using bench_f = function<size_t()>;
+
+struct Result {
+  string name;
+  size_t ops = 0;              // operations per repetition
+  vector<double> ns_per_op{};  // one value per repetition
+  double median() const {
+    vector<double> v(ns_per_op);
+    sort(v.begin(), v.end());
+    return v[v.size() / 2];
+  }
+  double min() const { return *min_element(ns_per_op.begin(), ns_per_op.end()); }
+};
+
+// Prevents the compiler from optimizing away the benchmarked code
+static volatile data_t sink = 0;
+
+static Result run(const string &name, size_t reps, bench_f f) {
+  Result r{name};
+  for (size_t i = 0; i < reps; i++) {
+    auto start = steady_clock::now();
+    r.ops = f();
+    auto stop = steady_clock::now();
+    r.ns_per_op.push_back(duration<double, nano>(stop - start).count() / r.ops);
+  }
+  cerr << format("{:<20} {:>10} ops {:>12.2f} ns/op (min {:.2f})", name, r.ops,
+                 r.median(), r.min())
+       << endl;
+  return r;
+}
+
+
+/*
+  __  __       _
+ |  \/  | __ _(_)_ __
+ | |\/| |/ _` | | '_ \
+ | |  | | (_| | | | | |
+ |_|  |_|\__,_|_|_| |_|
+
+*/
+
+static void usage(const char *name) {
+  cerr << style::bold << "Usage: " << name
+       << " [-n blocks] [-k lines|arcs|mixed] [-s seed] [-r reps]"
+       << " [-m machine.yml] [-o results.json] [-b baseline.json]"
+       << " [-t tolerance]" << style::reset << endl;
+}
+
+int main(int argc, char *const argv[]) {
+  size_t n = 100000, reps = 5;
+  unsigned seed = 0;
+  double tolerance = 0.1;
+  Generator::Kind kind = Generator::Kind::MIXED;
+  string machine_file, out_file, baseline_file;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:k:s:r:m:o:b:t:h")) != -1) {
+    switch (opt) {
+    case 'n': n = stoul(optarg); break;
+    case 's': seed = stoul(optarg); break;
+    case 'r': reps = max<size_t>(1, stoul(optarg)); break;
+    case 'm': machine_file = optarg; break;
+    case 'o': out_file = optarg; break;
+    case 'b': baseline_file = optarg; break;
+    case 't': tolerance = stod(optarg); break;
+    case 'k':
+      for (auto &[k, name] : Generator::kinds) {
+        if (name == optarg) kind = k;
+      }
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+#ifdef DEBUG_BUILD
+  cerr << fg::yellow << style::bold
+       << "Warning: this is a debug build, timings are not meaningful"
+       << style::reset << fg::reset << endl;
+#endif
+
+  Machine machine;
+  if (!machine_file.empty()) {
+    try {
+      machine.load(machine_file);
+    } catch (exception &e) {
+      cerr << fg::red << style::bold << "Error: " << e.what()
+           << style::reset << fg::reset << endl;
+      return 2;
+    }
+  }
+
+  Generator gen(kind, seed);
+  vector<string> lines = gen.lines(n);
+  string gcode_file = format("/tmp/cncpp_bench_{}.gcode", getpid());
+  gen.reset();
+  gen.write(gcode_file, n);
+  cerr << style::bold << gen.desc() << style::reset << endl;
+
+  Program program(&machine);
+  program.load(gcode_file);
+  cerr << format("Block size: {} bytes + {:.1f} bytes of source text", 
+                 sizeof(Block), double(program.source().size()) / n)
+       << endl;
+
+  vector<Result> results;
+
+  results.push_back(run("point_arith", reps, [&]() {
+    Point a(1, 2, 3), b(0.1, 0.2, 0.3), c(-1, 0.5, 2);
+    data_t len = 0;
+    for (size_t i = 0; i < n; i++) {
+      a = a + b;
+      len += a.delta(c).length();
+    }
+    sink = len;
+    return n;
+  }));
+
+  results.push_back(run("block_parse", reps, [&]() {
+    Program p(&machine);
+    for (auto &l : lines)
+      p << l;
+    return p.size();
+  }));
+
+  results.push_back(run("program_load", reps, [&]() {
+    Program p(&machine);
+    p.load(gcode_file);
+    return p.size();
+  }));
+
+  results.push_back(run("program_replan", reps, [&]() {
+    program.replan(machine);
+    return program.size();
+  }));
+
+  results.push_back(run("profile_lambda", reps, [&]() {
+    size_t ops = 0;
+    data_t s, acc = 0;
+    for (auto &b : program) {
+      if (b.type() == bt::RAPID || b.type() == bt::NO_MOTION) continue;
+      data_t dt = b.profile().dt;
+      for (size_t k = 0; k < 16; k++, ops++)
+        acc += b.lambda(dt * k / 15.0, s) + s;
+    }
+    sink = acc;
+    return ops;
+  }));
+
+  results.push_back(run("block_interpolate", reps, [&]() {
+    size_t ops = 0;
+    data_t acc = 0;
+    for (auto &b : program) {
+      if (b.type() == bt::RAPID || b.type() == bt::NO_MOTION) continue;
+      b.walk([&](Block &b, data_t t, data_t l, data_t s) {
+        Point p = b.interpolate(l);
+        acc += p.x() + p.y() + p.z();
+        ops++;
+      });
+    }
+    sink = acc;
+    return ops;
+  }));
+
+  results.push_back(run("machine_sync", reps, [&]() {
+    size_t len = 0;
+    for (size_t i = 0; i < n; i++) {
+      machine.setpoint(i * 0.001, i * 0.002, i * 0.003);
+      len += machine.payload(i % 2).length();
+    }
+    sink = len;
+    return n;
+  }));
+
+  remove(gcode_file.c_str());
+
+  // Results as JSON
+  json j;
+  j["version"] = cncpp::version();
+  j["blocks"] = n;
+  j["kind"] = Generator::kinds.at(kind);
+  j["seed"] = seed;
+  j["reps"] = reps;
+  // memory footprint: the block object and its share of the G-code text
+  j["block_bytes"] = sizeof(Block);
+  j["source_bytes_per_block"] = double(program.source().size()) / n;
+  for (auto &r : results) {
+    j["results"][r.name] = {
+      {"ops", r.ops},
+      {"ns_per_op", r.median()},
+      {"ns_per_op_min", r.min()},
+      {"samples", r.ns_per_op}
+    };
+  }
+  if (out_file.empty()) {
+    cout << j.dump(2) << endl;
+  } else {
+    ofstream(out_file) << j.dump(2) << endl;
+  }
+
+  // Comparison against baseline: ratio > 1 means slower than baseline
+  if (baseline_file.empty()) return 0;
+  json base;
+  try {
+    base = json::parse(ifstream(baseline_file));
+  } catch (exception &e) {
+    cerr << fg::red << style::bold << "Error: cannot read baseline: "
+         << e.what() << style::reset << fg::reset << endl;
+    return 2;
+  }
+  bool regression = false;
+  cerr << style::bold << "Comparison with " << baseline_file << style::reset
+       << endl;
+  for (auto &r : results) {
+    if (!base["results"].contains(r.name)) continue;
+    double ratio = r.median() / base["results"][r.name]["ns_per_op"].get<double>();
+    bool slower = ratio > 1.0 + tolerance;
+    regression |= slower;
+    cerr << (slower ? fg::red : fg::green)
+         << format("{:<20} {:>6.2f}x", r.name, ratio) << fg::reset << endl;
+  }
+  return regression ? 4 : 0;
+}
@@ -11,25 +11,32 @@
 #include <iostream>
 #include <rang.hpp>
 #include <fmt/core.h>
+#include <unistd.h>
 
 using namespace std;
 using namespace cncpp;
 using namespace rang;
 using namespace fmt;
 
-using bt = Block::BlockType;
-
-int main(int argc, const char *argv[]) {
-  if (argc < 3) {
+int main(int argc, char *const argv[]) {
+  // -c <dir>: reuse parsed and planned programs cached in dir
+  string cache_dir;
+  int opt;
+  while ((opt = getopt(argc, argv, "c:")) != -1) {
+    if (opt == 'c') cache_dir = optarg;
+  }
+  if (argc - optind < 2) {
     cerr << style::bold << "Usage: " << argv[0] 
-         << " <machine.yml> <program.gcode>" << style::reset << endl;
+         << " [-c cache_dir] <machine.yml> <program.gcode>" << style::reset
+         << endl;
     return 1;
   }
+  const char *machine_file = argv[optind], *program_file = argv[optind + 1];
 
   // Load machine
   Machine machine;
   try {
-    machine.load(argv[1]);
+    machine.load(machine_file);
   } catch (exception &e) {
     cerr << fg::red << style::bold << "Error: " << e.what()
          << style::reset << fg::reset << endl;
@@ -38,39 +45,56 @@ int main(int argc, const char *argv[]) {
   cerr << style::bold << "Machine: " << style::reset << endl
        << machine.desc() << endl;
 
+  auto print = [](const Trajectory::Sample &s) {
+    cout << format("{:},{:},{:.3f},{:.3f},{:.6f},{:.3f},{:.3f},{:.3f},{:.3f}", 
+                   s.block->n(), s.block->type_name(), s.time, s.t, s.lambda,
+                   s.speed, s.position.x(), s.position.y(), s.position.z())
+         << endl;
+  };
+
+  // Without a cache, the program is streamed: the first setpoints are out
+  // while the rest of the file is still being parsed and planned
+  if (cache_dir.empty()) {
+    Pipeline pipeline(&machine);
+    cout << "n,type,t_tot,t,lambda,feedrate,X,Y,Z" << endl;
+    try {
+      pipeline.run(program_file, print);
+    } catch (exception &e) {
+      cerr << fg::red << style::bold << "Error: " << e.what()
+           << style::reset << fg::reset << endl;
+      return 3;
+    }
+    cerr << style::bold << "Parsed program " << program_file << style::reset
+         << endl
+         << pipeline.program().desc() << endl
+         << style::bold << pipeline.desc() << style::reset << endl;
+    cerr << style::bold << "Done." << style::reset << endl;
+    return 0;
+  }
+
   // Load part program
   Program program(&machine);
   try {
-    program.load(argv[2]);
+    if (Cache(cache_dir).load(program, program_file)) {
+      cerr << style::bold << "Loaded from cache" << style::reset << endl;
+    }
   } catch (exception &e) {
     cerr << fg::red << style::bold << "Error: " << e.what()
          << style::reset << fg::reset << endl;
     return 3;
   }
 
-  cerr << style::bold << "Parsing program " << argv[2] << style::reset << endl
+  cerr << style::bold << "Parsing program " << program_file << style::reset
+       << endl
        << program.desc() << endl;
 
 
-  // Go through the whole program, skipping over rapid blocks
-  data_t t_tot = 0;
-  Point pos;
+  // Sample the whole program on a single clock: t_tot = k * tq, and t is the
+  // time from the start of the current block
+  Trajectory trajectory(program, machine);
+  cerr << style::bold << trajectory.desc() << style::reset << endl;
   cout << "n,type,t_tot,t,lambda,feedrate,X,Y,Z" << endl;
-  for (auto &b : program) {
-    if (b.type() == bt::RAPID || b.type() == bt::NO_MOTION) {
-      cerr << fg::yellow << "Skipping block " << b.line() << fg::reset << endl;
-      continue;
-    }
-    b.walk([&](Block &b, data_t t, data_t lambda, data_t feedrate) {
-      pos = b.interpolate(lambda);
-      t_tot += machine.tq();
-
-      cout << format("{:},{:},{:.3f},{:.3f},{:.6f},{:.3f},{:.3f},{:.3f},{:.3f}", 
-                     b.n(), b.type_name(), t_tot, t, lambda, feedrate, 
-                     pos.x(), pos.y(), pos.z())
-           << endl;
-    });
-  }
+  trajectory.walk(print);
 
   cerr << style::bold << "Done." << style::reset << endl;
   return 0;
@@ -0,0 +1,175 @@
+/*
+  __  __       _   _
+ |  \/  | ___ | |_(_) ___  _ __     ___ ___  _ __ ___
+ | |\/| |/ _ \| __| |/ _ \| '_ \   / __/ _ \| '__/ _ \
+ | |  | | (_) | |_| | (_) | | | | | (_| (_) | | |  __/
+ |_|  |_|\___/ \__|_|\___/|_| |_|  \___\___/|_|  \___|
+
+Implementation
+*/
+
+#include "motion.hpp"
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+using namespace cncpp;
+
+template <typename T> void ProfileT<T>::plan(T length, T feedrate, T A) {
+  T dt_1, dt_m, dt_2;
+  T f_m;
+
+  // The total time is not rounded to a multiple of tq: blocks end mid-tick,
+  // and the sampling clock runs across block boundaries (see Trajectory)
+  l = length;
+  fs = fe = 0;
+  f_m = feedrate / T(60);
+  dt_1 = f_m / A;
+  dt_2 = dt_1;
+  dt_m = l / f_m - (dt_1 + dt_2) / T(2);
+
+  if (dt_m > 0) { // long block, trapezoid
+    dt = dt_1 + dt_m + dt_2;
+  } else { // short block, triangle
+    dt_1 = dt_2 = std::sqrt(l / A);
+    dt = dt_1 + dt_2;
+    dt_m = 0;
+    f_m = l / dt_1;
+  }
+  a = f_m / dt_1;
+  d = -(f_m / dt_2);
+  f = f_m;
+  this->dt_1 = dt_1;
+  this->dt_2 = dt_2;
+  this->dt_m = dt_m;
+  current_acc = 0;
+}
+
+template <typename T>
+void ProfileT<T>::plan(T length, T feedrate, T A, T start) {
+  T v_0 = start / T(60), v_c = feedrate / T(60);
+  T d_1, d_2;
+
+  l = length;
+  fs = v_0;
+  fe = 0;
+  dt_1 = dt_m = dt_2 = 0;
+  current_acc = 0;
+  if (!(l > 0)) {
+    a = d = f = dt = 0;
+    return;
+  }
+  d_1 = fabs(v_c * v_c - v_0 * v_0) / (T(2) * A); // from v_0 to v_c
+  d_2 = v_c * v_c / (T(2) * A);                   // from v_c to rest
+  if (d_1 + d_2 <= l) { // v_c is reached
+    f = v_c;
+    dt_1 = fabs(v_c - v_0) / A;
+    dt_2 = v_c / A;
+    dt_m = v_c > 0 ? (l - d_1 - d_2) / v_c : numeric_limits<T>::infinity();
+  } else if (v_c > v_0) { // short: accelerate up to a peak, then stop
+    f = max(v_0, std::sqrt((T(2) * A * l + v_0 * v_0) / T(2)));
+    dt_1 = (f - v_0) / A;
+    dt_2 = f / A;
+  } else { // cannot even stop at A (by rounding only): stop at the end
+    f = v_0;
+    dt_2 = T(2) * l / v_0;
+  }
+  a = dt_1 > 0 ? (f - v_0) / dt_1 : 0;
+  d = dt_2 > 0 ? -(f / dt_2) : 0;
+  dt = dt_1 + dt_m + dt_2;
+}
+
+// Explicit instantiations, available to all library users
+template struct cncpp::ProfileT<float>;
+template struct cncpp::ProfileT<double>;
+template struct cncpp::GeometryT<float>;
+template struct cncpp::GeometryT<double>;
+
+
+
+/*
+     _                                                                   _
+    / \   ___ ___ _   _ _ __ __ _  ___ _   _   _ __ ___ _ __   ___  _ __| |_
+   / _ \ / __/ __| | | | '__/ _` |/ __| | | | | '__/ _ \ '_ \ / _ \| '__| __|
+  / ___ \ (_| (__| |_| | | | (_| | (__| |_| | | | |  __/ |_) | (_) | |  | |_
+ /_/   \_\___\___|\__,_|_|  \__,_|\___|\__, | |_|  \___| .__/ \___/|_|   \__|
+                                       |___/           |_|
+*/
+
+#ifdef MOTION_MAIN
+
+#include "program.hpp"
+#include "generator.hpp"
+#include <fmt/core.h>
+#include <iostream>
+
+using namespace fmt;
+
+// Float vs. double comparison over all the interpolated blocks of a program:
+//  - "cast":    double planning, float evaluation (e.g. visualization)
+//  - "planned": float planning and evaluation (e.g. bulk simulation)
+int main(int argc, const char *argv[]) {
+  if (argc < 2) {
+    cerr << "Usage: " << argv[0] << " <machine.yml> [program.gcode]" << endl;
+    return 1;
+  }
+  Machine machine(argv[1]);
+  Program program(&machine);
+  if (argc > 2) {
+    program.load(argv[2]);
+  } else {
+    Generator gen;
+    for (auto &line : gen.lines(10000))
+      program << line;
+  }
+
+  size_t blocks = 0, samples = 0;
+  double pos_cast = 0, pos_plan = 0, speed_cast = 0, speed_plan = 0;
+  double dt_plan = 0, time_d = 0, time_f = 0;
+  for (auto &b : program) {
+    if (b.type() != Block::BlockType::LINE &&
+        b.type() != Block::BlockType::CWA && b.type() != Block::BlockType::CCWA)
+      continue;
+    ProfileT<double> pd = b.profile().cast<double>();
+    GeometryT<double> gd = b.geometry().cast<double>();
+    ProfileT<float> pc = pd.cast<float>(), pf;
+    GeometryT<float> gf = gd.cast<float>();
+    pf.plan(float(gd.length), float(b.arc_feedrate()),
+            float(b.acceleration()));
+    blocks++;
+    time_d += pd.dt;
+    time_f += pf.dt;
+    dt_plan = max(dt_plan, fabs(double(pf.dt) - pd.dt));
+    for (double t = 0; t < pd.dt; t += machine.tq(), samples++) {
+      double sd;
+      float sc, sf;
+      Vec3T<double> xd = gd.interpolate(pd.lambda(t, sd));
+      Vec3T<float> xc = gf.interpolate(pc.lambda(float(t), sc));
+      Vec3T<float> xf = gf.interpolate(pf.lambda(float(t), sf));
+      pos_cast = max(pos_cast, (xc.cast<double>() - xd).length());
+      pos_plan = max(pos_plan, (xf.cast<double>() - xd).length());
+      speed_cast = max(speed_cast, fabs(sc - sd));
+      speed_plan = max(speed_plan, fabs(sf - sd));
+    }
+  }
+
+  cout << format("Accuracy of float vs. double on {} blocks, {} samples",
+                 blocks, samples)
+       << endl;
+  cout << format("{:<28} {:>12} {:>12}", "", "cast", "planned") << endl;
+  cout << format("{:<28} {:>12.3e} {:>12.3e}", "max position error (mm)",
+                 pos_cast, pos_plan)
+       << endl;
+  cout << format("{:<28} {:>12.3e} {:>12.3e}", "max speed error (mm/min)",
+                 speed_cast, speed_plan)
+       << endl;
+  cout << format("{:<28} {:>12} {:>12.3e}", "max block time error (s)", "-",
+                 dt_plan)
+       << endl;
+  cout << format("{:<28} {:>12} {:>12.3e}", "total time error (s)", "-",
+                 fabs(time_f - time_d))
+       << endl;
+  return 0;
+}
+
+#endif // MOTION_MAIN
@@ -0,0 +1,151 @@
+/*
+  __  __       _   _
+ |  \/  | ___ | |_(_) ___  _ __     ___ ___  _ __ ___
+ | |\/| |/ _ \| __| |/ _ \| '_ \   / __/ _ \| '__/ _ \
+ | |  | | (_) | |_| | (_) | | | | | (_| (_) | | |  __/
+ |_|  |_|\___/ \__|_|\___/|_| |_|  \___\___/|_|  \___|
+
+Numeric core of a block: the trapezoidal speed profile and the path geometry,
+templated on the scalar type. The library provides both the float and the
+double instantiations: Block uses data_t, float can be used for visualization
+and bulk simulation (twice the SIMD width, half the memory). Use cast<U>() to
+change precision, e.g. block.geometry().cast<float>().
+*/
+#ifndef MOTION_HPP
+#define MOTION_HPP
+
+// INCLUDES AND DEFINES --------------------------------------------------------
+#include "defines.hpp"
+#include "point.hpp"
+#include <algorithm>
+#include <cmath>
+
+// NAMESPACES AND CONSTANTS ----------------------------------------------------
+using namespace std;
+
+namespace cncpp {
+
+// Trapezoidal speed profile: lambda(t) is the traveled fraction of the length.
+// It starts from fs (zero unless re-timed mid-block) and ends at zero speed
+template <typename T> struct ProfileT {
+  T a, d;                                     // acceleration and deceleration
+  T f, l;                                     // feedrate and length
+  T fs, fe;                                   // start and end feedrate
+  T dt_1, dt_m, dt_2;                         // partial times
+  T dt;                                       // total time
+  T current_acc;                              // current acceleration on arc
+
+  // lambda function; s is the speed in mm/min
+  T lambda(T t, T &s) {
+    T r;
+    current_acc = 0;
+
+    if (t < 0) {
+      r = 0;
+      s = 0;
+    } else if (t < dt_1) { // Acceleration
+      r = fs * t + a * t * t / T(2);
+      s = fs + a * t;
+      current_acc = a;
+    } else if (t < dt_1 + dt_m) { // Maintenance
+      r = fs * dt_1 / T(2) + f * (dt_1 / T(2) + (t - dt_1));
+      s = f;
+      current_acc = 0;
+    } else if (t < dt_1 + dt_m + dt_2) { // Deceleration
+      T t_2 = dt_1 + dt_m;
+      r = fs * dt_1 / T(2) + f * dt_1 / T(2) + f * (dt_m + t - t_2) +
+          d / T(2) * (t * t + t_2 * t_2) - d * t * t_2;
+      s = f + d * (t - t_2);
+      current_acc = d;
+    } else {
+      r = l;
+      s = 0;
+      current_acc = 0;
+    }
+
+    r /= l;
+    s *= 60;
+    return r;
+  }
+
+  // Plan the profile for a given length (mm), feedrate (mm/min) and max
+  // acceleration (mm/s/s); the total time dt is exact, not quantized
+  void plan(T length, T feedrate, T acc);
+  // Same, from a start feedrate (mm/min) instead of zero, e.g. for the rest
+  // of a block re-timed mid-way: the new feedrate can be above or below the
+  // start one, and with a zero feedrate the profile stops and never ends
+  void plan(T length, T feedrate, T acc, T start);
+
+  // conversion to a different precision: p.cast<float>()
+  template <typename U> ProfileT<U> cast() const {
+    return ProfileT<U>{U(a),    U(d),    U(f),    U(l),  U(fs),
+                       U(fe),   U(dt_1), U(dt_m), U(dt_2), U(dt),
+                       U(current_acc)};
+  }
+};
+
+
+// Path geometry: segment or arc (helix, if Z changes)
+template <typename T> struct GeometryT {
+  Vec3T<T> start;                             // starting point
+  Vec3T<T> delta;                             // projections
+  Vec3T<T> center;                            // center point for arcs
+  T r, theta_0, dtheta;                       // arc radius and angles
+  T length;                                   // length of the block
+  bool arc;                                   // arc or segment?
+
+  // position at the traveled fraction lambda
+  Vec3T<T> interpolate(T lambda) const {
+    // x(t) = x(0) + d_x * lambda(t), and so on: Z is always linear
+    Vec3T<T> p = start + delta * lambda;
+    if (arc) {
+      T angle = theta_0 + dtheta * lambda;
+      p.c[0] = center.c[0] + r * std::cos(angle);
+      p.c[1] = center.c[1] + r * std::sin(angle);
+    }
+    return p;
+  }
+
+  // Axis-aligned bounding box of the path: the end points, and for arcs the
+  // points where they cross the X and Y axes through their center
+  void bounds(Vec3T<T> &lo, Vec3T<T> &hi) const {
+    Vec3T<T> end = start + delta;
+    for (size_t i = 0; i < 3; i++) {
+      lo.c[i] = std::min(start.c[i], end.c[i]);
+      hi.c[i] = std::max(start.c[i], end.c[i]);
+    }
+    if (!arc) return;
+    T a0 = std::min(theta_0, theta_0 + dtheta);
+    T a1 = std::max(theta_0, theta_0 + dtheta);
+    for (T k = std::ceil(a0 / T(M_PI_2)); k * T(M_PI_2) <= a1; k++) {
+      T x = center.c[0] + r * std::cos(k * T(M_PI_2));
+      T y = center.c[1] + r * std::sin(k * T(M_PI_2));
+      lo.c[0] = std::min(lo.c[0], x);
+      hi.c[0] = std::max(hi.c[0], x);
+      lo.c[1] = std::min(lo.c[1], y);
+      hi.c[1] = std::max(hi.c[1], y);
+    }
+  }
+
+  // conversion to a different precision: g.cast<float>()
+  template <typename U> GeometryT<U> cast() const {
+    return GeometryT<U>{start.template cast<U>(),
+                        delta.template cast<U>(),
+                        center.template cast<U>(),
+                        U(r),
+                        U(theta_0),
+                        U(dtheta),
+                        U(length),
+                        arc};
+  }
+};
+
+// Both precisions are compiled in the library (see motion.cpp)
+extern template struct ProfileT<float>;
+extern template struct ProfileT<double>;
+extern template struct GeometryT<float>;
+extern template struct GeometryT<double>;
+
+} // namespace cncpp
+
+#endif // MOTION_HPP
@@ -0,0 +1,255 @@
+/*
+   ___           _               _             _                    _
+  / _ \ _ __ ___| |__   ___  ___| |_ _ __ __ _| |_ ___  _ __    ___| | __ _ ___ ___
+ | | | | '__/ __| '_ \ / _ \/ __| __| '__/ _` | __/ _ \| '__|  / __| |/ _` / __/ __|
+ | |_| | | | (__| | | |  __/\__ \ |_| | | (_| | || (_) | |    | (__| | (_| \__ \__ \
+  \___/|_|  \___|_| |_|\___||___/\__|_|  \__,_|\__\___/|_|     \___|_|\__,_|___/___/
+
+
+
+Class implementation
+*/
+
+#include "orchestrator.hpp"
+#include "cache.hpp"
+#include <fmt/core.h>
+#include <chrono>
+#include <ctime>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+using namespace cncpp;
+using namespace fmt;
+
+// CPU time of the calling thread (s)
+static double thread_cpu() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+Orchestrator::Orchestrator(const string &program_file) : _file(program_file) {
+  ifstream file(program_file, ios::binary);
+  if (!file.is_open())
+    throw CNCError("Could not open file " + program_file, this);
+  ostringstream ss;
+  ss << file.rdbuf();
+  _text = ss.str();
+}
+
+string Orchestrator::desc(bool colored) const {
+  return format("Orchestrator: {} machines, {} programs from {}",
+                _units.size(), _programs.size(), _file);
+}
+
+Machine &Orchestrator::add(const string &settings_file) {
+  Unit u{make_unique<Machine>(settings_file)};
+  uint64_t key = Cache::key(_text, *u.machine);
+  auto it = _plans.find(key);
+  if (it != _plans.end()) {
+    u.program = it->second;
+  } else {
+    _programs.push_back(make_unique<Program>(u.machine.get()));
+    u.program = _programs.back().get();
+    u.program->load(_file);
+    _plans[key] = u.program;
+  }
+  _units.push_back(move(u));
+  return *_units.back().machine;
+}
+
+void Orchestrator::run(sink_f f, bool realtime) {
+  struct Stopped {};
+  vector<thread> threads;
+  exception_ptr error;
+  mutex error_mutex;
+  _stop = false;
+  auto start = chrono::steady_clock::now();
+  for (size_t i = 0; i < _units.size(); i++) {
+    threads.emplace_back([this, i, &f, realtime, &error, &error_mutex]() {
+      Unit &u = _units[i];
+      Machine &m = *u.machine;
+      double cpu = thread_cpu();
+      u.ticks = 0;
+      try {
+        Executor ex(*u.program, m);
+        ex.run([&](const Executor::Sample &s) {
+          if (_stop) throw Stopped();
+          m.setpoint(s.position.x(), s.position.y(), s.position.z());
+          if (m.connected()) m.sync(s.block->type() == Block::BlockType::RAPID);
+          if (f) f(i, s);
+        }, realtime);
+        u.ticks = ex.tick();
+      } catch (Stopped &) {
+      } catch (...) {
+        lock_guard<mutex> lock(error_mutex);
+        if (!error) error = current_exception();
+        _stop = true;
+      }
+      u.cpu = thread_cpu() - cpu;
+    });
+  }
+  for (auto &t : threads)
+    t.join();
+  _elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  if (error) rethrow_exception(error);
+}
+
+
+
+
+/*
+  _____         _                     _
+ |_   _|__  ___| |_   _ __ ___   __ _(_)_ __
+   | |/ _ \/ __| __| | '_ ` _ \ / _` | | '_ \
+   | |  __/\__ \ |_  | | | | | | (_| | | | | |
+   |_|\___||___/\__| |_| |_| |_|\__,_|_|_| |_|
+
+*/
+
+#ifdef ORCHESTRATOR_MAIN
+
+#include "generator.hpp"
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <unistd.h>
+#include <yaml-cpp/yaml.h>
+
+// Resident set size (bytes)
+static size_t rss() {
+  size_t pages = 0, resident = 0;
+  ifstream("/proc/self/statm") >> pages >> resident;
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+// Copy of a settings file, changed by f
+static string variant(const string &settings, const string &name,
+                      function<void(YAML::Node)> f) {
+  YAML::Node data = YAML::LoadFile(settings);
+  f(data["machine"]);
+  string path = format("/tmp/cncpp_orchestrator_{}_{}.yml", getpid(), name);
+  ofstream(path) << data << endl;
+  return path;
+}
+
+static bool same(const Executor::Sample &a, const Executor::Sample &b) {
+  return a.block == b.block && a.t == b.t && a.lambda == b.lambda &&
+         a.speed == b.speed && a.position.x() == b.position.x() &&
+         a.position.y() == b.position.y() && a.position.z() == b.position.z();
+}
+
+// CPU and memory scaling with the number of machines, shared plans, samples
+// of each machine vs. a single executor, and offsets
+int main(int argc, const char *argv[]) {
+  if (argc < 2) {
+    cerr << "Usage: " << argv[0] << " <machine.yml> [program.gcode]" << endl;
+    return 1;
+  }
+  string settings = argv[1], file;
+  if (argc > 2) {
+    file = argv[2];
+  } else {
+    file = format("/tmp/cncpp_orchestrator_{}.gcode", getpid());
+    Generator().write(file, 2000);
+  }
+  string shifted = variant(settings, "shifted", [](YAML::Node m) {
+    m["offset"][0] = m["offset"][0].as<double>() + 10;
+    m["mqtt"]["topics"]["pub"] = "cnc/shifted/setpoint";
+    m["mqtt"]["topics"]["sub"] = "cnc/shifted/status/#";
+    m["mqtt"]["topics"]["override"] = "cnc/shifted/override";
+  });
+  string slower = variant(settings, "slower", [](YAML::Node m) {
+    m["A"] = m["A"].as<double>() / 2;
+  });
+  size_t errors = 0;
+
+  // scaling: memory and CPU time per machine, all sharing one program. The
+  // orchestrators are kept, so that freed memory is not reused
+  cout << format("{:>8} {:>14} {:>16} {:>16} {:>10}", "machines",
+                 "program (KiB)", "machine (KiB)", "CPU/machine (s)",
+                 "wall (s)")
+       << endl;
+  vector<unique_ptr<Orchestrator>> kept;
+  for (size_t n : {1, 2, 4, 8}) {
+    size_t before = rss();
+    kept.push_back(make_unique<Orchestrator>(file));
+    Orchestrator &orch = *kept.back();
+    orch.add(settings);
+    size_t one = rss();
+    for (size_t i = 1; i < n; i++)
+      orch.add(settings);
+    size_t all = rss();
+    orch.run();
+    double cpu = 0;
+    for (size_t i = 0; i < n; i++)
+      cpu += orch.cpu(i);
+    cout << format("{:>8} {:>14.1f} {:>16.1f} {:>16.3f} {:>10.3f}", n,
+                   (one - before) / 1024.0,
+                   n > 1 ? (all - one) / 1024.0 / (n - 1) : 0.0, cpu / n,
+                   orch.elapsed())
+         << endl;
+    errors += orch.programs() != 1;
+  }
+
+  // same limits share the program, and each machine gets the samples of a
+  // single executor
+  {
+    Orchestrator orch(file);
+    orch.add(settings);
+    orch.add(shifted);
+    orch.add(slower);
+    cout << orch.desc() << endl;
+    if (orch.programs() != 2 || &orch.program(0) != &orch.program(1) ||
+        &orch.program(0) == &orch.program(2)) {
+      cout << "Wrong program sharing" << endl;
+      errors++;
+    }
+    vector<vector<Executor::Sample>> samples(orch.size());
+    orch.run([&](size_t i, const Executor::Sample &s) {
+      samples[i].push_back(s); // one vector per thread
+    });
+    for (size_t i = 0; i < orch.size(); i++) {
+      Executor ex(orch.program(i), orch.machine(i));
+      Executor::Sample s;
+      size_t diff = 0, n = 0;
+      while (ex.step(s))
+        diff += n >= samples[i].size() || !same(s, samples[i][n++]);
+      diff += n != samples[i].size();
+      cout << format("machine {}: {} samples, {} different from an executor",
+                     i, samples[i].size(), diff)
+           << endl;
+      errors += diff;
+    }
+    // the offset shifts the setpoints sent only
+    json p0 = json::parse(orch.machine(0).payload(false));
+    json p1 = json::parse(orch.machine(1).payload(false));
+    double shift = p1["x"].get<double>() - p0["x"].get<double>();
+    cout << format("offset of machine 1: {} mm", shift) << endl;
+    errors += fabs(shift - 10) > 1e-6;
+    // each machine on the topics of its own settings file
+    Machine &m0 = orch.machine(0), &m1 = orch.machine(1);
+    cout << format("topics: {}, {}, {} vs. {}, {}, {}", m0.pub_topic(),
+                   m0.sub_topic(), m0.override_topic(), m1.pub_topic(),
+                   m1.sub_topic(), m1.override_topic())
+         << endl;
+    errors += m1.pub_topic() != "cnc/shifted/setpoint" ||
+              m1.sub_topic() != "cnc/shifted/status/#" ||
+              m1.override_topic() != "cnc/shifted/override" ||
+              m0.pub_topic() == m1.pub_topic() ||
+              m0.sub_topic() == m1.sub_topic() ||
+              m0.override_topic() == m1.override_topic();
+  }
+
+  remove(shifted.c_str());
+  remove(slower.c_str());
+  if (argc <= 2) remove(file.c_str());
+  cout << (errors == 0 ? "OK" : "FAILED") << endl;
+  return errors == 0 ? 0 : 1;
+}
+
+#endif // ORCHESTRATOR_MAIN
@@ -0,0 +1,94 @@
+/*
+   ___           _               _             _                    _
+  / _ \ _ __ ___| |__   ___  ___| |_ _ __ __ _| |_ ___  _ __    ___| | __ _ ___ ___
+ | | | | '__/ __| '_ \ / _ \/ __| __| '__/ _` | __/ _ \| '__|  / __| |/ _` / __/ __|
+ | |_| | | | (__| | | |  __/\__ \ |_| | | (_| | || (_) | |    | (__| | (_| \__ \__ \
+  \___/|_|  \___|_| |_|\___||___/\__|_|  \__,_|\__\___/|_|     \___|_|\__,_|___/___/
+
+
+Drives several machines from a single process. Each machine has its own
+thread, Executor and MQTT client, publishing on the topics of its own
+settings file. Machines that plan the program the same way (same key, see
+Cache::key) share a single parsed and planned copy of it, which their
+executors only read; the offset of each machine is not part of the plan,
+and is applied to its setpoints by Machine::payload():
+
+  Orchestrator orch("program.gcode");
+  orch.add("mill1.yml").connect();
+  orch.add("mill2.yml").connect(); // same limits: shares the program
+  orch.run(nullptr, true);         // in real time
+
+Feed overrides and holds are per machine (see Executor). An additional
+machine sharing a program costs its Machine, Executor and thread only; a
+machine with different limits costs a copy of the program, too.
+*/
+#ifndef ORCHESTRATOR_HPP
+#define ORCHESTRATOR_HPP
+
+// INCLUDES AND DEFINES --------------------------------------------------------
+#include "defines.hpp"
+#include "executor.hpp"
+#include "machine.hpp"
+#include "program.hpp"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// NAMESPACES AND CONSTANTS ----------------------------------------------------
+using namespace std;
+
+namespace cncpp {
+
+class Orchestrator : Object {
+public:
+  // Called with the index of the machine, from the thread of the machine
+  using sink_f = function<void(size_t machine, const Executor::Sample &s)>;
+
+  // LIFECYCLE -----------------------------------------------------------------
+  // Machines are added afterwards: the program is parsed once for each
+  // distinct plan
+  Orchestrator(const string &program_file);
+  string desc(bool colored = true) const override;
+
+  // METHODS -------------------------------------------------------------------
+  // New machine from a settings file, owned by the orchestrator
+  Machine &add(const string &settings_file);
+  // Runs the program on all the machines, each in its own thread, until all
+  // of them are done. Connected machines publish their setpoints. The first
+  // error of any machine stops all of them, and is thrown once they stopped
+  void run(sink_f f = nullptr, bool realtime = false);
+
+  // ACCESSORS -----------------------------------------------------------------
+  size_t size() const { return _units.size(); }
+  Machine &machine(size_t i) { return *_units.at(i).machine; }
+  // shared between machines: not to be changed
+  Program &program(size_t i) { return *_units.at(i).program; }
+  size_t programs() const { return _programs.size(); } // distinct plans
+  // of the last run: samples and CPU time (s) of machine i, wall time (s)
+  size_t ticks(size_t i) const { return _units.at(i).ticks; }
+  double cpu(size_t i) const { return _units.at(i).cpu; }
+  double elapsed() const { return _elapsed; }
+
+private:
+  struct Unit {
+    unique_ptr<Machine> machine;
+    Program *program = nullptr;
+    size_t ticks = 0;
+    double cpu = 0;
+  };
+  string _file, _text;
+  vector<Unit> _units;
+  // destroyed before the machines they were planned with
+  vector<unique_ptr<Program>> _programs;
+  map<uint64_t, Program *> _plans; // by Cache::key
+  atomic<bool> _stop{false};
+  double _elapsed = 0;
+};
+
+} // namespace cncpp
+
+#endif // ORCHESTRATOR_HPP
@@ -0,0 +1,66 @@
+/*
+  ____                 _ _      _    __
+ |  _ \ __ _ _ __ __ _| | | ___| |  / _| ___  _ __
+ | |_) / _` | '__/ _` | | |/ _ \ | | |_ / _ \| '__|
+ |  __/ (_| | | | (_| | | |  __/ | |  _| (_) | |
+ |_|   \__,_|_|  \__,_|_|_|\___|_| |_|  \___/|_|
+
+Minimal data-parallel loop on std::thread, header only: the range [0, n) is
+split in contiguous chunks, one per thread, and f(begin, end) is called on
+each chunk. Exceptions thrown by f are rethrown in the calling thread.
+*/
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+// INCLUDES AND DEFINES --------------------------------------------------------
+#include <algorithm>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// NAMESPACES AND CONSTANTS ----------------------------------------------------
+using namespace std;
+
+namespace cncpp {
+
+// Number of threads to be used when 0 is requested
+inline unsigned default_threads() {
+  return max(1u, thread::hardware_concurrency());
+}
+
+// Calls f(begin, end) on chunks of [0, n), using up to threads threads (the
+// calling one included); with threads == 0, uses all the available cores
+template <typename F>
+void parallel_for(size_t n, F f, unsigned threads = 0) {
+  if (n == 0) return;
+  if (threads == 0) threads = default_threads();
+  size_t chunks = min<size_t>(threads, n);
+  size_t step = (n + chunks - 1) / chunks;
+  if (chunks == 1) {
+    f(size_t(0), n);
+    return;
+  }
+  exception_ptr error;
+  mutex error_mtx;
+  auto run = [&](size_t begin, size_t end) {
+    try {
+      f(begin, end);
+    } catch (...) {
+      lock_guard<mutex> lock(error_mtx);
+      if (!error) error = current_exception();
+    }
+  };
+  vector<thread> pool;
+  pool.reserve(chunks - 1);
+  for (size_t begin = step; begin < n; begin += step)
+    pool.emplace_back(run, begin, min(begin + step, n));
+  run(0, min(step, n));
+  for (auto &t : pool)
+    t.join();
+  if (error) rethrow_exception(error);
+}
+
+} // namespace cncpp
+
+#endif // PARALLEL_HPP
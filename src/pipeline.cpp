@@ -0,0 +1,363 @@
+/*
+  ____  _            _ _                   _
+ |  _ \(_)_ __   ___| (_)_ __   ___    ___| | __ _ ___ ___
+ | |_) | | '_ \ / _ \ | | '_ \ / _ \  / __| |/ _` / __/ __|
+ |  __/| | |_) |  __/ | | | | |  __/ | (__| | (_| \__ \__ \
+ |_|   |_| .__/ \___|_|_|_| |_|\___|  \___|_|\__,_|___/___/
+         |_|
+
+
+Class implementation
+*/
+
+#include "pipeline.hpp"
+#include "queue.hpp"
+#include <fmt/core.h>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+using namespace cncpp;
+using namespace fmt;
+
+string Pipeline::desc(bool colored) const {
+  return format("Pipeline: lookahead {} blocks, queues of {}; {} samples, "
+                "first after {:.3f} ms, done after {:.3f} s",
+                _lookahead, _capacity, _samples, _first * 1000, _elapsed);
+}
+
+Program::Body &Pipeline::body(const Block &call) {
+  // the parser may be adding bodies meanwhile; neither the map nor the deque
+  // move their elements, and a body is not changed once parsed
+  lock_guard<mutex> lock(_mtx);
+  return _program.body(call);
+}
+
+void Pipeline::plan(Block &b) {
+  b.plan(*_machine);
+  if (b.m() != 98) return;
+  // a body is parsed once, by its first call, and planned once as well
+  Program::Body &body = this->body(b);
+  if (!_planned.insert(&body).second) return;
+  for (auto &sb : body.blocks)
+    plan(sb);
+}
+
+void Pipeline::run(const string &filename, sink_f sink) {
+  ifstream file(filename);
+  if (!file.is_open()) {
+    throw runtime_error("Could not open file " + filename);
+  }
+  auto start = steady_clock::now();
+  _program.reset();
+  _program._filename = filename;
+  _program._planning = false;
+  _planned.clear();
+  _first = -1;
+  _elapsed = 0;
+  _samples = 0;
+
+  BoundedQueue<Block *> parsed(_capacity), planned(_capacity);
+  exception_ptr error;
+  mutex error_mtx;
+  auto fail = [&](exception_ptr e) {
+    lock_guard<mutex> lock(error_mtx);
+    if (!error) error = e;
+  };
+
+  // Stage 1: parsing, in a single pass, so that the first blocks are planned
+  // while the rest of the file is still being read. Definition lines are
+  // collected as they come; a call to a subprogram that is not defined yet
+  // reads ahead up to its definition (and to those of the subprograms it
+  // calls), keeping the main program lines found meanwhile for later
+  thread parser([&]() {
+    try {
+      string line, ahead;
+      deque<string> pending; // main program lines read ahead
+      set<size_t> resolved;  // subprograms defined with all they call
+      auto define = [&](const string &line) {
+        // only the start of a definition changes what the other stages read
+        if (line.find_first_of("Oo") == string::npos)
+          return _program.define(line);
+        lock_guard<mutex> lock(_mtx);
+        return _program.define(line);
+      };
+      auto defined = [&](size_t number) {
+        auto found = _program._subprograms.find(number);
+        return found != _program._subprograms.end() &&
+               _program._defining != &found->second;
+      };
+      function<void(size_t)> resolve = [&](size_t number) {
+        while (!defined(number) && getline(file, ahead)) {
+          if (!define(ahead)) pending.push_back(ahead);
+        }
+        if (!defined(number)) {
+          if (_program._defining)
+            throw CNCError("Missing M99 at the end of subprogram", this);
+          return; // reported as undefined by the call
+        }
+        if (!resolved.insert(number).second) return;
+        for (auto &l : _program._subprograms.at(number).text) {
+          if (auto sub = Program::called(l)) resolve(*sub);
+        }
+      };
+      for (;;) {
+        if (!pending.empty()) {
+          line = move(pending.front());
+          pending.pop_front();
+        } else if (!getline(file, line)) {
+          break;
+        } else if (define(line)) {
+          continue;
+        }
+        Block &b = _program.append(line);
+        if (b.m() == 98) {
+          resolve(b.p());
+          lock_guard<mutex> lock(_mtx);
+          _program.call(b);
+        }
+        if (!parsed.push(&b)) break;
+      }
+      if (_program._defining)
+        throw CNCError("Missing M99 at the end of subprogram", this);
+    } catch (...) {
+      fail(current_exception());
+    }
+    parsed.close();
+  });
+
+  // Stage 2: planning. The profiles only depend on the block itself, so that
+  // they can be computed while the following blocks are being parsed
+  thread planner([&]() {
+    try {
+      Block *b;
+      while (parsed.pop(b)) {
+        plan(*b);
+        if (!planned.push(b)) break;
+      }
+    } catch (...) {
+      fail(current_exception());
+    }
+    parsed.close();
+    planned.close();
+  });
+
+  // Stage 3, in this thread: blocks in execution order, as Program::Cursor
+  // does, with the subprogram repetitions unrolled
+  struct Frame {
+    list<Block>::iterator it, begin, end;
+    Vec3 origin, step, offset;
+    size_t rep, reps;
+  };
+  vector<Frame> stack;
+  auto next = [&](Block *&b, Vec3 &offset) {
+    for (;;) {
+      if (stack.empty()) {
+        if (!planned.pop(b)) return false;
+        offset = Vec3();
+      } else {
+        Frame &f = stack.back();
+        if (f.it == f.end) {
+          if (++f.rep < f.reps) { // next repetition
+            f.it = f.begin;
+            f.offset = f.origin + f.step * data_t(f.rep);
+          } else {
+            stack.pop_back();
+          }
+          continue;
+        }
+        b = &*f.it++;
+        offset = f.offset;
+      }
+      if (b->m() == 98 && b->l() > 0) {
+        Program::Body &sub = body(*b);
+        Vec3 origin = offset + b->geometry().start;
+        auto first = std::next(sub.blocks.begin()); // skip the head block
+        stack.push_back({first, first, sub.blocks.end(), origin,
+                         sub.displacement, origin, 0, b->l()});
+      }
+      return true;
+    }
+  };
+
+  // Same clock as Trajectory::walk, on a window of segments that is refilled
+  // up to the lookahead as the time goes by
+  try {
+    deque<Trajectory::Segment> window;
+    size_t lookahead = max<size_t>(_lookahead, 2);
+    double tq = _machine->tq(), total = 0; // as in Trajectory, in double
+    bool ended = false;
+    auto refill = [&]() {
+      Block *b;
+      Vec3 offset;
+      while (!ended && window.size() < lookahead) {
+        if (!next(b, offset)) {
+          ended = true;
+        } else if (b->profile().dt > 0) {
+          window.push_back({b, offset, total});
+          total += b->profile().dt;
+        }
+      }
+    };
+    refill();
+    for (size_t k = 0;; k++) {
+      double time = k * tq;
+      while (window.size() > 1 && window[1].t0 <= time) {
+        window.pop_front();
+        refill();
+      }
+      if (window.empty() ||
+          (ended && k >= static_cast<size_t>(ceil(total / tq)) + 1))
+        break;
+      Trajectory::Sample s = Trajectory::evaluate(window.front(), k, time);
+      if (_samples++ == 0)
+        _first = duration_cast<duration<double>>(steady_clock::now() - start)
+                     .count();
+      sink(s);
+    }
+  } catch (...) {
+    fail(current_exception());
+    parsed.close();
+    planned.close();
+  }
+  parser.join();
+  planner.join();
+  _program._planning = true;
+  _elapsed =
+      duration_cast<duration<double>>(steady_clock::now() - start).count();
+  if (error) rethrow_exception(error);
+}
+
+
+/*
+  _____         _                     _
+ |_   _|__  ___| |_   _ __ ___   __ _(_)_ __
+   | |/ _ \/ __| __| | '_ ` _ \ / _` | | '_ \
+   | |  __/\__ \ |_  | | | | | | (_| | | | | |
+   |_|\___||___/\__| |_| |_| |_|\__,_|_|_| |_|
+
+*/
+
+#ifdef PIPELINE_MAIN
+
+#include "generator.hpp"
+#include <fstream>
+#include <iostream>
+#include <unistd.h>
+
+// Time to the first setpoint, streaming vs. load then walk, and the samples
+// of both compared bit for bit
+int main(int argc, const char *argv[]) {
+  if (argc < 2) {
+    cerr << "Usage: " << argv[0]
+         << " <machine.yml> [program.gcode] [lookahead]" << endl;
+    return 1;
+  }
+  Machine machine(argv[1]);
+  string file;
+  if (argc > 2) {
+    file = argv[2];
+  } else {
+    file = format("/tmp/cncpp_pipeline_{}.gcode", getpid());
+    Generator().write(file, 10000);
+  }
+  size_t lookahead = argc > 3 ? stoul(argv[3]) : 16;
+
+  struct Record {
+    Block *block;
+    data_t t, lambda, speed;
+    Vec3 position;
+  };
+  vector<Record> records;
+  Pipeline pipeline(&machine, lookahead);
+  pipeline.run(file, [&](const Trajectory::Sample &s) {
+    records.push_back({s.block, s.t, s.lambda, s.speed, s.position});
+  });
+  cout << pipeline.desc() << endl;
+
+  // the same, the way it is done without a pipeline
+  auto start = steady_clock::now();
+  double first = -1;
+  Program program(&machine);
+  program.load(file);
+  Trajectory traj(program, machine);
+  size_t errors = 0, count = 0;
+  traj.walk([&](const Trajectory::Sample &s) {
+    if (first < 0)
+      first =
+          duration_cast<duration<double>>(steady_clock::now() - start).count();
+    if (count >= records.size()) {
+      count++;
+      errors++;
+      return;
+    }
+    // the blocks are different objects, but with the same line number
+    Record &r = records[count++];
+    if (r.block->n() != s.block->n() || r.t != s.t || r.lambda != s.lambda ||
+        r.speed != s.speed || r.position.x() != s.position.x() ||
+        r.position.y() != s.position.y() || r.position.z() != s.position.z())
+      errors++;
+  });
+  cout << format("Load and walk: first setpoint after {:.3f} ms", first * 1000)
+       << endl;
+  cout << format("Samples: {} vs. {}, {} different", records.size(), count,
+                 errors)
+       << endl;
+  if (argc <= 2) remove(file.c_str());
+  bool ok = errors == 0 && count == records.size() &&
+            pipeline.program().size() == program.size();
+
+  // time to the first setpoint does not depend on the length of the file
+  struct Stop {};
+  string big = format("/tmp/cncpp_pipeline_{}_big.gcode", getpid());
+  Generator().write(big, 1000000);
+  Pipeline streaming(&machine, lookahead);
+  try {
+    streaming.run(big, [](const Trajectory::Sample &s) { throw Stop(); });
+  } catch (Stop &) {
+  }
+  remove(big.c_str());
+  cout << format("1M lines: first setpoint after {:.3f} ms vs. {:.3f} ms",
+                 streaming.first_setpoint() * 1000,
+                 pipeline.first_setpoint() * 1000)
+       << endl;
+  ok = ok && streaming.first_setpoint() >= 0 &&
+       streaming.first_setpoint() < 4 * pipeline.first_setpoint() + 0.01;
+
+  // subprograms defined after they are called, also by another subprogram
+  string fwd = format("/tmp/cncpp_pipeline_{}_fwd.gcode", getpid());
+  ofstream(fwd) << "N10 G00 X100 Y100 Z10 T01 S2000\n"
+                << "N20 G01 Z5 F3000\n"
+                << "N30 M98 P100 L3\n"
+                << "N40 G01 X100 Y100\n"
+                << "O100\n"
+                << "N1 G01 Z-5\n"
+                << "N2 M98 P200\n"
+                << "N3 M99\n"
+                << "N50 G00 Z10\n"
+                << "O200\n"
+                << "N1 G02 X10 Y0 I5 J0\n"
+                << "N2 M99\n";
+  size_t streamed = 0, walked = 0;
+  Pipeline forward(&machine, lookahead);
+  forward.run(fwd, [&](const Trajectory::Sample &s) { streamed++; });
+  Program loaded(&machine);
+  loaded.load(fwd);
+  Trajectory(loaded, machine).walk([&](const Trajectory::Sample &s) {
+    walked++;
+  });
+  remove(fwd.c_str());
+  cout << format("Forward call: {} vs. {} samples", streamed, walked) << endl;
+  ok = ok && streamed == walked && walked > 0;
+  cout << (ok ? "OK" : "FAILED") << endl;
+  return ok ? 0 : 3;
+}
+
+#endif // PIPELINE_MAIN
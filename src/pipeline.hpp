@@ -0,0 +1,82 @@
+/*
+  ____  _            _ _                   _
+ |  _ \(_)_ __   ___| (_)_ __   ___    ___| | __ _ ___ ___
+ | |_) | | '_ \ / _ \ | | '_ \ / _ \  / __| |/ _` / __/ __|
+ |  __/| | |_) |  __/ | | | | |  __/ | (__| | (_| \__ \__ \
+ |_|   |_| .__/ \___|_|_|_| |_|\___|  \___|_|\__,_|___/___/
+         |_|
+
+Streams a G-code file to setpoints through three concurrent stages connected
+by BoundedQueues: parsing (reader thread), planning (planner thread) and
+interpolation (calling thread), so that the first setpoints are produced as
+soon as a few blocks are planned, while the rest of the file is still being
+read, instead of after Program::load is done with the whole file:
+
+  Pipeline pipeline(&machine);
+  pipeline.run("part.gcode", [](const Trajectory::Sample &s) { ... });
+  pipeline.first_setpoint(); // s from the start of run()
+
+The samples are the same as those of a Trajectory of the loaded program, and
+the program is available afterwards. The file is read once: subprograms may
+still be called before they are defined, as with Program::load, since such a
+call reads ahead up to the definition and holds back the main program lines
+found on the way.
+*/
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+// INCLUDES AND DEFINES --------------------------------------------------------
+#include "defines.hpp"
+#include "machine.hpp"
+#include "program.hpp"
+#include "trajectory.hpp"
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+
+// NAMESPACES AND CONSTANTS ----------------------------------------------------
+using namespace std;
+
+namespace cncpp {
+
+class Pipeline : Object {
+public:
+  using sink_f = function<void(const Trajectory::Sample &s)>;
+
+  // LIFECYCLE -----------------------------------------------------------------
+  // lookahead: planned blocks waiting before the first setpoint; capacity:
+  // length of the queues between stages
+  Pipeline(Machine *machine, size_t lookahead = 16, size_t capacity = 1024)
+      : _machine(machine), _program(machine), _lookahead(lookahead),
+        _capacity(capacity) {}
+  string desc(bool colored = true) const override;
+
+  // METHODS -------------------------------------------------------------------
+  // Parses, plans and interpolates filename, calling sink for each sample
+  // from the calling thread; returns after the last one. Errors of any stage
+  // are rethrown here, after the samples of the blocks preceding the error
+  void run(const string &filename, sink_f sink);
+
+  // ACCESSORS -----------------------------------------------------------------
+  Program &program() { return _program; }
+  double first_setpoint() const { return _first; } // s, < 0 if none
+  double elapsed() const { return _elapsed; }      // s, whole run
+  size_t samples() const { return _samples; }
+
+private:
+  Machine *_machine;
+  Program _program;
+  size_t _lookahead, _capacity;
+  mutex _mtx; // guards the subprograms of _program while they are added
+  set<const Program::Body *> _planned;
+  double _first = -1, _elapsed = 0;
+  size_t _samples = 0;
+
+  Program::Body &body(const Block &call);
+  void plan(Block &b);
+};
+
+} // namespace cncpp
+
+#endif // PIPELINE_HPP
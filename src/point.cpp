@@ -21,84 +21,44 @@ using namespace fmt;
 using col_t = optional<color>;
 
 // FORWARD DECLARATIONS --------------------------------------------------------
-static string coord_str(opt_data_t const &coord, col_t const &color = nullopt);
+static string coord_str(optional<double> const &coord,
+                        col_t const &color = nullopt);
 
 
 
 // LIFECYCLE -------------------------------------------------------------------
-Point::Point(opt_data_t x, opt_data_t y, opt_data_t z) : _x(x), _y(y), _z(z) {}
+template <typename T> PointT<T>::PointT(opt_t x, opt_t y, opt_t z) {
+  if (x) this->x(x.value());
+  if (y) this->y(y.value());
+  if (z) this->z(z.value());
+}
 
 // descrition like: [100.0, 200.0, 123.2]
-string Point::desc(bool col) const {
+template <typename T> string PointT<T>::desc(bool col) const {
+  auto coord = [this](Axis a, int i) {
+    return has(a) ? optional<double>(_v.c[i]) : nullopt;
+  };
   stringstream ss;
-  ss << "[" << coord_str(_x, col ? col_t(color::red) : nullopt) << ", "
-     << coord_str(_y, col ? col_t(color::green) : nullopt) << ", "
-     << coord_str(_z, col ? col_t(color::blue) : nullopt) << "]";
+  ss << "[" << coord_str(coord(X, 0), col ? col_t(color::red) : nullopt) << ", "
+     << coord_str(coord(Y, 1), col ? col_t(color::green) : nullopt) << ", "
+     << coord_str(coord(Z, 2), col ? col_t(color::blue) : nullopt) << "]";
 
   return ss.str();
 }
 
-void Point::reset() {
-  _x.reset();
-  _y.reset();
-  _z.reset();
-}
-
-
-// OPERATORS -------------------------------------------------------------------
-Point Point::operator+(Point const &other) const {
-  if (!is_complete() || !other.is_complete())
-    throw CNCError("Points are not complete", this);
-
-  Point out(_x.value() + other._x.value(), _y.value() + other._y.value(),
-            _z.value() + other._z.value());
-  return out;
-}
-
-Point& Point::operator=(Point const &other) {
-  if (this != &other) {
-    _x = other._x;
-    _y = other._y;
-    _z = other._z;
-  }
-  return *this;
-}
-
 
 // METHODS ---------------------------------------------------------------------
-Point Point::delta(Point const &other) {
-  if (!is_complete() || !other.is_complete())
-    throw CNCError("Points are not complete", this);
-
-  Point out(_x.value() - other._x.value(), _y.value() - other._y.value(),
-            _z.value() - other._z.value());
-  return out;
-}
-
-void Point::modal(Point const &p) {
-  if (p._x && !_x)
-    _x = p._x;
-  if (p._y && !_y)
-    _y = p._y;
-  if (p._z && !_z)
-    _z = p._z;
-}
-
-data_t Point::length() const {
-  if (!is_complete())
-    throw CNCError("Point is not complete", this);
-
-  return sqrt(_x.value() * _x.value() + _y.value() * _y.value() +
-              _z.value() * _z.value());
+template <typename T> void PointT<T>::modal(PointT const &p) {
+  for (int i = 0; i < 3; i++) {
+    if (!(_mask & (1 << i)))
+      _v.c[i] = p._v.c[i];
+  }
+  _mask |= p._mask;
 }
 
-
-// ACCESSORS -------------------------------------------------------------------
-vector<data_t> Point::vec() const {
-  if (!is_complete())
-  throw CNCError("Point is not complete", this);
-  return vector<data_t>{_x.value(), _y.value(), _z.value()};
-}
+// Explicit instantiations, available to all library users
+template class cncpp::PointT<float>;
+template class cncpp::PointT<double>;
 
 
 /*
@@ -111,7 +71,7 @@ _   _ _   _ _ _ _   _
 */
 
 // Utility function to format coordinates (static = only visible here)
-static string coord_str(opt_data_t const &coord, col_t const &color) {
+static string coord_str(optional<double> const &coord, col_t const &color) {
   string str;
   if (coord && color) {
     str = format("{:" NUMBERS_WIDTH ".3f}",
@@ -165,14 +125,11 @@ int main() {
   cout << p3.delta(p1).desc() << endl;
 
   Point p4(100, 20);
+  cout << "p4 is " << (p4.is_complete() ? "" : "not ") << "complete, length: "
+       << p4.length() << endl;
+  cout << "Sum of p3 and p4: " << (p3 + p4).desc() << endl;
 
-  try {
-    cout << "p4 length: " << p4.length() << endl;
-  } catch (CNCError &e) {
-    cerr << "Error: " << e.what() << endl << "Raised by: " << e.who() << endl;
-  } catch (exception &e) {
-    cerr << "Unexpected error" << endl;
-  }
+  cout << "Size of Point: " << sizeof(Point) << " bytes" << endl;
 
   cout << "Vector from p3:" << endl;
   cout << format("{}", p3.vec()) << endl;
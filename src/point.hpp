@@ -1,19 +1,26 @@
 /*
-  ____       _       _          _               
- |  _ \ ___ (_)_ __ | |_    ___| | __ _ ___ ___ 
+  ____       _       _          _
+ |  _ \ ___ (_)_ __ | |_    ___| | __ _ ___ ___
  | |_) / _ \| | '_ \| __|  / __| |/ _` / __/ __|
  |  __/ (_) | | | | | |_  | (__| | (_| \__ \__ \
  |_|   \___/|_|_| |_|\__|  \___|_|\__,_|___/___/
-                                                
+
 Represents a 3-D coordinate object, with optional components
-and methods for calculating distances and projections
+and methods for calculating distances and projections.
+Vec3 is the complete (no missing components) counterpart, used in the hot
+paths: its arithmetic is unchecked and branch-free, so it can be vectorized.
+Both are trivially copyable: Point packs the three coordinates with a bitmask
+of the components that are actually present.
+Both are templates on the scalar type, with Vec3 and Point using data_t.
 */
 #ifndef POINT_HPP
 #define POINT_HPP
 
 // INCLUDES AND DEFINES --------------------------------------------------------
 #include "defines.hpp"
-#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
 
 // NAMESPACES AND CONSTANTS ----------------------------------------------------
 using namespace std;
@@ -21,47 +28,112 @@ using namespace std;
 // Project namespace
 namespace cncpp {
 
-// The Point class, inheriting from Object
-class Point : Object {
+// Complete 3-D vector
+template <typename T> struct Vec3T {
+  T c[3] = {0, 0, 0};
+
+  Vec3T() = default;
+  Vec3T(T x, T y, T z) : c{x, y, z} {}
+
+  Vec3T operator+(Vec3T const &o) const {
+    Vec3T r;
+    for (int i = 0; i < 3; i++) r.c[i] = c[i] + o.c[i];
+    return r;
+  }
+  Vec3T operator-(Vec3T const &o) const {
+    Vec3T r;
+    for (int i = 0; i < 3; i++) r.c[i] = c[i] - o.c[i];
+    return r;
+  }
+  Vec3T operator*(T s) const {
+    Vec3T r;
+    for (int i = 0; i < 3; i++) r.c[i] = c[i] * s;
+    return r;
+  }
+  T dot(Vec3T const &o) const {
+    return c[0] * o.c[0] + c[1] * o.c[1] + c[2] * o.c[2];
+  }
+  T length() const { return std::sqrt(dot(*this)); }
+  // conversion to a different precision: v.cast<float>()
+  template <typename U> Vec3T<U> cast() const {
+    return Vec3T<U>(U(c[0]), U(c[1]), U(c[2]));
+  }
+
+  T x() const { return c[0]; }
+  T y() const { return c[1]; }
+  T z() const { return c[2]; }
+  // so that it can be used as a range: for (auto v : vec) ...
+  const T *begin() const { return c; }
+  const T *end() const { return c + 3; }
+};
+
+
+// The Point class
+template <typename T> class PointT {
 public:
+  // bitmask of the available components
+  enum Axis : uint8_t { X = 1, Y = 2, Z = 4, XYZ = 7 };
+  using opt_t = optional<T>;
 
   // LIFECYCLE -----------------------------------------------------------------
-  Point(opt_data_t x = nullopt, opt_data_t y = nullopt, opt_data_t z = nullopt);
-  string desc(bool colored = true) const override;
-  void reset();
+  PointT(opt_t x = nullopt, opt_t y = nullopt, opt_t z = nullopt);
+  PointT(Vec3T<T> const &v) : _v(v), _mask(XYZ) {}
+  string desc(bool colored = true) const;
+  void reset() { _mask = 0; }
 
   // OPERATORS -----------------------------------------------------------------
-  Point& operator=(Point const &other);
-  Point operator+(Point const  &other) const;
+  // Components missing in either operand are missing in the result
+  PointT operator+(PointT const &other) const {
+    PointT out(_v + other._v);
+    out._mask = _mask & other._mask;
+    return out;
+  }
 
   // METHODS -------------------------------------------------------------------
   // Calculate the projections: [1 1 0] and [2 1 0] -> [1 0 0]
-  Point delta(Point const &other);
+  PointT delta(PointT const &other) const {
+    PointT out(_v - other._v);
+    out._mask = _mask & other._mask;
+    return out;
+  }
   // inherits from prev point: [1 - -] and [2 1 3] -> [1 1 3]
-  void modal(Point const &other);
-  data_t length() const;
-  bool is_complete() const { return _x && _y && _z; }
+  void modal(PointT const &other);
+  // NaN if the point is not complete
+  T length() const { return is_complete() ? _v.length() : T(NAN); }
+  bool is_complete() const { return _mask == XYZ; }
+  bool has(Axis a) const { return (_mask & a) == a; }
 
   // ACCESSORS -----------------------------------------------------------------
-  vector<data_t> vec() const;
-  data_t x() const { return _x.value(); }
-  data_t y() const { return _y.value(); }
-  data_t z() const { return _z.value(); }
-
-  data_t x(data_t v) { return (_x = v).value(); }
-  data_t y(data_t v) { return (_y = v).value(); }
-  data_t z(data_t v) { return (_z = v).value(); }
-  
+  // Unchecked: missing components have unspecified values
+  Vec3T<T> const &vec() const { return _v; }
+  T x() const { return _v.c[0]; }
+  T y() const { return _v.c[1]; }
+  T z() const { return _v.c[2]; }
+
+  T x(T v) { _mask |= X; return _v.c[0] = v; }
+  T y(T v) { _mask |= Y; return _v.c[1] = v; }
+  T z(T v) { _mask |= Z; return _v.c[2] = v; }
+
 private:
-  opt_data_t _x = nullopt;
-  opt_data_t _y = nullopt;
-  opt_data_t _z = nullopt;
+  Vec3T<T> _v;
+  uint8_t _mask = 0;
+
+}; // class PointT
+
+// Both precisions are compiled in the library (see point.cpp)
+extern template class PointT<float>;
+extern template class PointT<double>;
+
+// Default precision, as selected in defines.hpp
+using Vec3 = Vec3T<data_t>;
+using Point = PointT<data_t>;
 
-}; // class Point
+static_assert(is_trivially_copyable_v<Vec3>, "Vec3 must be trivially copyable");
+static_assert(is_trivially_copyable_v<Point>, "Point must be trivially copyable");
 
 } // namespace cncpp
 
 
 
 
-#endif // POINT_HPP
\ No newline at end of file
+#endif // POINT_HPP
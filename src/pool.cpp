@@ -0,0 +1,182 @@
+/*
+  ____             _        _
+ |  _ \ ___   ___ | |   ___| | __ _ ___ ___
+ | |_) / _ \ / _ \| |  / __| |/ _` / __/ __|
+ |  __/ (_) | (_) | | | (__| | (_| \__ \__ \
+ |_|   \___/ \___/|_|  \___|_|\__,_|___/___/
+
+Class implementation
+*/
+
+#include "pool.hpp"
+#include "parallel.hpp"
+#include <fmt/core.h>
+
+using namespace std;
+using namespace cncpp;
+
+// Worker running the current thread, if any: tasks submitted from a task go
+// to the queue of the same worker
+static thread_local const Pool *current_pool = nullptr;
+static thread_local size_t current_worker = 0;
+
+Pool::Pool(unsigned threads) {
+  if (threads == 0) threads = default_threads();
+  for (unsigned i = 0; i < threads; i++)
+    _workers.push_back(make_unique<Worker>());
+  for (unsigned i = 0; i < threads; i++)
+    _workers[i]->th = thread(&Pool::run, this, i);
+}
+
+Pool::~Pool() {
+  {
+    lock_guard<mutex> lock(_mtx);
+    _stop = true;
+  }
+  _work.notify_all();
+  for (auto &w : _workers)
+    w->th.join();
+}
+
+string Pool::desc(bool colored) const {
+  return fmt::format("Pool: {} threads, {} tasks executed, {} stolen",
+                     _workers.size(), _executed.load(), _stolen.load());
+}
+
+void Pool::submit(task_f task) {
+  size_t id;
+  {
+    lock_guard<mutex> lock(_mtx);
+    id = current_pool == this ? current_worker : _next++ % _workers.size();
+    _pending++;
+    _queued++;
+  }
+  {
+    lock_guard<mutex> lock(_workers[id]->mtx);
+    _workers[id]->tasks.push_back(move(task));
+  }
+  _work.notify_one();
+}
+
+void Pool::wait() {
+  unique_lock<mutex> lock(_mtx);
+  _idle.wait(lock, [this]() { return _pending == 0; });
+  if (_error) {
+    exception_ptr e = _error;
+    _error = nullptr;
+    rethrow_exception(e);
+  }
+}
+
+bool Pool::take(size_t id, task_f &task) {
+  // own queue first, newest task: it is the most likely to be in cache
+  {
+    Worker &w = *_workers[id];
+    lock_guard<mutex> lock(w.mtx);
+    if (!w.tasks.empty()) {
+      task = move(w.tasks.back());
+      w.tasks.pop_back();
+      return true;
+    }
+  }
+  // then steal the oldest task of another worker
+  for (size_t i = 1; i < _workers.size(); i++) {
+    Worker &w = *_workers[(id + i) % _workers.size()];
+    lock_guard<mutex> lock(w.mtx);
+    if (!w.tasks.empty()) {
+      task = move(w.tasks.front());
+      w.tasks.pop_front();
+      _stolen++;
+      return true;
+    }
+  }
+  return false;
+}
+
+void Pool::run(size_t id) {
+  current_pool = this;
+  current_worker = id;
+  for (;;) {
+    {
+      unique_lock<mutex> lock(_mtx);
+      _work.wait(lock, [this]() { return _stop || _queued > 0; });
+      if (_queued == 0) return; // stopping, and nothing left
+      _queued--; // one task is ours, possibly not yet in its queue
+    }
+    task_f task;
+    while (!take(id, task))
+      this_thread::yield();
+    try {
+      task();
+    } catch (...) {
+      lock_guard<mutex> lock(_mtx);
+      if (!_error) _error = current_exception();
+    }
+    _executed++;
+    lock_guard<mutex> lock(_mtx);
+    if (--_pending == 0) _idle.notify_all();
+  }
+}
+
+
+
+/*
+  _____         _                     _
+ |_   _|__  ___| |_   _ __ ___   __ _(_)_ __
+   | |/ _ \/ __| __| | '_ ` _ \ / _` | | '_ \
+   | |  __/\__ \ |_  | | | | | | (_| | | | | |
+   |_|\___||___/\__| |_| |_| |_|\__,_|_|_| |_|
+
+*/
+
+#ifdef POOL_MAIN
+
+#include <chrono>
+#include <iostream>
+
+using namespace fmt;
+
+// Uneven tasks: all the long ones are submitted to the first worker, the
+// others must steal them to finish in time
+int main(int argc, const char *argv[]) {
+  unsigned threads = argc > 1 ? stoul(argv[1]) : 4;
+  size_t tasks = 400;
+  Pool pool(threads);
+  atomic<size_t> done{0}, nested{0};
+  volatile double sink = 0;
+  auto work = [&](size_t n) {
+    double acc = 0;
+    for (size_t i = 0; i < n; i++) acc += 1.0 / (i + 1);
+    sink = acc;
+  };
+
+  auto start = chrono::steady_clock::now();
+  for (size_t i = 0; i < tasks; i++) {
+    size_t n = i % threads == 0 ? 400000 : 1000;
+    pool.submit([&, n, i]() {
+      work(n);
+      done++;
+      // tasks may submit more tasks
+      if (i % 100 == 0) pool.submit([&]() { nested++; });
+    });
+  }
+  pool.wait();
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  cout << pool.desc() << format(" in {:.3f} s", elapsed.count()) << endl;
+
+  // the first exception is rethrown by wait()
+  bool thrown = false;
+  pool.submit([]() { throw runtime_error("task error"); });
+  pool.submit([&]() { done++; });
+  try {
+    pool.wait();
+  } catch (runtime_error &e) {
+    thrown = string(e.what()) == "task error";
+  }
+  bool ok = done == tasks + 1 && nested == tasks / 100 && thrown &&
+            pool.executed() == tasks + tasks / 100 + 2;
+  cout << (ok ? "OK" : "FAILED") << endl;
+  return ok ? 0 : 3;
+}
+
+#endif // POOL_MAIN
@@ -0,0 +1,83 @@
+/*
+  ____             _        _
+ |  _ \ ___   ___ | |   ___| | __ _ ___ ___
+ | |_) / _ \ / _ \| |  / __| |/ _` / __/ __|
+ |  __/ (_) | (_) | | | (__| | (_| \__ \__ \
+ |_|   \___/ \___/|_|  \___|_|\__,_|___/___/
+
+Work-stealing thread pool for independent tasks of uneven size, e.g. one
+task per G-code file. Each worker has its own queue: it takes its tasks from
+the back, and when it runs out it steals from the front of the others', so
+that a few long tasks do not leave the other cores idle.
+Unlike parallel_for, tasks can be submitted at any time:
+
+  Pool pool(4);
+  for (auto &f : files) pool.submit([f]() { ... });
+  pool.wait(); // rethrows the first exception thrown by a task
+*/
+#ifndef POOL_HPP
+#define POOL_HPP
+
+// INCLUDES AND DEFINES --------------------------------------------------------
+#include "defines.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// NAMESPACES AND CONSTANTS ----------------------------------------------------
+using namespace std;
+
+namespace cncpp {
+
+class Pool : Object {
+public:
+  using task_f = function<void()>;
+
+  // LIFECYCLE -----------------------------------------------------------------
+  // threads == 0: all the available cores
+  Pool(unsigned threads = 0);
+  ~Pool(); // waits for the pending tasks
+  string desc(bool colored = true) const override;
+
+  // METHODS -------------------------------------------------------------------
+  // Queues a task, on the calling worker if called from a task
+  void submit(task_f task);
+  // Blocks until all the tasks are done, then rethrows the first exception
+  // thrown by any of them, if any
+  void wait();
+
+  // ACCESSORS -----------------------------------------------------------------
+  size_t threads() const { return _workers.size(); }
+  size_t executed() const { return _executed; }
+  size_t stolen() const { return _stolen; }
+
+private:
+  struct Worker {
+    mutex mtx;
+    deque<task_f> tasks;
+    thread th;
+  };
+  vector<unique_ptr<Worker>> _workers;
+  mutex _mtx;                   // guards the counters below
+  condition_variable _work, _idle;
+  size_t _pending = 0;          // submitted and not yet done
+  size_t _queued = 0;           // submitted and not yet taken
+  size_t _next = 0;             // round robin for external submissions
+  bool _stop = false;
+  exception_ptr _error;
+  atomic<size_t> _executed{0}, _stolen{0};
+
+  void run(size_t id);
+  bool take(size_t id, task_f &task);
+};
+
+} // namespace cncpp
+
+#endif // POOL_HPP
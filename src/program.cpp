@@ -8,9 +8,11 @@
 */
 
 #include "program.hpp"
+#include "parallel.hpp"
 #include <rang.hpp>
 #include <fmt/core.h>
 #include <fstream>
+#include <tuple>
 #include <sstream>
 
 using namespace std;
@@ -37,6 +39,21 @@ std::string Program::desc(bool colored) const {
     ss << format(", previous: {:0>3}", current_block.prev ? current_block.prev->n() : 0);
     ss << endl;
   }
+  for (auto &[number, sub] : _subprograms) {
+    if (sub.bodies.empty()) {
+      ss << format("O{:} ({:} lines, never called)", number, sub.text.size())
+         << endl;
+      continue;
+    }
+    for (auto &body : sub.bodies) {
+      ss << format("O{:} ({:} blocks, F{:} S{:} T{:})", number,
+                   body.blocks.size() - 1, body.feedrate, body.spindle,
+                   body.tool)
+         << endl;
+      for (auto b = next(body.blocks.begin()); b != body.blocks.end(); b++)
+        ss << "  " << b->desc() << endl;
+    }
+  }
   return ss.str();
 }
 
@@ -51,25 +68,316 @@ void Program::load(const string &f, bool append) {
     throw runtime_error("Could not open file " + _filename);
   }
   if (!append) reset();
+  // subprograms may be defined after they are called, so they are collected
+  // in a first pass, then the main program lines are parsed in a second one
   string line;
+  vector<bool> main;
   while (getline(file, line)) {
-    *this << line;
+    main.push_back(!define(line));
+  }
+  if (_defining) throw CNCError("Missing M99 at the end of subprogram", this);
+  file.clear();
+  file.seekg(0);
+  for (size_t i = 0; getline(file, line); i++) {
+    if (main[i]) add_block(line);
   }
   file.close();
 }
 
 
 Program &Program::operator<<(string line) {
+  if (!define(line)) add_block(line);
+  return *this;
+}
+
+size_t Program::insert_block(iterator pos, const string &line) {
+  place(pos, line);
+  return 1 + propagate(pos);
+}
+
+size_t Program::replace_block(iterator pos, const string &line) {
+  if (pos == end()) throw CNCError("Cannot replace past the end", this);
+  iterator it = place(pos, line);
+  if (_current == pos) _current = it;
+  _source.release(pos->_info->line);
+  iterator next = erase(pos);
+  collect();
+  return 1 + propagate(next);
+}
+
+size_t Program::erase_block(iterator pos) {
+  if (pos == end()) throw CNCError("Cannot erase past the end", this);
+  bool current = _current == pos;
+  _source.release(pos->_info->line);
+  iterator next = erase(pos);
+  if (current) _current = next;
+  if (next == end() && !empty()) back().next = nullptr;
+  collect();
+  return propagate(next);
+}
+
+void Program::replan(const Machine &machine, unsigned threads) {
+  vector<Block *> blocks;
+  blocks.reserve(size());
+  for (auto &b : *this)
+    blocks.push_back(&b);
+  for (auto &[number, sub] : _subprograms) {
+    for (auto &body : sub.bodies) {
+      for (auto &b : body.blocks)
+        blocks.push_back(&b);
+    }
+  }
+  parallel_for(blocks.size(), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++)
+      blocks[i]->plan(machine);
+  }, threads);
+}
+
+
+void Program::delimiters(std::string_view line, optional<size_t> &start,
+                         bool &end) {
+  start.reset();
+  end = false;
+  Block::tokenize(line, [&](std::string_view token) {
+    char cmd;
+    data_t value;
+    if (Block::scan(token, cmd, value) != Block::Error::NONE) return;
+    if (cmd == 'O')
+      start = static_cast<size_t>(value);
+    else if (cmd == 'M' && value == 99)
+      end = true;
+  });
+}
+
+
+optional<size_t> Program::called(std::string_view line) {
+  optional<size_t> number;
+  bool m98 = false;
+  Block::tokenize(line, [&](std::string_view token) {
+    char cmd;
+    data_t value;
+    if (Block::scan(token, cmd, value) != Block::Error::NONE) return;
+    if (cmd == 'M' && value == 98)
+      m98 = true;
+    else if (cmd == 'P')
+      number = static_cast<size_t>(value);
+  });
+  return m98 ? number : nullopt;
+}
+
+
+// PRIVATE METHODS -------------------------------------------------------------
+bool Program::define(const string &line) {
+  if (!_defining && line.find_first_of("Oo") == string::npos) return false;
+  optional<size_t> start;
+  bool end;
+  delimiters(line, start, end);
+  if (start) {
+    if (_defining)
+      throw CNCError("Nested subprogram definition: " + line, this);
+    auto [sub, inserted] = _subprograms.try_emplace(*start);
+    if (!inserted)
+      throw CNCError(format("Subprogram O{:} already defined", *start), this);
+    _defining = &sub->second;
+    return true;
+  }
+  if (!_defining) return false;
+  _defining->text.push_back(line);
+  if (end) _defining = nullptr;
+  return true;
+}
+
+void Program::add_block(const string &line) {
+  Block &b = append(line);
+  if (b.m() == 98) call(b);
+}
+
+Block &Program::append(const string &line) {
   if (size() > 0) {
     // emplace_back tries to create a new instance as Block(line)
     emplace_back(line, back());
   } else {
-    emplace_back(line);
+    emplace_back(line, _source);
+  }
+  back().parse(_machine, _planning);
+  return back();
+}
+
+void Program::call(Block &b) {
+  auto found = _subprograms.find(b.p());
+  if (found == _subprograms.end())
+    throw CNCError(format("Undefined subprogram O{:}", b.p()), &b);
+  Subprogram &sub = found->second;
+  if (sub.parsing)
+    throw CNCError(format("Recursive call to subprogram O{:}", b.p()), &b);
+
+  // The body is parsed and planned from the local origin, once for each
+  // modal state of the callers: the same lines run at a different feedrate
+  // when called under a different F
+  size_t i = 0;
+  while (i < sub.bodies.size() &&
+         !(sub.bodies[i].feedrate == b.feedrate() &&
+           sub.bodies[i].spindle == b.spindle() &&
+           sub.bodies[i].tool == b.tool()))
+    i++;
+  if (i == sub.bodies.size()) {
+    sub.parsing = true;
+    Body &body = sub.bodies.emplace_back();
+    body.feedrate = b.feedrate();
+    body.spindle = b.spindle();
+    body.tool = b.tool();
+    list<Block> &blocks = body.blocks;
+    blocks.emplace_back(format("X0 Y0 Z0 F{:} S{:} T{:}", b.feedrate(),
+                               b.spindle(), b.tool()),
+                        _source);
+    blocks.back().parse(_machine, _planning);
+    for (auto &line : sub.text) {
+      blocks.emplace_back(line, blocks.back());
+      blocks.back().parse(_machine, _planning);
+      if (blocks.back().m() == 98) call(blocks.back());
+    }
+    body.displacement = blocks.back().target().vec();
+    sub.parsing = false;
+  }
+  Body &body = sub.bodies[i];
+
+  // The call block ends where the last repetition does, with the modal
+  // state left by the subprogram
+  Block &last = body.blocks.back();
+  Block::Info &info = *b._info;
+  info.body = static_cast<uint32_t>(i);
+  info.target =
+      Point(b.start_point().vec() + body.displacement * data_t(b.l()));
+  info.feedrate = last.feedrate();
+  info.spindle = last.spindle();
+  info.tool = last.tool();
+}
+
+
+Program::iterator Program::place(iterator pos, const string &line) {
+  optional<size_t> start;
+  bool end_def;
+  delimiters(line, start, end_def);
+  if (start)
+    throw CNCError("Subprograms cannot be defined by editing: " + line, this);
+  Block *prev = pos == begin() ? nullptr : &*std::prev(pos);
+  iterator it = emplace(pos, line, _source);
+  auto undo = [&]() {
+    if (prev) prev->next = pos == end() ? nullptr : &*pos;
+    _source.release(it->_info->line);
+    erase(it);
+  };
+  Block::Errors errors;
+  try {
+    reparse(*it, prev, errors);
+  } catch (...) {
+    undo();
+    throw;
+  }
+  if (!errors.empty()) {
+    undo();
+    throw CNCError(format("Edit error at line: {:}\nToken: {:}\nException: {:}",
+                          line, errors.front().second,
+                          Block::errors.at(errors.front().first)),
+                   this);
+  }
+  return it;
+}
+
+void Program::reparse(Block &b, Block *prev, Block::Errors &errors) {
+  Block *next = b.next;
+  b.reset();
+  if (prev) b = *prev; // modal state and links
+  b.next = next;
+  b.try_parse(_machine, &errors);
+  if (b.m() == 98) call(b);
+}
+
+void Program::collect() {
+  if (_source.garbage() <= _source.size() / 2) return;
+  _source.compact([&](auto f) {
+    for (auto &b : *this)
+      f(b._info->line);
+    for (auto &[number, sub] : _subprograms) {
+      for (auto &body : sub.bodies) {
+        for (auto &b : body.blocks)
+          f(b._info->line);
+      }
+    }
+  });
+}
+
+size_t Program::propagate(iterator it) {
+  // what the following block inherits
+  auto state = [](const Block &b) {
+    Vec3 t = b.target().vec();
+    return make_tuple(t.c[0], t.c[1], t.c[2], b.feedrate(), b.spindle(),
+                      b.tool(), b.n());
+  };
+  size_t count = 0;
+  Block::Errors errors;
+  string lines;
+  for (; it != end(); it++) {
+    auto before = state(*it);
+    size_t found = errors.size();
+    reparse(*it, it == begin() ? nullptr : &*std::prev(it), errors);
+    count++;
+    if (errors.size() > found) lines += "\n" + it->line();
+    if (state(*it) == before) break;
   }
-  back().parse(_machine);
+  if (!errors.empty())
+    throw CNCError(format("Edit applied, but {:} following block(s) do not "
+                          "parse any more (first: {:}):{:}",
+                          errors.size(), Block::errors.at(errors.front().first),
+                          lines),
+                   this);
+  return count;
+}
+
+
+Program::Body &Program::body(const Block &call) {
+  return _subprograms.at(call.p()).bodies.at(call._info->body);
+}
+
+const Program::Body &Program::body(const Block &call) const {
+  return _subprograms.at(call.p()).bodies.at(call._info->body);
+}
+
+
+// CURSOR ----------------------------------------------------------------------
+Program::Cursor::Cursor(Program &program) : _program(program) {
+  _stack.push_back({program.begin(), program.begin(), program.end(), Vec3(),
+                    Vec3(), Vec3(), 0, 1});
+  settle();
+}
+
+Program::Cursor &Program::Cursor::operator++() {
+  Frame &f = _stack.back();
+  Block &b = *f.it++;
+  if (b.m() == 98 && b.l() > 0) {
+    Body &body = _program.body(b);
+    Vec3 origin = f.offset + b.start_point().vec();
+    auto first = next(body.blocks.begin()); // skip the head block
+    _stack.push_back({first, first, body.blocks.end(), origin,
+                      body.displacement, origin, 0, b.l()});
+  }
+  settle();
   return *this;
 }
 
+void Program::Cursor::settle() {
+  while (!_stack.empty()) {
+    Frame &f = _stack.back();
+    if (f.it != f.end) return;
+    if (++f.rep < f.reps) { // next repetition
+      f.it = f.begin;
+      f.offset = f.origin + f.step * data_t(f.rep);
+      continue;
+    }
+    _stack.pop_back();
+  }
+}
+
 
 
 
@@ -13,14 +13,59 @@
 #include "defines.hpp"
 #include "block.hpp"
 #include "machine.hpp"
+#include "source.hpp"
+#include <deque>
 #include <list>
+#include <map>
+#include <optional>
+#include <string_view>
+#include <vector>
 
 
 namespace cncpp {
 
+// The list holds the blocks of the main program. Subprogram bodies (O... up
+// to M99) are interpreted relative to the call point: they are parsed and
+// planned from a local origin, once for each modal state (F, S, T) they are
+// called with, and their repetitions (M98 P... L...) are only instantiated
+// with an offset (the call point) while walking the program with a Cursor
 class Program : Object, public std::list<Block> {
 
 public:
+  // A subprogram body, parsed and planned for one modal state of its callers
+  struct Body {
+    data_t feedrate = 0, spindle = 0; // modal state at the call
+    size_t tool = 0;
+    std::list<Block> blocks;       // a NO_MOTION head at the origin, then body
+    Vec3 displacement;             // end position of each repetition
+  };
+  struct Subprogram {
+    std::vector<std::string> text; // body lines
+    std::deque<Body> bodies;       // by first call, not moved when growing
+    bool parsing = false;          // to catch recursive calls
+  };
+
+  // Walks all the blocks, main program and subprogram repetitions, in
+  // execution order; positions of block() are to be shifted by offset()
+  class Cursor {
+  public:
+    Cursor(Program &program);
+    bool done() const { return _stack.empty(); }
+    Block &block() const { return *_stack.back().it; }
+    const Vec3 &offset() const { return _stack.back().offset; }
+    Cursor &operator++();
+
+  private:
+    struct Frame {
+      std::list<Block>::iterator it, begin, end;
+      Vec3 origin, step, offset;   // offset = origin + step * rep
+      size_t rep, reps;
+    };
+    void settle();                 // pops exhausted frames
+    Program &_program;
+    std::vector<Frame> _stack;
+  };
+
   // LIFECYCLE
   Program(const std::string &filename, Machine *machine);
   Program(Machine *machine) : _machine(machine) {}
@@ -30,22 +75,80 @@ public:
   // METHODS
   void load(const std::string &filename, bool append = false);
   Program &operator<<(std::string line);
+  Cursor cursor() { return Cursor(*this); }
+  // In-place edits of the main program: only the edited block and the
+  // following blocks whose modal state (position, F, S, T, N) actually
+  // changes are re-parsed and re-planned. Each returns the number of parsed
+  // blocks. If the new line does not parse, the program is left untouched;
+  // if a following block does not parse any more, the edit is applied and
+  // a CNCError is thrown afterwards
+  size_t insert_block(iterator pos, const std::string &line); // before pos
+  size_t replace_block(iterator pos, const std::string &line);
+  size_t erase_block(iterator pos);
+  // Recomputes the speed profiles of all the blocks, in parallel, keeping
+  // the parsed geometry; machine is usually the program's own machine, after
+  // it has been edited or reloaded (a change of zero needs a reload instead)
+  void replan(const Machine &machine, unsigned threads = 0);
+  // Subprogram delimiters: "O<number>" begins a definition (start is set),
+  // a line with M99 ends it
+  static void delimiters(std::string_view line, std::optional<size_t> &start,
+                         bool &end);
+  // Subprogram called by line (M98 P<number>), if any
+  static std::optional<size_t> called(std::string_view line);
 
   using iterator = std::list<Block>::iterator;
 
   iterator load_next() { _current++; _done = _current == end(); return _current; }
   void rewind() { _current = begin(); _done = false; }
-  void reset() { clear(); rewind(); }
+  void reset() {
+    clear();
+    _subprograms.clear();
+    _defining = nullptr;
+    _source.clear();
+    rewind();
+  }
 
   // ACCESSORS
   bool done() const { return _done; }
+  const Source &source() const { return _source; }
+  const std::map<size_t, Subprogram> &subprograms() const {
+    return _subprograms;
+  }
+  // Body run by a subprogram call (M98)
+  Body &body(const Block &call);
+  const Body &body(const Block &call) const;
 
 
 private:
+  friend class Cache; // stores and restores blocks and subprograms
+  friend class Pipeline; // parses and plans in separate threads
   Machine *_machine = nullptr;
   std::string _filename;
+  Source _source; // G-code text of all the blocks
+  std::map<size_t, Subprogram> _subprograms;
+  Subprogram *_defining = nullptr; // subprogram being defined, if any
   iterator _current = begin();
   bool _done = false;
+  bool _planning = true; // false: blocks are planned later, by a Pipeline
+
+  // true if line belongs to a subprogram definition
+  bool define(const std::string &line);
+  // parses line as a block of the main program
+  void add_block(const std::string &line);
+  // the same, without planning the subprogram it may call
+  Block &append(const std::string &line);
+  // plans the subprogram called by b, and sets the end state of b
+  void call(Block &b);
+  // inserts and parses a block before pos, leaving the program untouched if
+  // the line does not parse
+  iterator place(iterator pos, const std::string &line);
+  // re-parses b as if it had just been appended after prev
+  void reparse(Block &b, Block *prev, Block::Errors &errors);
+  // re-parses from it on, until the modal state stops changing
+  size_t propagate(iterator it);
+  // drops the text of the edited lines from _source, once it is more than
+  // half of it
+  void collect();
 };
 
 
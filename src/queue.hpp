@@ -0,0 +1,78 @@
+/*
+  ____                        _          _
+ | __ )  ___  _   _ _ __   __| | ___  __| |   __ _ _   _  ___ _   _  ___
+ |  _ \ / _ \| | | | '_ \ / _` |/ _ \/ _` |  / _` | | | |/ _ \ | | |/ _ \
+ | |_) | (_) | |_| | | | | (_| |  __/ (_| | | (_| | |_| |  __/ |_| |  __/
+ |____/ \___/ \__,_|_| |_|\__,_|\___|\__,_|  \__, |\__,_|\___|\__,_|\___|
+                                                |_|
+Blocking FIFO queue with a fixed capacity, header only, to connect threads
+of a pipeline: push() waits while the queue is full, so that a fast producer
+cannot run too far ahead of its consumer, and pop() waits while it is empty.
+close() ends the stream: the items left can still be popped, then pop()
+returns false; push() returns false from then on, which also stops a
+producer when the consumer gives up.
+*/
+#ifndef QUEUE_HPP
+#define QUEUE_HPP
+
+// INCLUDES AND DEFINES --------------------------------------------------------
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// NAMESPACES AND CONSTANTS ----------------------------------------------------
+using namespace std;
+
+namespace cncpp {
+
+template <typename T> class BoundedQueue {
+public:
+  BoundedQueue(size_t capacity) : _capacity(capacity > 0 ? capacity : 1) {}
+
+  // false if the queue has been closed
+  bool push(T item) {
+    unique_lock<mutex> lock(_mtx);
+    _not_full.wait(lock, [this]() {
+      return _closed || _items.size() < _capacity;
+    });
+    if (_closed) return false;
+    _items.push_back(move(item));
+    _not_empty.notify_one();
+    return true;
+  }
+
+  // false if the queue is closed and empty
+  bool pop(T &item) {
+    unique_lock<mutex> lock(_mtx);
+    _not_empty.wait(lock, [this]() { return _closed || !_items.empty(); });
+    if (_items.empty()) return false;
+    item = move(_items.front());
+    _items.pop_front();
+    _not_full.notify_one();
+    return true;
+  }
+
+  void close() {
+    lock_guard<mutex> lock(_mtx);
+    _closed = true;
+    _not_full.notify_all();
+    _not_empty.notify_all();
+  }
+
+  size_t size() const {
+    lock_guard<mutex> lock(_mtx);
+    return _items.size();
+  }
+  size_t capacity() const { return _capacity; }
+
+private:
+  size_t _capacity;
+  deque<T> _items;
+  bool _closed = false;
+  mutable mutex _mtx;
+  condition_variable _not_full, _not_empty;
+};
+
+} // namespace cncpp
+
+#endif // QUEUE_HPP
@@ -0,0 +1,306 @@
+/*
+  ____                        _                  _
+ |  _ \ ___  ___ ___  _ __ __| | ___ _ __    ___| | __ _ ___ ___
+ | |_) / _ \/ __/ _ \| '__/ _` |/ _ \ '__|  / __| |/ _` / __/ __|
+ |  _ <  __/ (_| (_) | | | (_| |  __/ |    | (__| | (_| \__ \__ \
+ |_| \_\___|\___\___/|_|  \__,_|\___|_|     \___|_|\__,_|___/___/
+
+
+Class implementation
+*/
+
+#include "recorder.hpp"
+#include <fmt/core.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+using namespace std::chrono;
+using namespace cncpp;
+using namespace fmt;
+
+static const char MAGIC[8] = {'C', 'N', 'C', 'R', 'E', 'C', '1', '\0'};
+
+namespace {
+
+struct Header {
+  char magic[8];
+  uint32_t record_size;  // sizeof(Recorder::Record)
+  uint32_t data_size;    // sizeof(data_t)
+  uint64_t records;
+};
+
+} // namespace
+
+static uint64_t now() {
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch())
+      .count();
+}
+
+Recorder::Recorder(size_t capacity) {
+  size_t n = 1;
+  while (n < capacity)
+    n <<= 1;
+  _mask = n - 1;
+  for (auto &ring : _rings)
+    ring.slots = make_unique<Slot[]>(n);
+}
+
+Recorder::~Recorder() { disarm(); }
+
+string Recorder::desc(bool colored) const {
+  return format("Recorder: {} setpoints, {} statuses, the last {} of each "
+                "kept{}",
+                setpoints(), statuses(), capacity(),
+                _armed ? (_triggered ? ", triggered" : ", armed") : "");
+}
+
+void Recorder::setpoint(const Vec3 &position, bool rapid) {
+  Record r;
+  memset(static_cast<void *>(&r), 0, sizeof(r)); // zero padding bytes
+  r.time = now();
+  r.kind = Kind::SETPOINT;
+  r.rapid = rapid;
+  r.position = position;
+  write(_rings[0], r);
+}
+
+void Recorder::status(const Vec3 &position, data_t error) {
+  Record r;
+  memset(static_cast<void *>(&r), 0, sizeof(r));
+  r.time = now();
+  r.kind = Kind::STATUS;
+  r.position = position;
+  r.error = error;
+  write(_rings[1], r);
+}
+
+// Single writer: the slot is marked as being written, then as done
+void Recorder::write(Ring &ring, const Record &record) {
+  uint64_t i = ring.head.load(memory_order_relaxed);
+  Slot &slot = ring.slots[i & _mask];
+  slot.seq.store(2 * i + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  slot.record = record;
+  slot.seq.store(2 * i + 2, memory_order_release);
+  ring.head.store(i + 1, memory_order_release);
+}
+
+// Records whose slot is being written, or has been overwritten, are skipped
+void Recorder::read(const Ring &ring, vector<Record> &records) const {
+  uint64_t head = ring.head.load(memory_order_acquire);
+  uint64_t first = head > capacity() ? head - capacity() : 0;
+  for (uint64_t i = first; i < head; i++) {
+    const Slot &slot = ring.slots[i & _mask];
+    uint64_t seq = slot.seq.load(memory_order_acquire);
+    if (seq != 2 * i + 2) continue;
+    Record r = slot.record;
+    atomic_thread_fence(memory_order_acquire);
+    if (slot.seq.load(memory_order_relaxed) != seq) continue;
+    records.push_back(r);
+  }
+}
+
+vector<Recorder::Record> Recorder::snapshot() const {
+  vector<Record> records;
+  for (auto &ring : _rings)
+    read(ring, records);
+  stable_sort(records.begin(), records.end(),
+              [](const Record &a, const Record &b) { return a.time < b.time; });
+  return records;
+}
+
+size_t Recorder::dump(const string &filename) const {
+  vector<Record> records = snapshot();
+  ofstream out(filename, ios::binary);
+  if (!out.is_open()) throw CNCError("Could not open file " + filename, this);
+  Header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, MAGIC, sizeof(MAGIC));
+  h.record_size = sizeof(Record);
+  h.data_size = sizeof(data_t);
+  h.records = records.size();
+  out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+  out.write(reinterpret_cast<const char *>(records.data()),
+            records.size() * sizeof(Record));
+  if (!out) throw CNCError("Could not write file " + filename, this);
+  return records.size();
+}
+
+vector<Recorder::Record> Recorder::load(const string &filename) const {
+  ifstream in(filename, ios::binary);
+  if (!in.is_open()) throw CNCError("Could not open file " + filename, this);
+  Header h;
+  if (!in.read(reinterpret_cast<char *>(&h), sizeof(h)) ||
+      memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      h.record_size != sizeof(Record) || h.data_size != sizeof(data_t))
+    throw CNCError("Not a recording of this build: " + filename, this);
+  vector<Record> records(h.records);
+  if (!in.read(reinterpret_cast<char *>(records.data()),
+               records.size() * sizeof(Record)))
+    throw CNCError("Truncated recording: " + filename, this);
+  return records;
+}
+
+// The dumping thread polls, so that trigger() is a plain store
+void Recorder::arm(const string &filename, size_t after) {
+  disarm();
+  _triggered = false;
+  _armed = true;
+  _dumper = thread([this, filename, after]() {
+    while (_armed && !_triggered)
+      this_thread::sleep_for(milliseconds(1));
+    if (!_armed) return;
+    uint64_t until = setpoints() + after;
+    while (_armed && setpoints() < until)
+      this_thread::sleep_for(milliseconds(1));
+    try {
+      dump(filename);
+    } catch (CNCError &e) {
+      cerr << "Recorder: " << e.what() << endl;
+    }
+    _armed = false;
+  });
+}
+
+void Recorder::disarm() {
+  _armed = false;
+  if (_dumper.joinable()) _dumper.join();
+}
+
+
+/*
+  _____         _                     _
+ |_   _|__  ___| |_   _ __ ___   __ _(_)_ __
+   | |/ _ \/ __| __| | '_ ` _ \ / _` | | '_ \
+   | |  __/\__ \ |_  | | | | | | (_| | | | | |
+   |_|\___||___/\__| |_| |_| |_|\__,_|_|_| |_|
+
+*/
+
+#ifdef RECORDER_MAIN
+
+#include "machine.hpp"
+#include <cstdio>
+#include <unistd.h>
+
+// Snapshots taken while a writer laps the rings, write cost, dump and load,
+// and a dump triggered by a following error received by the machine
+int main(int argc, const char *argv[]) {
+  if (argc < 2) {
+    cerr << "Usage: " << argv[0] << " <machine.yml>" << endl;
+    return 1;
+  }
+  size_t errors = 0;
+  string file = format("/tmp/cncpp_recorder_{}.rec", getpid());
+
+  // write cost, alone
+  const size_t n = 1000000;
+  {
+    Recorder recorder(1024);
+    auto t0 = steady_clock::now();
+    for (size_t i = 0; i < n; i++)
+      recorder.setpoint(Vec3(i, 2 * i, 3 * i), false);
+    auto t1 = steady_clock::now();
+    cout << format("{:.1f} ns per record",
+                   duration<double, nano>(t1 - t0).count() / n)
+         << endl;
+  }
+
+  // records are never torn, and come in order, while a writer laps the
+  // rings under a reader
+  {
+    Recorder recorder(1024);
+    atomic<bool> running{true};
+    size_t snapshots = 0, records = 0, torn = 0;
+    thread reader([&]() {
+      while (running) {
+        auto snap = recorder.snapshot();
+        data_t last = -1;
+        for (auto &r : snap) {
+          data_t x = r.position.x();
+          torn += r.position.y() != 2 * x || r.position.z() != 3 * x ||
+                  (r.kind == Recorder::Kind::STATUS && r.error != x);
+          if (r.kind == Recorder::Kind::SETPOINT) {
+            torn += x <= last;
+            last = x;
+          }
+        }
+        snapshots++;
+        records += snap.size();
+      }
+    });
+    for (size_t i = 0; i < n; i++) {
+      data_t x = data_t(i);
+      recorder.setpoint(Vec3(x, 2 * x, 3 * x), false);
+      if (i % 10 == 0) recorder.status(Vec3(x, 2 * x, 3 * x), x);
+      if (i % 1000 == 0) this_thread::yield(); // let the reader in
+    }
+    running = false;
+    reader.join();
+    errors += torn > 0 || recorder.setpoints() != n;
+    cout << recorder.desc() << endl;
+    cout << format("{} snapshots of {:.0f} records on average while "
+                   "writing, {} torn or out of order",
+                   snapshots, double(records) / max<size_t>(snapshots, 1),
+                   torn)
+         << endl;
+
+    // dump and load, byte by byte
+    auto snap = recorder.snapshot();
+    size_t dumped = recorder.dump(file);
+    auto loaded = recorder.load(file);
+    bool same = dumped == snap.size() && loaded.size() == snap.size() &&
+                memcmp(loaded.data(), snap.data(),
+                       snap.size() * sizeof(Recorder::Record)) == 0;
+    errors += !same;
+    cout << format("Dumped {} records, loaded back {}", dumped,
+                   same ? "the same" : "DIFFERENT")
+         << endl;
+  }
+
+  // a following error above max_error dumps the rings, after 5 more
+  // setpoints
+  {
+    Machine machine(argv[1]);
+    Recorder recorder(64);
+    machine.recorder(&recorder);
+    recorder.arm(file, 5);
+    auto receive = [&](data_t x, data_t error) {
+      string payload = format("{{\"x\": {}, \"y\": 0, \"z\": 0, \"error\": {}}}",
+                              x, error);
+      mosquitto_message msg{};
+      msg.topic = const_cast<char *>("cnc/status/x");
+      msg.payload = payload.data();
+      msg.payloadlen = payload.size();
+      machine.on_message(&msg);
+    };
+    // one cycle per ms, until the dump is written
+    for (size_t i = 0; recorder.armed() && i < 10000; i++) {
+      recorder.setpoint(Vec3(i, 0, 0), false); // as by Machine::sync
+      receive(i / 1000.0, i == 50 ? 0.01 : 0);
+      this_thread::sleep_for(milliseconds(1));
+    }
+    auto records = recorder.load(file);
+    size_t setpoints = 0;
+    bool found = false;
+    for (auto &r : records) {
+      if (r.kind == Recorder::Kind::SETPOINT && found) setpoints++;
+      if (r.kind == Recorder::Kind::STATUS && r.error > machine.max_error()) found = true;
+    }
+    errors += !found || setpoints < 5;
+    cout << format("Triggered dump: {} records, {} setpoints after the "
+                   "error {}",
+                   records.size(), setpoints, found ? "" : "(NOT FOUND)")
+         << endl;
+  }
+  remove(file.c_str());
+
+  cout << (errors == 0 ? "OK" : "FAILED") << endl;
+  return errors == 0 ? 0 : 3;
+}
+
+#endif // RECORDER_MAIN
@@ -0,0 +1,111 @@
+/*
+  ____                        _                  _
+ |  _ \ ___  ___ ___  _ __ __| | ___ _ __    ___| | __ _ ___ ___
+ | |_) / _ \/ __/ _ \| '__/ _` |/ _ \ '__|  / __| |/ _` / __/ __|
+ |  _ <  __/ (_| (_) | | | (_| |  __/ |    | (__| | (_| \__ \__ \
+ |_| \_\___|\___\___/|_|  \__,_|\___|_|     \___|_|\__,_|___/___/
+
+
+Flight recorder of the machine telemetry: every setpoint sent by
+Machine::sync and every status received by Machine::on_message is stored,
+with its steady clock time, in a lock-free ring that keeps the most recent
+records. Writing a record is a few stores, with no locks and no allocations,
+so that the control thread is not slowed down; the rings can be dumped to a
+binary file at any time, from any thread, or when triggered:
+
+  Recorder recorder(1 << 16);          // records per ring
+  machine.recorder(&recorder);
+  recorder.arm("fault.rec", 1000);     // dump 1000 setpoints after a trigger
+  ...                                  // following error above max_error
+  auto records = recorder.load("fault.rec");
+
+There is a ring for setpoints and one for statuses, each with a single
+writer. Readers never block them: a slot overwritten while being read is
+detected by its sequence number (a seqlock), and dropped.
+
+Binary file: the 8 bytes "CNCREC1\0", the size of a record and of data_t
+(uint32 each), the number of records (uint64), then the records, by time.
+*/
+#ifndef RECORDER_HPP
+#define RECORDER_HPP
+
+// INCLUDES AND DEFINES --------------------------------------------------------
+#include "defines.hpp"
+#include "point.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// NAMESPACES AND CONSTANTS ----------------------------------------------------
+using namespace std;
+
+namespace cncpp {
+
+class Recorder : Object {
+public:
+  enum class Kind : uint8_t { SETPOINT, STATUS };
+  struct Record {
+    uint64_t time;     // steady clock (ns)
+    Kind kind;
+    bool rapid;        // setpoints only
+    Vec3 position;     // mm, machine coordinates
+    data_t error;      // following error (mm), statuses only
+  };
+
+  // LIFECYCLE -----------------------------------------------------------------
+  // Keeps the last capacity records of each kind (rounded up to a power of 2)
+  Recorder(size_t capacity = 1 << 16);
+  ~Recorder(); // disarms
+  string desc(bool colored = true) const override;
+
+  // METHODS -------------------------------------------------------------------
+  // Writers: one thread each, lock-free
+  void setpoint(const Vec3 &position, bool rapid);
+  void status(const Vec3 &position, data_t error);
+  // The records still in the rings, by time
+  vector<Record> snapshot() const;
+  // Writes the snapshot to a binary file, returns the number of records
+  size_t dump(const string &filename) const;
+  // Records of a dump
+  vector<Record> load(const string &filename) const;
+  // Dumps to filename once, after a trigger() and then after more setpoints,
+  // on a thread of its own
+  void arm(const string &filename, size_t after = 0);
+  // Stops waiting: a dump already triggered is written with the setpoints so
+  // far
+  void disarm();
+  // Lock-free, e.g. from the control thread
+  void trigger() { _triggered = true; }
+
+  // ACCESSORS -----------------------------------------------------------------
+  size_t capacity() const { return _mask + 1; }
+  // records written so far, lost ones included
+  uint64_t setpoints() const { return _rings[0].head; }
+  uint64_t statuses() const { return _rings[1].head; }
+  bool armed() const { return _armed; }
+  bool triggered() const { return _triggered; }
+
+private:
+  struct Slot {
+    atomic<uint64_t> seq{0};   // 2 * index + 1 while writing, + 2 when done
+    Record record;
+  };
+  struct Ring {
+    atomic<uint64_t> head{0};  // records written
+    unique_ptr<Slot[]> slots;
+  };
+  size_t _mask;
+  Ring _rings[2];              // by Kind
+  atomic<bool> _triggered{false}, _armed{false};
+  thread _dumper;
+
+  void write(Ring &ring, const Record &record);
+  void read(const Ring &ring, vector<Record> &records) const;
+};
+
+} // namespace cncpp
+
+#endif // RECORDER_HPP
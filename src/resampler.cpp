@@ -0,0 +1,146 @@
+/*
+  ____                                 _                  _
+ |  _ \ ___  ___  __ _ _ __ ___  _ __ | | ___ _ __    ___| | __ _ ___ ___
+ | |_) / _ \/ __|/ _` | '_ ` _ \| '_ \| |/ _ \ '__|  / __| |/ _` / __/ __|
+ |  _ <  __/\__ \ (_| | | | | | | |_) | |  __/ |    | (__| | (_| \__ \__ \
+ |_| \_\___||___/\__,_|_| |_| |_| .__/|_|\___|_|     \___|_|\__,_|___/___/
+                                |_|
+
+Class implementation
+*/
+
+#include "resampler.hpp"
+#include <fmt/core.h>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+using namespace cncpp;
+using namespace fmt;
+
+string Resampler::desc(bool colored) const {
+  string s = format("Resampler: {} outputs", _outputs.size());
+  for (auto &o : _outputs)
+    s += format(", {} Hz ({} samples)", o.rate, o.emitted);
+  return s;
+}
+
+size_t Resampler::add(double rate, sink_f sink) {
+  if (!(rate > 0) || isinf(rate))
+    throw CNCError(format("Invalid output rate {}", rate), this);
+  _outputs.push_back({rate, sink});
+  return _outputs.size() - 1;
+}
+
+void Resampler::run() {
+  const vector<Trajectory::Segment> &segments = _trajectory.segments();
+  // as in Trajectory::walk, the last sample is at or past the end
+  for (auto &o : _outputs) {
+    o.emitted = 0;
+    o.next = 0;
+    o.count = segments.empty()
+                  ? 0
+                  : static_cast<size_t>(ceil(_trajectory.duration() * o.rate)) + 1;
+  }
+
+  size_t i = 0;
+  for (;;) {
+    double time = numeric_limits<double>::infinity();
+    for (auto &o : _outputs) {
+      if (o.pending()) time = min(time, o.next);
+    }
+    if (isinf(time)) break;
+    while (i + 1 < segments.size() && segments[i + 1].t0 <= time)
+      i++;
+    Trajectory::Sample s = _trajectory.sample(i, 0, time);
+    for (auto &o : _outputs) {
+      if (o.pending() && o.next == time) {
+        s.tick = o.emitted++;
+        o.next = o.emitted / o.rate;
+        o.sink(s);
+      }
+    }
+  }
+}
+
+
+
+/*
+  _____         _                     _
+ |_   _|__  ___| |_   _ __ ___   __ _(_)_ __
+   | |/ _ \/ __| __| | '_ ` _ \ / _` | | '_ \
+   | |  __/\__ \ |_  | | | | | | (_| | | | | |
+   |_|\___||___/\__| |_| |_| |_|\__,_|_|_| |_|
+
+*/
+
+#ifdef RESAMPLER_MAIN
+
+#include "generator.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+// Usage: resampler_test machine.yml [program.gcode] [rate...]
+int main(int argc, const char *argv[]) {
+  if (argc < 2) {
+    cerr << "Usage: " << argv[0]
+         << " <machine.yml> [program.gcode] [rate (Hz)...]" << endl;
+    return 1;
+  }
+  Machine machine(argv[1]);
+  Program program(&machine);
+  if (argc > 2) {
+    program.load(argv[2]);
+  } else {
+    Generator gen;
+    for (auto &line : gen.lines(10000))
+      program << line;
+  }
+  vector<double> rates;
+  for (int i = 3; i < argc; i++)
+    rates.push_back(stod(argv[i]));
+  if (rates.empty()) rates = {1000, 100, 30};
+
+  Trajectory traj(program, machine);
+  cout << traj.desc() << endl;
+
+  // every output sample matches the trajectory at the same time
+  Resampler rs(traj);
+  vector<double> diff(rates.size(), 0);
+  vector<size_t> errors(rates.size(), 0);
+  for (size_t r = 0; r < rates.size(); r++) {
+    rs.add(rates[r], [&, r](const Trajectory::Sample &s) {
+      if (s.time != s.tick / rates[r]) errors[r]++;
+      Trajectory::Sample ref = traj.at(s.time);
+      diff[r] = max(diff[r], double((ref.position - s.position).length()));
+    });
+  }
+  rs.run();
+  cout << rs.desc() << endl;
+  bool ok = true;
+  for (size_t r = 0; r < rates.size(); r++) {
+    size_t expected = static_cast<size_t>(ceil(traj.duration() * rates[r])) + 1;
+    ok &= errors[r] == 0 && diff[r] < 1e-9 && rs.samples(r) == expected;
+  }
+
+  // cost: all the rates in one pass vs. the highest rate alone, which is
+  // what generating at the top rate and decimating downstream costs at least
+  volatile double sink = 0;
+  auto timed = [&](const vector<double> &rates) {
+    Resampler rs(traj);
+    for (double rate : rates)
+      rs.add(rate, [&](const Trajectory::Sample &s) { sink = s.position.x(); });
+    auto start = chrono::steady_clock::now();
+    rs.run();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  };
+  double top = *max_element(rates.begin(), rates.end());
+  cout << format("All rates in {:.3f} s, {} Hz alone in {:.3f} s",
+                 timed(rates), top, timed({top}))
+       << endl;
+  cout << (ok ? "OK" : "FAILED") << endl;
+  return ok ? 0 : 3;
+}
+
+#endif // RESAMPLER_MAIN
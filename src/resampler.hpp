@@ -0,0 +1,72 @@
+/*
+  ____                                 _                  _
+ |  _ \ ___  ___  __ _ _ __ ___  _ __ | | ___ _ __    ___| | __ _ ___ ___
+ | |_) / _ \/ __|/ _` | '_ ` _ \| '_ \| |/ _ \ '__|  / __| |/ _` / __/ __|
+ |  _ <  __/\__ \ (_| | | | | | | |_) | |  __/ |    | (__| | (_| \__ \__ \
+ |_| \_\___||___/\__,_|_| |_| |_| .__/|_|\___|_|     \___|_|\__,_|___/___/
+                                |_|
+
+Samples a Trajectory at several independent rates in a single pass, e.g. the
+drive loop at 1 kHz, logging at 100 Hz and the UI at 30 Hz. Each output has
+its own sink, and the profile is evaluated only at the times actually
+emitted, rather than at tq and decimated downstream (which could not give
+30 Hz out of 1 kHz anyway):
+
+  Resampler rs(trajectory);
+  rs.add(1000, [](const Trajectory::Sample &s) { ... });
+  rs.add(30, [](const Trajectory::Sample &s) { ... });
+  rs.run();
+
+Output samples are at t = k / rate, with s.tick = k; outputs with a common
+sample time share a single evaluation.
+*/
+#ifndef RESAMPLER_HPP
+#define RESAMPLER_HPP
+
+// INCLUDES AND DEFINES --------------------------------------------------------
+#include "defines.hpp"
+#include "trajectory.hpp"
+#include <functional>
+#include <string>
+#include <vector>
+
+// NAMESPACES AND CONSTANTS ----------------------------------------------------
+using namespace std;
+
+namespace cncpp {
+
+class Resampler : Object {
+public:
+  using sink_f = function<void(const Trajectory::Sample &s)>;
+
+  // LIFECYCLE -----------------------------------------------------------------
+  Resampler(const Trajectory &trajectory) : _trajectory(trajectory) {}
+  string desc(bool colored = true) const override;
+
+  // METHODS -------------------------------------------------------------------
+  // Adds an output at rate (Hz); returns its index
+  size_t add(double rate, sink_f sink);
+  // Feeds all the outputs in time order, up to the end of the trajectory
+  void run();
+
+  // ACCESSORS -----------------------------------------------------------------
+  size_t size() const { return _outputs.size(); }
+  double rate(size_t i) const { return _outputs.at(i).rate; }
+  // samples emitted by output i in the last run
+  size_t samples(size_t i) const { return _outputs.at(i).emitted; }
+
+private:
+  struct Output {
+    double rate;
+    sink_f sink;
+    size_t count = 0, emitted = 0;
+    double next = 0;     // time of the next sample, emitted / rate
+    bool pending() const { return emitted < count; }
+  };
+  const Trajectory &_trajectory;
+  vector<Output> _outputs;
+};
+
+} // namespace cncpp
+
+#endif // RESAMPLER_HPP
@@ -0,0 +1,29 @@
+/*
+  ____                                  _
+ / ___|  ___  _   _ _ __ ___ ___    ___| | __ _ ___ ___
+ \___ \ / _ \| | | | '__/ __/ _ \  / __| |/ _` / __/ __|
+  ___) | (_) | |_| | | | (_|  __/ | (__| | (_| \__ \__ \
+ |____/ \___/ \__,_|_|  \___\___|  \___|_|\__,_|___/___/
+
+Class implementation
+*/
+
+#include "source.hpp"
+#include <fmt/core.h>
+#include <limits>
+
+using namespace std;
+using namespace cncpp;
+
+string Source::desc(bool colored) const {
+  return fmt::format("Source buffer: {} bytes", _text.size());
+}
+
+Source::Ref Source::add(string_view line) {
+  if (_text.size() + line.size() > numeric_limits<uint32_t>::max())
+    throw CNCError("Source buffer is full", this);
+  Ref ref{static_cast<uint32_t>(_text.size()),
+          static_cast<uint32_t>(line.size())};
+  _text.append(line);
+  return ref;
+}
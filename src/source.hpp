@@ -0,0 +1,77 @@
+/*
+  ____                                  _
+ / ___|  ___  _   _ _ __ ___ ___    ___| | __ _ ___ ___
+ \___ \ / _ \| | | | '__/ __/ _ \  / __| |/ _` / __/ __|
+  ___) | (_) | |_| | | | (_|  __/ | (__| | (_| \__ \__ \
+ |____/ \___/ \__,_|_|  \___\___|  \___|_|\__,_|___/___/
+
+Buffer for the G-code source text. Blocks do not own a copy of their line,
+but a reference (offset and length) into the buffer of their owner (e.g. a
+program), so that the text is stored contiguously and out of the way of the
+data used during interpolation. A buffer is not synchronized: it is to be
+used by one thread at a time, as its owner is.
+*/
+#ifndef SOURCE_HPP
+#define SOURCE_HPP
+
+// INCLUDES AND DEFINES --------------------------------------------------------
+#include "defines.hpp"
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// NAMESPACES AND CONSTANTS ----------------------------------------------------
+using namespace std;
+
+namespace cncpp {
+
+class Source : Object {
+public:
+  // Reference to a line in the buffer: 4 GiB of text at most
+  struct Ref {
+    uint32_t offset = 0;
+    uint32_t length = 0;
+  };
+
+  // LIFECYCLE -----------------------------------------------------------------
+  Source() {}
+  string desc(bool colored = true) const override;
+  void clear() { _text.clear(); _garbage = 0; }
+
+  // METHODS -------------------------------------------------------------------
+  Ref add(string_view line);
+  // The view is invalidated by the next add()
+  string_view view(Ref ref) const {
+    return string_view(_text).substr(ref.offset, ref.length);
+  }
+  // The text of a line not used any more, to be dropped by compact()
+  void release(Ref ref) { _garbage += ref.length; }
+  // Copies the lines still in use to a new buffer, dropping the released
+  // ones: refs(f) must call f(ref) on each reference in use, and each one is
+  // updated
+  template <typename F> void compact(F refs) {
+    string text;
+    text.reserve(_text.size() - _garbage);
+    refs([&](Ref &ref) {
+      string_view line = view(ref);
+      ref.offset = static_cast<uint32_t>(text.size());
+      text.append(line);
+    });
+    _text.swap(text);
+    _garbage = 0;
+  }
+
+  // ACCESSORS -----------------------------------------------------------------
+  size_t size() const { return _text.size(); }
+  const string &text() const { return _text; }
+  size_t garbage() const { return _garbage; } // bytes released so far
+
+private:
+  friend class Cache; // restores the whole buffer at once
+  string _text;
+  size_t _garbage = 0;
+};
+
+} // namespace cncpp
+
+#endif // SOURCE_HPP
@@ -0,0 +1,366 @@
+/*
+  ____  _             _           _
+ / ___|| |_ ___   ___| | __   ___| | __ _ ___ ___
+ \___ \| __/ _ \ / __| |/ /  / __| |/ _` / __/ __|
+  ___) | || (_) | (__|   <  | (__| | (_| \__ \__ \
+ |____/ \__\___/ \___|_|\_\  \___|_|\__,_|___/___/
+
+
+Class implementation
+*/
+
+#include "stock.hpp"
+#include "parallel.hpp"
+#include "pool.hpp"
+#include <fmt/core.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <limits>
+
+using namespace std;
+using namespace cncpp;
+using namespace fmt;
+
+// Side of the square tiles cut in parallel (cells)
+#define TILE_SIDE 64
+
+Stock::Stock(const Vec3 &lo, const Vec3 &hi, data_t resolution)
+    : _lo(lo), _hi(hi), _res(resolution) {
+  if (!(resolution > 0) || !(hi.x() > lo.x()) || !(hi.y() > lo.y()) ||
+      !(hi.z() > lo.z()))
+    throw CNCError("Invalid stock size or resolution", this);
+  _nx = static_cast<size_t>(ceil((hi.x() - lo.x()) / resolution));
+  _ny = static_cast<size_t>(ceil((hi.y() - lo.y()) / resolution));
+  _height.assign(_nx * _ny, hi.z());
+}
+
+string Stock::desc(bool colored) const {
+  return format("Stock: {}x{} cells of {} mm, {:.1f} mm^3 removed by {} "
+                "blocks, {} rapid cuts",
+                _nx, _ny, _res, removed(), _removal.size(), rapid_cuts());
+}
+
+double Stock::removed() const {
+  double v = 0;
+  for (auto &r : _removal)
+    v += r.volume;
+  return v;
+}
+
+size_t Stock::rapid_cuts() const {
+  return count_if(_removal.begin(), _removal.end(), [](const Removal &r) {
+    return r.volume > 0 && r.block->type() == Block::BlockType::RAPID;
+  });
+}
+
+// Lowers cells h[0, n) to z[0, n), returning the height removed. Independent
+// accumulators, so that the loop is vectorized also without -ffast-math
+static double lower(data_t *h, const data_t *z, size_t n) {
+  data_t acc[4] = {0, 0, 0, 0};
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    for (size_t k = 0; k < 4; k++) {
+      data_t nh = min(h[i + k], z[i + k]);
+      acc[k] += h[i + k] - nh;
+      h[i + k] = nh;
+    }
+  }
+  for (; i < n; i++) {
+    data_t nh = min(h[i], z[i]);
+    acc[0] += h[i] - nh;
+    h[i] = nh;
+  }
+  return double(acc[0]) + acc[1] + acc[2] + acc[3];
+}
+
+// Interval of X = x - x_a where lo <= k * X + m <= hi, intersected with
+// [x_0, x_1]
+static void clip(data_t k, data_t m, data_t lo, data_t hi, data_t &x_0,
+                 data_t &x_1) {
+  if (fabs(k) < 1e-12) {
+    if (m < lo || m > hi) x_0 = numeric_limits<data_t>::infinity();
+    return;
+  }
+  data_t a = (lo - m) / k, b = (hi - m) / k;
+  x_0 = max(x_0, min(a, b));
+  x_1 = min(x_1, max(a, b));
+}
+
+double Stock::sweep(const Vec3 &a, const Vec3 &b, const Machine::Tool &tool,
+                    size_t tx, size_t ty) {
+  const data_t inf = numeric_limits<data_t>::infinity();
+  data_t r = tool.radius, r2 = r * r;
+  data_t dx = b.x() - a.x(), dy = b.y() - a.y(), dz = b.z() - a.z();
+  data_t l = sqrt(dx * dx + dy * dy);
+  bool plunge = l < _res * 1e-3; // no motion in XY
+  data_t ux = plunge ? 0 : dx / l, uy = plunge ? 0 : dy / l;
+  bool flat = !tool.ball && (dz == 0 || plunge);
+  data_t z_flat = max(min(a.z(), b.z()), _lo.z());
+
+  // cells of the tile, rows crossed by the swept area
+  auto cell = [this](data_t x, data_t o) { return (x - o) / _res - data_t(0.5); };
+  long i_0 = tx * TILE_SIDE, i_1 = min<long>(_nx, i_0 + TILE_SIDE) - 1;
+  long j_0 = ty * TILE_SIDE, j_1 = min<long>(_ny, j_0 + TILE_SIDE) - 1;
+  j_0 = max<long>(j_0, ceil(cell(min(a.y(), b.y()) - r, _lo.y())));
+  j_1 = min<long>(j_1, floor(cell(max(a.y(), b.y()) + r, _lo.y())));
+
+  data_t z[TILE_SIDE];
+  double removed = 0;
+  for (long j = j_0; j <= j_1; j++) {
+    data_t y = _lo.y() + (j + data_t(0.5)) * _res, ry = y - a.y();
+    // the swept area is a capsule: its end disks, and the band in between
+    data_t x_lo = inf, x_hi = -inf;
+    for (const Vec3 *c : {&a, &b}) {
+      data_t e = y - c->y();
+      if (e * e > r2) continue;
+      data_t w = sqrt(r2 - e * e);
+      x_lo = min(x_lo, c->x() - w);
+      x_hi = max(x_hi, c->x() + w);
+    }
+    if (!plunge) {
+      data_t x_0 = -inf, x_1 = inf;
+      clip(ux, uy * ry, 0, l, x_0, x_1);  // along the segment
+      clip(-uy, ux * ry, -r, r, x_0, x_1); // within r from it
+      if (x_0 <= x_1) {
+        x_lo = min(x_lo, a.x() + x_0);
+        x_hi = max(x_hi, a.x() + x_1);
+      }
+    }
+    if (!(x_lo <= x_hi)) continue;
+    long i_lo = max<long>(i_0, ceil(cell(x_lo, _lo.x())));
+    long i_hi = min<long>(i_1, floor(cell(x_hi, _lo.x())));
+    if (i_lo > i_hi) continue;
+    size_t n = i_hi - i_lo + 1;
+
+    // lowest tool point on each cell
+    if (flat) {
+      fill(z, z + n, z_flat);
+    } else {
+      for (size_t k = 0; k < n; k++) {
+        data_t wx = _lo.x() + (i_lo + k + data_t(0.5)) * _res - a.x();
+        data_t t, d2 = 0;
+        if (plunge) { // ball only
+          t = dz < 0 ? 1 : 0;
+          d2 = wx * wx + ry * ry;
+        } else {
+          data_t s = (ux * wx + uy * ry) / l;  // along, in [0, 1]
+          if (tool.ball) { // closest point of the path
+            t = min<data_t>(max<data_t>(s, 0), 1);
+            data_t ex = wx - t * dx, ey = ry - t * dy;
+            d2 = ex * ex + ey * ey;
+          } else { // lowest end of the part within r
+            data_t q = -uy * wx + ux * ry;
+            data_t w = sqrt(max<data_t>(r2 - q * q, 0)) / l;
+            t = dz < 0 ? min<data_t>(s + w, 1) : max<data_t>(s - w, 0);
+          }
+        }
+        z[k] = a.z() + dz * t;
+        if (tool.ball) z[k] += r - sqrt(max<data_t>(r2 - d2, 0));
+        z[k] = max(z[k], _lo.z());
+      }
+    }
+    removed += lower(&_height[j * _nx + i_lo], z, n);
+  }
+  return removed * _res * _res;
+}
+
+void Stock::cut(Program &program, const Machine &machine, unsigned threads) {
+  // executed blocks that move, with their subprogram offset
+  vector<pair<Block *, Vec3>> blocks;
+  for (auto c = program.cursor(); !c.done(); ++c) {
+    Block &b = c.block();
+    if (b.type() == Block::BlockType::NO_MOTION || !(b.length() > 0))
+      continue;
+    blocks.push_back({&b, c.offset()});
+  }
+  _removal.clear();
+  for (auto &[b, o] : blocks)
+    _removal.push_back({b, 0});
+
+  // tiles touched by each block: its bounding box widened by the tool
+  // radius; blocks above the stock are skipped, and need no tool
+  size_t tiles_x = (_nx + TILE_SIDE - 1) / TILE_SIDE;
+  size_t tiles_y = (_ny + TILE_SIDE - 1) / TILE_SIDE;
+  vector<array<long, 4>> span(blocks.size());
+  vector<const Machine::Tool *> tools(blocks.size(), nullptr);
+  parallel_for(blocks.size(), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      auto &[b, offset] = blocks[i];
+      span[i] = {0, -1, 0, -1};
+      Vec3 lo, hi;
+      b->geometry().bounds(lo, hi);
+      if (!(lo.z() + offset.z() < _hi.z())) continue;
+      tools[i] = &machine.tool(b->tool());
+      data_t r = tools[i]->radius + _res;
+      long t[4] = {
+        long(floor((lo.x() + offset.x() - r - _lo.x()) / _res / TILE_SIDE)),
+        long(floor((hi.x() + offset.x() + r - _lo.x()) / _res / TILE_SIDE)),
+        long(floor((lo.y() + offset.y() - r - _lo.y()) / _res / TILE_SIDE)),
+        long(floor((hi.y() + offset.y() + r - _lo.y()) / _res / TILE_SIDE))};
+      span[i] = {max<long>(t[0], 0), min<long>(t[1], tiles_x - 1),
+                 max<long>(t[2], 0), min<long>(t[3], tiles_y - 1)};
+    }
+  }, threads);
+  vector<vector<uint32_t>> bins(tiles_x * tiles_y);
+  for (size_t i = 0; i < blocks.size(); i++) {
+    for (long ty = span[i][2]; ty <= span[i][3]; ty++)
+      for (long tx = span[i][0]; tx <= span[i][1]; tx++)
+        bins[ty * tiles_x + tx].push_back(i);
+  }
+
+  // tiles in parallel, each with the blocks in program order; uneven work,
+  // hence the work-stealing pool
+  vector<vector<double>> volumes(bins.size());
+  {
+    Pool pool(threads);
+    for (size_t tile = 0; tile < bins.size(); tile++) {
+      if (bins[tile].empty()) continue;
+      pool.submit([&, tile]() {
+        size_t tx = tile % tiles_x, ty = tile / tiles_x;
+        vector<Vec3> pts;
+        volumes[tile].resize(bins[tile].size());
+        for (size_t k = 0; k < bins[tile].size(); k++) {
+          auto &[b, offset] = blocks[bins[tile][k]];
+          b->path(_res / 10, pts);
+          double v = 0;
+          for (size_t p = 1; p < pts.size(); p++)
+            v += sweep(pts[p - 1] + offset, pts[p] + offset,
+                       *tools[bins[tile][k]], tx, ty);
+          volumes[tile][k] = v;
+        }
+      });
+    }
+    pool.wait();
+  }
+  for (size_t tile = 0; tile < bins.size(); tile++)
+    for (size_t k = 0; k < volumes[tile].size(); k++)
+      _removal[bins[tile][k]].volume += volumes[tile][k];
+}
+
+void Stock::write(const string &filename) const {
+  ofstream out(filename);
+  if (!out.is_open()) throw CNCError("Could not open file " + filename, this);
+  out << format("ncols {}\nnrows {}\nxllcorner {}\nyllcorner {}\ncellsize "
+                "{}\nNODATA_value -9999\n",
+                _nx, _ny, _lo.x(), _lo.y(), _res);
+  for (size_t j = _ny; j-- > 0;) {
+    for (size_t i = 0; i < _nx; i++)
+      out << (i ? " " : "") << format("{:.4f}", height(i, j));
+    out << '\n';
+  }
+}
+
+void Stock::write_removal(const string &filename) const {
+  ofstream out(filename);
+  if (!out.is_open()) throw CNCError("Could not open file " + filename, this);
+  out << "n,type,tool,time,volume,mrr\n";
+  for (auto &r : _removal)
+    out << format("{},{},{},{:.4f},{:.4f},{:.4f}\n", r.block->n(),
+                  r.block->type_name(), r.block->tool(),
+                  r.block->profile().dt, r.volume, r.mrr());
+}
+
+
+/*
+  _____         _                     _
+ |_   _|__  ___| |_   _ __ ___   __ _(_)_ __
+   | |/ _ \/ __| __| | '_ ` _ \ / _` | | '_ \
+   | |  __/\__ \ |_  | | | | | | (_| | | | | |
+   |_|\___||___/\__| |_| |_| |_|\__,_|_|_| |_|
+
+*/
+
+#ifdef STOCK_MAIN
+
+#include "generator.hpp"
+#include <chrono>
+#include <iostream>
+
+using namespace std::chrono;
+
+// Removed volumes of straight grooves and a circular one against their
+// analytic values, same surface with one and all threads, and timing on a
+// generated (or given) program
+int main(int argc, const char *argv[]) {
+  if (argc < 2) {
+    cerr << "Usage: " << argv[0] << " <machine.yml> [program.gcode] [cell]"
+         << endl;
+    return 1;
+  }
+  Machine machine(argv[1]);
+  size_t errors = 0;
+
+  // grooves 5 mm deep, full length, in a 100x100x20 box; T1 is a flat end
+  // mill of radius 5, T2 a ball end mill of radius 3, T3 flat of radius 1
+  {
+    Program program(&machine);
+    for (auto line : {"G00 X-10 Y30 Z30 T1", "G00 Z15", "G01 X110 F1000",
+                      "G00 Z30", "G00 X-10 Y70 T2", "G00 Z15",
+                      "G01 X110 F1000", "G00 Z30", "G00 X50 Y50 T3",
+                      "G01 Z18 F200", "G02 X50 Y50 I0 J-20 F500", "G00 Z30"})
+      program << line;
+    Stock stock(Vec3(0, 0, 0), Vec3(100, 100, 20), 0.05);
+    stock.cut(program, machine);
+    double flat = 0, ball = 0, circle = 0;
+    for (auto &r : stock.removal()) {
+      if (r.block->tool() == 1) flat += r.volume;
+      if (r.block->tool() == 2) ball += r.volume;
+      if (r.block->tool() == 3) circle += r.volume;
+    }
+    // the circle crosses the flat groove, where nothing is left to cut
+    double flat_x = 100 * 10 * 5;
+    double ball_x = 100 * (M_PI * 3 * 3 / 2 + 6 * 2);
+    double circle_x = M_PI * (21 * 21 - 19 * 19) * 2;
+    cout << stock.desc() << endl;
+    for (auto [name, v, x] : {tuple{"flat", flat, flat_x},
+                              tuple{"ball", ball, ball_x}}) {
+      bool ok = fabs(v - x) < 0.01 * x;
+      errors += !ok;
+      cout << format("{} groove: {:.1f} mm^3 vs. {:.1f} mm^3 {}", name, v, x,
+                     ok ? "" : "(WRONG)")
+           << endl;
+    }
+    bool ok = circle > 0 && circle < circle_x;
+    errors += !ok || stock.rapid_cuts() > 0;
+    cout << format("circle: {:.1f} mm^3, less than {:.1f} mm^3 {}", circle,
+                   circle_x, ok ? "" : "(WRONG)")
+         << endl;
+  }
+
+  // a program over a 400x400x50 box
+  Program program(&machine);
+  if (argc > 2) {
+    program.load(argv[2]);
+  } else {
+    Generator gen;
+    for (auto &line : gen.lines(20000))
+      program << line;
+  }
+  data_t cell = argc > 3 ? atof(argv[3]) : 0.5;
+  Stock serial(Vec3(0, 0, 0), Vec3(400, 400, 25), cell);
+  Stock parallel(Vec3(0, 0, 0), Vec3(400, 400, 25), cell);
+  auto t0 = steady_clock::now();
+  serial.cut(program, machine, 1);
+  auto t1 = steady_clock::now();
+  parallel.cut(program, machine);
+  auto t2 = steady_clock::now();
+  size_t diff = 0;
+  for (size_t j = 0; j < serial.ny(); j++)
+    for (size_t i = 0; i < serial.nx(); i++)
+      diff += serial.height(i, j) != parallel.height(i, j);
+  errors += diff > 0 || serial.removed() != parallel.removed();
+  cout << parallel.desc() << endl;
+  cout << format("{} blocks: {:.3f} s on 1 thread, {:.3f} s on {} threads, "
+                 "{} cells different",
+                 program.size(), duration<double>(t1 - t0).count(),
+                 duration<double>(t2 - t1).count(),
+                 thread::hardware_concurrency(), diff)
+       << endl;
+
+  cout << (errors == 0 ? "OK" : "FAILED") << endl;
+  return errors == 0 ? 0 : 3;
+}
+
+#endif // STOCK_MAIN
@@ -0,0 +1,92 @@
+/*
+  ____  _             _           _
+ / ___|| |_ ___   ___| | __   ___| | __ _ ___ ___
+ \___ \| __/ _ \ / __| |/ /  / __| |/ _` / __/ __|
+  ___) | || (_) | (__|   <  | (__| | (_| \__ \__ \
+ |____/ \__\___/ \___|_|\_\  \___|_|\__,_|___/___/
+
+Material removal on a heightmap: the stock is a box, sampled on a regular XY
+grid of cells, each holding the height of the material left. The tool of
+each block (from the tool table of the machine) is swept along the block
+path, and every cell within its radius is lowered to the tool tip, or to the
+ball surface for ball end mills:
+
+  Stock stock(Vec3(0, 0, 0), Vec3(400, 400, 25), 0.5); // lo, hi, cell (mm)
+  stock.cut(program, machine);
+  stock.write("surface.asc");   // ESRI ASCII grid
+  stock.write_removal("mrr.csv"); // volume and removal rate per block
+
+The grid is split in square tiles, cut in parallel: each tile applies the
+blocks touching it in program order, so that the result does not depend on
+the number of threads. Arcs are split in chords within a tenth of a cell.
+Cuts are exact for flat end mills; for ball end mills moving along Z as well,
+the lowest point is taken where the cell is closest to the tool axis.
+*/
+#ifndef STOCK_HPP
+#define STOCK_HPP
+
+// INCLUDES AND DEFINES --------------------------------------------------------
+#include "defines.hpp"
+#include "block.hpp"
+#include "machine.hpp"
+#include "program.hpp"
+#include <string>
+#include <vector>
+
+// NAMESPACES AND CONSTANTS ----------------------------------------------------
+using namespace std;
+
+namespace cncpp {
+
+class Stock : Object {
+public:
+  // Material removed by an executed block
+  struct Removal {
+    Block *block;
+    double volume;                    // mm^3
+    double mrr() const {              // mm^3/s
+      return block->profile().dt > 0 ? volume / block->profile().dt : 0;
+    }
+  };
+
+  // LIFECYCLE -----------------------------------------------------------------
+  // Box of material from lo to hi, on cells of side resolution (mm)
+  Stock(const Vec3 &lo, const Vec3 &hi, data_t resolution);
+  string desc(bool colored = true) const override;
+
+  // METHODS -------------------------------------------------------------------
+  // Cuts all the blocks of program, in execution order (subprograms
+  // included). Throws a CNCError if a block reaching into the stock uses a
+  // tool that is not in the tool table
+  void cut(Program &program, const Machine &machine, unsigned threads = 0);
+  // Surface as an ESRI ASCII grid (first row is the highest Y)
+  void write(const string &filename) const;
+  // CSV: n,type,tool,time,volume,mrr for each block of the last cut()
+  void write_removal(const string &filename) const;
+
+  // ACCESSORS -----------------------------------------------------------------
+  size_t nx() const { return _nx; }
+  size_t ny() const { return _ny; }
+  data_t resolution() const { return _res; }
+  // material height on cell (i, j), i along X
+  data_t height(size_t i, size_t j) const { return _height[j * _nx + i]; }
+  const vector<Removal> &removal() const { return _removal; }
+  double removed() const;     // total volume (mm^3)
+  size_t rapid_cuts() const;  // rapids that removed material (gouges)
+
+private:
+  Vec3 _lo, _hi;
+  data_t _res;
+  size_t _nx, _ny;
+  vector<data_t> _height;     // row major, j * nx + i
+  vector<Removal> _removal;
+
+  // cuts segment a-b with tool on the cells of tile (tx, ty); returns the
+  // removed volume
+  double sweep(const Vec3 &a, const Vec3 &b, const Machine::Tool &tool,
+               size_t tx, size_t ty);
+};
+
+} // namespace cncpp
+
+#endif // STOCK_HPP
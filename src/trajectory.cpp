@@ -0,0 +1,176 @@
+/*
+  _____           _           _                          _
+ |_   _| __ __ _ (_) ___  ___| |_ ___  _ __ _   _    ___| | __ _ ___ ___
+   | || '__/ _` || |/ _ \/ __| __/ _ \| '__| | | |  / __| |/ _` / __/ __|
+   | || | | (_| || |  __/ (__| || (_) | |  | |_| | | (__| | (_| \__ \__ \
+   |_||_|  \__,_|/ |\___|\___|\__\___/|_|   \__, |  \___|_|\__,_|___/___/
+               |__/                         |___/
+
+Class implementation
+*/
+
+#include "trajectory.hpp"
+#include <fmt/core.h>
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using namespace cncpp;
+using namespace fmt;
+
+Trajectory::Trajectory(Program &program, const Machine &machine)
+    : _tq(machine.tq()) {
+  // start times are summed in double, also when data_t is float
+  for (auto c = program.cursor(); !c.done(); ++c) {
+    Block &b = c.block();
+    if (!(b.profile().dt > 0)) continue;
+    _segments.push_back({&b, c.offset(), _duration});
+    _duration += b.profile().dt;
+  }
+}
+
+string Trajectory::desc(bool colored) const {
+  return format("Trajectory: {} blocks, {:.3f} s, {} samples", _segments.size(),
+                _duration, ticks());
+}
+
+size_t Trajectory::ticks() const {
+  if (_segments.empty()) return 0;
+  return static_cast<size_t>(ceil(_duration / _tq)) + 1;
+}
+
+Trajectory::Sample Trajectory::sample(size_t i, size_t k, double time) const {
+  return evaluate(_segments[i], k, time);
+}
+
+Trajectory::Sample Trajectory::evaluate(const Segment &seg, size_t k,
+                                        double time) {
+  Sample s;
+  s.tick = k;
+  s.time = time;
+  s.t = static_cast<data_t>(time - seg.t0);
+  s.block = seg.block;
+  s.position = seg.block->interpolate(s.t, s.lambda, s.speed) + seg.offset;
+  return s;
+}
+
+size_t Trajectory::segment(double time) const {
+  auto it = upper_bound(
+      _segments.begin(), _segments.end(), time,
+      [](double t, const Segment &s) { return t < s.t0; });
+  return it == _segments.begin() ? 0 : it - _segments.begin() - 1;
+}
+
+size_t Trajectory::tick_at(double time) const {
+  if (!(time > 0)) return 0;
+  // time / tq may be off by one ulp either way
+  size_t k = static_cast<size_t>(ceil(time / _tq));
+  while (k > 0 && (k - 1) * _tq >= time)
+    k--;
+  while (k * _tq < time)
+    k++;
+  return k;
+}
+
+void Trajectory::walk(function<void(const Sample &s)> f, size_t first,
+                      size_t last) const {
+  last = min(last, ticks());
+  if (first >= last) return;
+  size_t i = segment(first * _tq);
+  for (size_t k = first; k < last; k++) {
+    double time = k * _tq;
+    // a block can be shorter than tq: skip all those already over
+    while (i + 1 < _segments.size() && _segments[i + 1].t0 <= time)
+      i++;
+    f(sample(i, k, time));
+  }
+}
+
+Trajectory::Sample Trajectory::at(double time) const {
+  if (_segments.empty()) throw CNCError("Empty trajectory", this);
+  return sample(segment(time), static_cast<size_t>(max(0.0, round(time / _tq))),
+                time);
+}
+
+
+/*
+  _____         _                     _
+ |_   _|__  ___| |_   _ __ ___   __ _(_)_ __
+   | |/ _ \/ __| __| | '_ ` _ \ / _` | | '_ \
+   | |  __/\__ \ |_  | | | | | | (_| | | | | |
+   |_|\___||___/\__| |_| |_| |_|\__,_|_|_| |_|
+
+*/
+
+#ifdef TRAJECTORY_MAIN
+
+#include "generator.hpp"
+#include <iostream>
+
+// Cycle time on the single clock vs. the former per-block quantization, and
+// consistency checks of the samples
+int main(int argc, const char *argv[]) {
+  if (argc < 2) {
+    cerr << "Usage: " << argv[0] << " <machine.yml> [program.gcode]" << endl;
+    return 1;
+  }
+  Machine machine(argv[1]);
+  Program program(&machine);
+  if (argc > 2) {
+    program.load(argv[2]);
+  } else {
+    Generator gen;
+    for (auto &line : gen.lines(10000))
+      program << line;
+  }
+  Trajectory traj(program, machine);
+  cout << traj.desc() << endl;
+
+  // each block used to be rounded up to the next multiple of tq
+  double padded = 0;
+  for (auto &s : traj.segments())
+    padded += (floor(s.block->profile().dt / traj.tq()) + 1) * traj.tq();
+  cout << format("Padded cycle time: {:.3f} s, saved {:.3f} s ({:.2f}%)",
+                 padded, padded - traj.duration(),
+                 100 * (padded - traj.duration()) / padded)
+       << endl;
+
+  // walk() and at() agree, samples are continuous within fmax (unless
+  // rapids are dog-legs) and each axis within its vmax
+  size_t errors = 0, count = 0;
+  double max_speed = 0, max_diff = 0, axis_ratio = 0;
+  Vec3 last;
+  traj.walk([&](const Trajectory::Sample &s) {
+    if (s.tick != count++ || s.time != s.tick * traj.tq()) errors++;
+    Trajectory::Sample a = traj.tick(s.tick);
+    max_diff = max(max_diff, double((a.position - s.position).length()));
+    if (s.tick > 0) {
+      Vec3 v = (s.position - last) * data_t(60 / traj.tq());
+      max_speed = max(max_speed, double(v.length()));
+      for (size_t i = 0; i < 3; i++)
+        axis_ratio = max(axis_ratio, double(fabs(v.c[i]) / machine.vmax(i)));
+    }
+    last = s.position;
+  });
+  cout << format("Samples: {}, max speed {:.1f} mm/min (fmax {}), "
+                 "max axis speed {:.1f}% of vmax, walk vs. at {:.3e} mm",
+                 count, max_speed, machine.fmax(), axis_ratio * 100, max_diff)
+       << endl;
+  // a window of ticks is the same as the corresponding part of the whole
+  size_t first = traj.tick_at(traj.duration() / 3), window = 0;
+  traj.walk(
+      [&](const Trajectory::Sample &s) {
+        if (s.tick != first + window++ ||
+            (s.position - traj.tick(s.tick).position).length() > 1e-9)
+          errors++;
+      },
+      first, first + 1000);
+  errors += window != min<size_t>(1000, traj.ticks() - first);
+  bool ok = errors == 0 && count == traj.ticks() && max_diff < 1e-6 &&
+            axis_ratio <= 1.001 &&
+            (machine.dogleg() || max_speed <= machine.fmax() * 1.001);
+  cout << (ok ? "OK" : "FAILED") << endl;
+  return ok ? 0 : 3;
+}
+
+#endif // TRAJECTORY_MAIN
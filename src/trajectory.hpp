@@ -0,0 +1,92 @@
+/*
+  _____           _           _                          _
+ |_   _| __ __ _ (_) ___  ___| |_ ___  _ __ _   _    ___| | __ _ ___ ___
+   | || '__/ _` || |/ _ \/ __| __/ _ \| '__| | | |  / __| |/ _` / __/ __|
+   | || | | (_| || |  __/ (__| || (_) | |  | |_| | | (__| | (_| \__ \__ \
+   |_||_|  \__,_|/ |\___|\___|\__\___/|_|   \__, |  \___|_|\__,_|___/___/
+               |__/                         |___/
+
+Timeline of a whole program on a single sampling clock. Block profiles are
+not padded to a multiple of tq: each interpolated block starts at the exact
+end time of the previous one, and the samples are taken at t = k * tq with an
+integer tick k, so that block transitions fall mid-tick and the timestamps do
+not drift on long programs:
+
+  Trajectory traj(program, machine);
+  traj.walk([](const Trajectory::Sample &s) { ... s.position ... });
+
+No-motion blocks take no time and are not part of the timeline.
+The program must outlive the trajectory, and be left unchanged meanwhile.
+*/
+#ifndef TRAJECTORY_HPP
+#define TRAJECTORY_HPP
+
+// INCLUDES AND DEFINES --------------------------------------------------------
+#include "defines.hpp"
+#include "block.hpp"
+#include "machine.hpp"
+#include "program.hpp"
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// NAMESPACES AND CONSTANTS ----------------------------------------------------
+using namespace std;
+
+namespace cncpp {
+
+class Trajectory : Object {
+public:
+  struct Segment {
+    Block *block;
+    Vec3 offset;         // subprogram repetition offset (see Program::Cursor)
+    double t0;           // start time (s) on the program clock
+  };
+
+  struct Sample {
+    size_t tick;         // sample index k
+    double time;         // k * tq (s)
+    data_t t;            // time from the start of the block (s)
+    Block *block;
+    data_t lambda, speed;
+    Vec3 position;       // offset included
+  };
+
+  // LIFECYCLE -----------------------------------------------------------------
+  Trajectory(Program &program, const Machine &machine);
+  string desc(bool colored = true) const override;
+
+  // METHODS -------------------------------------------------------------------
+  // All the samples, in order: the last one is at or past the end of the
+  // program, and it holds the final position. A range of ticks [first, last)
+  // can be given, e.g. from tick_at(t0) to tick_at(t1) for a time window
+  void walk(function<void(const Sample &s)> f, size_t first = 0,
+            size_t last = SIZE_MAX) const;
+  // Sample at any time, clamped to the program duration
+  Sample at(double time) const;
+  Sample tick(size_t k) const { return at(k * _tq); }
+  // First tick at or after time
+  size_t tick_at(double time) const;
+  // Sample of a segment at time k * tq (used by streaming stages as well)
+  static Sample evaluate(const Segment &seg, size_t k, double time);
+
+  // ACCESSORS -----------------------------------------------------------------
+  double duration() const { return _duration; }
+  double tq() const { return _tq; }
+  size_t ticks() const;  // number of samples taken by walk()
+  const vector<Segment> &segments() const { return _segments; }
+
+private:
+  friend class Resampler; // samples at its own rates
+  vector<Segment> _segments;
+  double _tq;
+  double _duration = 0;
+
+  Sample sample(size_t i, size_t k, double time) const;
+  size_t segment(double time) const; // index of the segment at time
+};
+
+} // namespace cncpp
+
+#endif // TRAJECTORY_HPP
@@ -0,0 +1,287 @@
+/*
+ __     __    _ _     _       _                    _
+ \ \   / /_ _| (_) __| | __ _| |_ ___  _ __    ___| | __ _ ___ ___
+  \ \ / / _` | | |/ _` |/ _` | __/ _ \| '__|  / __| |/ _` / __/ __|
+   \ V / (_| | | | (_| | (_| | || (_) | |    | (__| | (_| \__ \__ \
+    \_/ \__,_|_|_|\__,_|\__,_|\__\___/|_|     \___|_|\__,_|___/___/
+
+Class implementation
+*/
+
+#include "validator.hpp"
+#include "parallel.hpp"
+#include "program.hpp"
+#include "source.hpp"
+#include <fmt/core.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <sstream>
+
+using namespace std;
+using namespace cncpp;
+using namespace fmt;
+
+namespace {
+
+// Modal state after a given line; n is the block number (-1 before the first
+// line, so that the first block gets number 0 as in Program)
+struct Modal {
+  opt_data_t x, y, z, f, s, t;
+  int64_t n = -1;
+
+  // a NO_MOTION block that sets the same state
+  string line() const {
+    string l = format("N{}", n);
+    auto word = [&l](char c, const opt_data_t &v) {
+      if (v) l += format(" {}{}", c, *v); // shortest exact representation
+    };
+    word('X', x); word('Y', y); word('Z', z);
+    word('F', f); word('S', s); word('T', t);
+    return l;
+  }
+};
+
+// Modal words found in a chunk of lines
+struct Summary {
+  Modal last;         // last valid value of each word, if any
+  bool has_n = false;
+  size_t after_n = 0; // lines after the one with the last N word
+  size_t lines = 0;
+
+  Modal apply(const Modal &in) const {
+    Modal out;
+    out.x = last.x ? last.x : in.x;
+    out.y = last.y ? last.y : in.y;
+    out.z = last.z ? last.z : in.z;
+    out.f = last.f ? last.f : in.f;
+    out.s = last.s ? last.s : in.s;
+    out.t = last.t ? last.t : in.t;
+    out.n = has_n ? last.n + after_n : in.n + lines;
+    return out;
+  }
+};
+
+// Same rules as Block::parse_token, without building the blocks
+Summary scan_chunk(const vector<std::string_view> &lines, size_t begin,
+                   size_t end) {
+  Summary sum;
+  for (size_t i = begin; i < end; i++) {
+    bool n_found = false;
+    Block::tokenize(lines[i], [&](std::string_view token) {
+      char cmd;
+      data_t v;
+      if (Block::scan(token, cmd, v) != Block::Error::NONE) return;
+      bool integer = v == trunc(v) && v >= 0;
+      switch (cmd) {
+      case 'X': sum.last.x = v; break;
+      case 'Y': sum.last.y = v; break;
+      case 'Z': sum.last.z = v; break;
+      case 'F': sum.last.f = v; break;
+      case 'S': sum.last.s = v; break;
+      case 'T': if (integer && v <= UINT16_MAX) sum.last.t = v; break;
+      case 'N':
+        if (integer && v <= UINT32_MAX) {
+          sum.last.n = static_cast<int64_t>(v);
+          n_found = true;
+        }
+        break;
+      default: break;
+      }
+    });
+    if (n_found) {
+      sum.has_n = true;
+      sum.after_n = 0;
+    } else {
+      sum.after_n++;
+    }
+  }
+  sum.lines = end - begin;
+  return sum;
+}
+
+} // namespace
+
+
+string Validator::desc(bool colored) const {
+  return format("Validator: {} lines, {} diagnostics", _lines,
+                _diagnostics.size());
+}
+
+const vector<Validator::Diagnostic> &
+Validator::validate(const string &filename) {
+  ifstream file(filename, ios::binary);
+  if (!file.is_open())
+    throw CNCError("Could not open file " + filename, this);
+  ostringstream ss;
+  ss << file.rdbuf();
+  return validate_text(ss.str());
+}
+
+const vector<Validator::Diagnostic> &
+Validator::validate_text(std::string_view text) {
+  // split lines as getline() does in Program::load; subprogram definitions
+  // are moved after the main program, as they are not part of its flow
+  vector<std::string_view> lines, defs;
+  vector<size_t> numbers, def_numbers, def_begin;
+  optional<size_t> start;
+  bool end, defining = false;
+  _lines = 0;
+  for (size_t pos = 0, eol; pos < text.size(); pos = eol + 1) {
+    eol = text.find('\n', pos);
+    if (eol == std::string_view::npos) eol = text.size();
+    std::string_view line = text.substr(pos, eol - pos);
+    _lines++;
+    start.reset();
+    end = false;
+    if (defining || line.find_first_of("Oo") != std::string_view::npos)
+      Program::delimiters(line, start, end);
+    if (start) {
+      defining = true;
+      def_begin.push_back(defs.size());
+    } else if (defining) {
+      defs.push_back(line);
+      def_numbers.push_back(_lines);
+      defining = !end;
+    } else {
+      lines.push_back(line);
+      numbers.push_back(_lines);
+    }
+  }
+  size_t main_lines = lines.size();
+  lines.insert(lines.end(), defs.begin(), defs.end());
+  numbers.insert(numbers.end(), def_numbers.begin(), def_numbers.end());
+  _diagnostics.clear();
+
+  unsigned threads = _threads ? _threads : default_threads();
+  size_t chunks = max<size_t>(1, min<size_t>(threads, main_lines / 4096));
+  size_t step = (main_lines + chunks - 1) / chunks;
+  auto chunk_begin = [&](size_t c) { return min(c * step, main_lines); };
+
+  // 1. modal words of each chunk of the main program, in parallel
+  vector<Summary> summaries(chunks);
+  parallel_for(chunks, [&](size_t b, size_t e) {
+    for (size_t c = b; c < e; c++)
+      summaries[c] = scan_chunk(lines, chunk_begin(c), chunk_begin(c + 1));
+  }, threads);
+
+  // 2. modal state at the beginning of each chunk (cheap, sequential).
+  // Subprograms are separate chunks, starting from the local origin
+  struct Chunk {
+    size_t begin, end;
+    Modal state;
+    bool seeded;
+  };
+  vector<Chunk> units;
+  for (size_t c = 0; c < chunks; c++) {
+    Modal state = c > 0 ? summaries[c - 1].apply(units.back().state) : Modal{};
+    units.push_back({chunk_begin(c), chunk_begin(c + 1), state, c > 0});
+  }
+  for (size_t k = 0; k < def_begin.size(); k++) {
+    size_t e = k + 1 < def_begin.size() ? def_begin[k + 1] : defs.size();
+    units.push_back({main_lines + def_begin[k], main_lines + e,
+                     Modal{0, 0, 0, {}, {}, {}, 0}, true});
+  }
+
+  // 3. full parsing of each chunk, in parallel. Only the last two blocks are
+  // kept, and the source buffer only holds the current line
+  vector<vector<Diagnostic>> found(units.size());
+  parallel_for(units.size(), [&](size_t b, size_t e) {
+    for (size_t c = b; c < e; c++) {
+      Source source;
+      optional<Block> slots[2];
+      Block *prev = nullptr;
+      Block::Errors errors;
+      if (units[c].seeded) {
+        slots[1].emplace(units[c].state.line(), source);
+        slots[1]->try_parse(_machine);
+        prev = &*slots[1];
+      }
+      for (size_t i = units[c].begin; i < units[c].end; i++) {
+        optional<Block> &slot = slots[(i - units[c].begin) % 2];
+        source.clear();
+        if (prev)
+          slot.emplace(lines[i], *prev);
+        else
+          slot.emplace(lines[i], source);
+        Block &block = *slot;
+        errors.clear();
+        block.try_parse(_machine, &errors);
+        for (auto &[error, detail] : errors)
+          found[c].push_back({numbers[i], error, detail});
+        // reported where the feedrate is set above the limit
+        if (block.feedrate() > _machine->fmax() &&
+            (!block.prev || block.prev->feedrate() != block.feedrate()))
+          found[c].push_back({numbers[i], Block::Error::FEED_OVER_FMAX,
+                              format("{}", block.feedrate())});
+        prev = &block;
+      }
+    }
+  }, threads);
+
+  for (auto &f : found)
+    _diagnostics.insert(_diagnostics.end(), f.begin(), f.end());
+  stable_sort(_diagnostics.begin(), _diagnostics.end(),
+              [](auto &a, auto &b) { return a.line < b.line; });
+  return _diagnostics;
+}
+
+
+
+
+/*
+  _____         _                     _
+ |_   _|__  ___| |_   _ __ ___   __ _(_)_ __
+   | |/ _ \/ __| __| | '_ ` _ \ / _` | | '_ \
+   | |  __/\__ \ |_  | | | | | | (_| | | | | |
+   |_|\___||___/\__| |_| |_| |_|\__,_|_|_| |_|
+
+*/
+
+#ifdef VALIDATOR_MAIN
+
+#include <chrono>
+#include <iostream>
+#include <rang.hpp>
+
+using namespace rang;
+
+// Usage: validator_test machine.yml program.gcode [threads]
+int main(int argc, const char *argv[]) {
+  if (argc < 3) {
+    cerr << "Usage: " << argv[0] << " <machine.yml> <file.gcode> [threads]"
+         << endl;
+    return 1;
+  }
+  Machine machine;
+  try {
+    machine.load(argv[1]);
+  } catch (exception &e) {
+    cerr << fg::red << style::bold << "Error: " << e.what()
+         << style::reset << fg::reset << endl;
+    return 1;
+  }
+  Validator validator(&machine, argc > 3 ? stoul(argv[3]) : 0);
+  auto start = chrono::steady_clock::now();
+  try {
+    validator.validate(argv[2]);
+  } catch (exception &e) {
+    cerr << fg::red << style::bold << "Error: " << e.what()
+         << style::reset << fg::reset << endl;
+    return 2;
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+  for (auto &d : validator.diagnostics()) {
+    cout << format("{}:{}: ", argv[2], d.line) << fg::red
+         << Block::errors.at(d.error) << fg::reset << format(" ({})", d.detail)
+         << endl;
+  }
+  cerr << style::bold << validator.desc() << style::reset
+       << format(" in {:.3f} s", elapsed.count()) << endl;
+  return validator.ok() ? 0 : 3;
+}
+
+#endif // VALIDATOR_MAIN
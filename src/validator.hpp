@@ -0,0 +1,66 @@
+/*
+ __     __    _ _     _       _                    _
+ \ \   / /_ _| (_) __| | __ _| |_ ___  _ __    ___| | __ _ ___ ___
+  \ \ / / _` | | |/ _` |/ _` | __/ _ \| '__|  / __| |/ _` / __/ __|
+   \ V / (_| | | | (_| | (_| | || (_) | |    | (__| | (_| \__ \__ \
+    \_/ \__,_|_|_|\__,_|\__,_|\__\___/|_|     \___|_|\__,_|___/___/
+
+Bulk validation of G-code files: every line is parsed with Block::try_parse
+(no exceptions) and all the errors are collected with their line number,
+instead of stopping at the first one as Program::load does.
+The file is split in chunks that are validated in parallel: a first, cheap
+pass scans the modal words (X, Y, Z, F, S, T, N) of each chunk, so that every
+chunk can start from the correct modal state. Subprogram bodies (O... M99)
+are validated on their own, starting from the local origin as in Program.
+*/
+#ifndef VALIDATOR_HPP
+#define VALIDATOR_HPP
+
+// INCLUDES AND DEFINES --------------------------------------------------------
+#include "defines.hpp"
+#include "block.hpp"
+#include "machine.hpp"
+#include <string>
+#include <string_view>
+#include <vector>
+
+// NAMESPACES AND CONSTANTS ----------------------------------------------------
+using namespace std;
+
+namespace cncpp {
+
+class Validator : Object {
+public:
+  struct Diagnostic {
+    size_t line;         // 1-based line number
+    Block::Error error;
+    string detail;       // offending token or value
+  };
+
+  // LIFECYCLE -----------------------------------------------------------------
+  // threads == 0 means all the available cores
+  Validator(const Machine *machine, unsigned threads = 0)
+      : _machine(machine), _threads(threads) {}
+  string desc(bool colored = true) const override;
+
+  // METHODS -------------------------------------------------------------------
+  // Validate a file, throws only if the file cannot be read
+  const vector<Diagnostic> &validate(const string &filename);
+  // Validate G-code text, one block per line
+  const vector<Diagnostic> &validate_text(string_view text);
+
+  // ACCESSORS -----------------------------------------------------------------
+  const vector<Diagnostic> &diagnostics() const { return _diagnostics; }
+  size_t lines() const { return _lines; }
+  bool ok() const { return _diagnostics.empty(); }
+
+private:
+  const Machine *_machine;
+  unsigned _threads;
+  size_t _lines = 0;
+  vector<Diagnostic> _diagnostics;
+};
+
+} // namespace cncpp
+
+#endif // VALIDATOR_HPP